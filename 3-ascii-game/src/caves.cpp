@@ -0,0 +1,276 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "types.hpp"
+
+#include "job_pool.cpp"
+#include "level.cpp"
+#include "proc_gen.cpp"
+#include "rng.cpp"
+
+/*
+ * Cellular automaton caves: random rock, then smoothing passes where a tile
+ * becomes rock when 5 or more of the 3x3 block around it are rock.
+ *
+ * The grid is one bit per tile, 64 tiles to a word, and a pass never looks at
+ * single tiles. Each row's left, center and right bits go through a full adder
+ * into a 2 bit count, the three rows' counts are added into a 4 bit count with
+ * more adders, and the >= 5 test is a couple of ands and ors on those bits.
+ * All of it is plain word logic, so the kernel is written on the compiler's
+ * vector type and comes out as NEON, AVX2 or SSE2 depending on the target, with
+ * a u64 loop for the tail of a row.
+ *
+ * Passes read one buffer and write the other. Rows are split into one slice per
+ * worker plus the main thread, a slice only writes its own rows. Rows carry a
+ * guard word on each side and there's a guard row above and below, all rock, so
+ * the edge of the map reads as rock without any bounds checks.
+ *
+ * Random fill uses one RNG stream per row, so the result doesn't depend on how
+ * rows were split across threads.
+ */
+
+#define CAVE_LANES 4
+#define CAVE_SLICES_MAX 16
+
+typedef u64 Cave_Lanes __attribute__((vector_size(CAVE_LANES * sizeof(u64))));
+
+struct Cave_Params
+{
+    u64 seed;
+    int cols, rows;
+    f32 rock_chance;
+    int iterations;
+};
+
+struct Cave_Result
+{
+    v2i spawn;
+    f32 fill_rate;
+};
+
+// Vectors only go through pointers, by value they'd depend on the target's vector ABI
+template <typename T>
+static inline void cave_load(T *out, const u64 *p)
+{
+    memcpy(out, p, sizeof(T));
+}
+
+// Rock count of each tile and its left and right neighbors as a 2 bit number
+template <typename T>
+static inline void cave_row_count(const u64 *row, int i, T *lo, T *hi)
+{
+    T prev, center, next;
+    cave_load(&prev, row + i - 1);
+    cave_load(&center, row + i);
+    cave_load(&next, row + i + 1);
+    T left = (center << 1) | (prev >> 63);
+    T right = (center >> 1) | (next << 63);
+    T half = left ^ center;
+    *lo = half ^ right;
+    *hi = (left & center) | (right & half);
+}
+
+template <typename T>
+static inline void cave_rule(const u64 *above, const u64 *here, const u64 *below, int i, u64 *out)
+{
+    T a_lo, a_hi, b_lo, b_hi, c_lo, c_hi;
+    cave_row_count<T>(above, i, &a_lo, &a_hi);
+    cave_row_count<T>(here, i, &b_lo, &b_hi);
+    cave_row_count<T>(below, i, &c_lo, &c_hi);
+
+    // Three 2 bit counts into one 0..9 count, bit0..bit3
+    T lo_half = a_lo ^ b_lo;
+    T bit0 = lo_half ^ c_lo;
+    T carry_2 = (a_lo & b_lo) | (c_lo & lo_half);
+    T hi_half = a_hi ^ b_hi;
+    T hi_sum = hi_half ^ c_hi;
+    T carry_4a = (a_hi & b_hi) | (c_hi & hi_half);
+    T bit1 = hi_sum ^ carry_2;
+    T carry_4b = hi_sum & carry_2;
+    T bit2 = carry_4a ^ carry_4b;
+    T bit3 = carry_4a & carry_4b;
+
+    T rock = bit3 | (bit2 & (bit1 | bit0));
+    memcpy(out + i, &rock, sizeof(T));
+}
+
+struct Cave_Automaton;
+
+struct Cave_Slice
+{
+    Cave_Automaton *automaton;
+    int row_min, row_max;
+};
+
+struct Cave_Automaton
+{
+    const Cave_Params *params;
+    int words;  // per row, guards not included
+    int stride; // words plus the two guards
+    u64 tail_mask; // bits of the last word inside the map
+    u64 *src;
+    u64 *dst;
+    bool is_fill_pass;
+
+    Cave_Slice slices[CAVE_SLICES_MAX];
+    int slice_count;
+    std::mutex mutex;
+    std::condition_variable slices_done;
+    int slices_left;
+
+    // Map row -1 and rows is the guard row
+    u64 *get_row(u64 *buffer, int row)
+    {
+        return buffer + (size_t)(row + 1) * stride + 1;
+    }
+
+    void fill_rows(int row_min, int row_max)
+    {
+        // Rock chance in 1/256 steps, built up from random words one binary digit at a time
+        int threshold = (int)(params->rock_chance * 256.0f + 0.5f);
+        if (threshold < 0) threshold = 0;
+        if (threshold > 256) threshold = 256;
+        for (int row = row_min; row < row_max; row++)
+        {
+            Rng rng = rng_make(params->seed, (u64)row);
+            u64 *out = get_row(dst, row);
+            for (int i = 0; i < words; i++)
+            {
+                u64 bits = threshold == 256 ? ~0ull : 0;
+                for (int digit = 0; digit < 8 && threshold < 256; digit++)
+                {
+                    u64 r = ((u64)rng_next(&rng) << 32) | rng_next(&rng);
+                    bits = (threshold >> digit) & 1 ? (bits | r) : (bits & r);
+                }
+                out[i] = bits;
+            }
+            out[words - 1] |= ~tail_mask;
+        }
+    }
+
+    void step_rows(int row_min, int row_max)
+    {
+        for (int row = row_min; row < row_max; row++)
+        {
+            const u64 *above = get_row(src, row - 1);
+            const u64 *here = get_row(src, row);
+            const u64 *below = get_row(src, row + 1);
+            u64 *out = get_row(dst, row);
+            int i = 0;
+            for (; i + CAVE_LANES <= words; i += CAVE_LANES)
+            {
+                cave_rule<Cave_Lanes>(above, here, below, i, out);
+            }
+            for (; i < words; i++)
+            {
+                cave_rule<u64>(above, here, below, i, out);
+            }
+            // Past the right edge stays rock
+            out[words - 1] |= ~tail_mask;
+        }
+    }
+
+    static void run_slice(Cave_Slice *slice)
+    {
+        Cave_Automaton *automaton = slice->automaton;
+        if (automaton->is_fill_pass) automaton->fill_rows(slice->row_min, slice->row_max);
+        else automaton->step_rows(slice->row_min, slice->row_max);
+    }
+
+    static void slice_job(void *data)
+    {
+        Cave_Slice *slice = (Cave_Slice *)data;
+        run_slice(slice);
+
+        Cave_Automaton *automaton = slice->automaton;
+        std::lock_guard<std::mutex> lock(automaton->mutex);
+        if (--automaton->slices_left == 0) automaton->slices_done.notify_all();
+    }
+
+    // Runs one pass over every row, the main thread takes the first slice. Blocks until all are done.
+    void run_pass(Job_Pool *pool)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slices_left = slice_count - 1;
+        }
+        for (int i = 1; i < slice_count; i++)
+        {
+            pool->push(slice_job, &slices[i]);
+        }
+        run_slice(&slices[0]);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        slices_done.wait(lock, [this]() { return slices_left == 0; });
+    }
+};
+
+// Runs the automaton into grid, set bits are rock. pool can be null to run on the main thread only.
+static void cave_run_automaton(Job_Pool *pool, const Cave_Params *params, Bit_Grid *grid)
+{
+    Cave_Automaton automaton;
+    automaton.params = params;
+    automaton.words = (params->cols + 63) / 64;
+    automaton.stride = automaton.words + 2;
+    automaton.tail_mask = params->cols % 64 == 0 ? ~0ull : (1ull << (params->cols % 64)) - 1;
+
+    // Everything starts as rock, which covers the guards
+    size_t buffer_words = (size_t)(params->rows + 2) * automaton.stride;
+    automaton.src = (u64 *)malloc(buffer_words * sizeof(u64));
+    automaton.dst = (u64 *)malloc(buffer_words * sizeof(u64));
+    memset(automaton.src, 0xFF, buffer_words * sizeof(u64));
+    memset(automaton.dst, 0xFF, buffer_words * sizeof(u64));
+
+    int slice_count = pool ? pool->get_worker_count() + 1 : 1;
+    if (slice_count > CAVE_SLICES_MAX) slice_count = CAVE_SLICES_MAX;
+    if (slice_count > params->rows) slice_count = params->rows > 0 ? params->rows : 1;
+    automaton.slice_count = slice_count;
+    for (int i = 0; i < slice_count; i++)
+    {
+        automaton.slices[i] = Cave_Slice{&automaton, params->rows * i / slice_count, params->rows * (i + 1) / slice_count};
+    }
+
+    automaton.is_fill_pass = true;
+    automaton.run_pass(pool);
+    automaton.is_fill_pass = false;
+    for (int i = 0; i < params->iterations; i++)
+    {
+        u64 *swap = automaton.src;
+        automaton.src = automaton.dst;
+        automaton.dst = swap;
+        automaton.run_pass(pool);
+    }
+
+    bit_grid_init(grid, params->cols, params->rows, true);
+    for (int row = 0; row < params->rows; row++)
+    {
+        memcpy(bit_grid_row(grid, row), automaton.get_row(automaton.dst, row), (size_t)automaton.words * sizeof(u64));
+    }
+    free(automaton.src);
+    free(automaton.dst);
+}
+
+Cave_Result generate_caves(Level *level, Job_Pool *pool, const Cave_Params *params)
+{
+    Cave_Result result = {};
+    int cols = params->cols;
+    int rows = params->rows;
+
+    Bit_Grid grid;
+    cave_run_automaton(pool, params, &grid);
+
+    // Seal the outer ring, the automaton only leans towards rock there
+    bit_grid_set_border(&grid, true);
+    result.spawn = bit_grid_find_clear_near_center(&grid);
+
+    i64 grid_tiles = (i64)grid.words_per_row * CHUNK_DIM * grid.word_rows;
+    result.fill_rate = (f32)(grid_tiles - bit_grid_count(&grid)) / (f32)((i64)cols * rows);
+
+    level_write_bit_grid(level, &grid, (MapTile){MAP_TILE_WALL, true, true}, (MapTile){MAP_TILE_GROUND, false, false});
+    bit_grid_free(&grid);
+    return result;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "types.hpp"
+
+#include "level.cpp"
+#include "proc_gen.cpp"
+#include "rng.cpp"
+
+/*
+ * Rooms and corridors, the native version of 4-proc-gen/proc_gen.py.
+ *
+ * Same recipe as the prototype: a few passes of random room attempts from big
+ * to small, a room is kept if it doesn't touch any kept so far, and each kept
+ * room is joined to the next by an L shaped corridor. Then random walks from
+ * room walls eat into the rock until the open fill rate is reached.
+ *
+ * What changed for big maps:
+ * - Attempts scale with the map area, per the prototype's 128x32 map.
+ * - Kept rooms are stamped into an occupancy grid, one bit per tile, covering
+ *   the rect with its max edges (the prototype's touching rule). An attempt
+ *   tests its own rows a word at a time instead of every room kept so far.
+ * - Rooms are joined in Hilbert order of their centers rather than placement
+ *   order, so corridors connect neighbors instead of crossing the whole map.
+ * - Everything is carved into a Bit_Grid and written to the level in one go.
+ *
+ * The same seed and size always give the same dungeon.
+ */
+
+#define DUNGEON_PASS_AREA (128 * 32)
+#define DUNGEON_WALK_STEPS 256
+
+struct Dungeon_Room
+{
+    int x, y, w, h;
+
+    v2i get_max()
+    {
+        return (v2i){{{x + w, y + h}}};
+    }
+
+    v2i get_center()
+    {
+        return (v2i){{{x + w / 2, y + h / 2}}};
+    }
+};
+
+struct Dungeon_Room_Pass
+{
+    int attempts; // per DUNGEON_PASS_AREA tiles
+    int min_w, max_w;
+    int min_h, max_h;
+};
+
+static const Dungeon_Room_Pass dungeon_room_passes[] = {
+    {10, 7, 20, 7, 15},
+    {10, 5, 15, 5, 13},
+    {100, 5, 8, 5, 6},
+};
+
+struct Dungeon_Params
+{
+    u64 seed;
+    int cols, rows;
+    f32 walk_fill; // open fill rate the random walks carve up to, 0 for rooms and corridors only
+};
+
+struct Dungeon_Result
+{
+    v2i spawn;
+    int room_count;
+    f32 fill_rate;
+};
+
+// Same as the prototype's Room.intersect against every kept room: touching counts, so rooms always keep a wall between them
+static bool dungeon_room_is_free(Bit_Grid *occupied, Dungeon_Room room)
+{
+    v2i max = room.get_max();
+    for (int row = room.y; row <= max.y; row++)
+    {
+        if (bit_grid_any_in_span(occupied, row, room.x, max.x)) return false;
+    }
+    return true;
+}
+
+// Position along a Hilbert curve over a 65536 x 65536 square, consecutive positions are always neighbors
+static u32 dungeon_hilbert_index(u32 x, u32 y)
+{
+    u32 d = 0;
+    for (u32 s = 1u << 15; s > 0; s >>= 1)
+    {
+        u32 rx = (x & s) ? 1 : 0;
+        u32 ry = (y & s) ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant so the curve stays continuous
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            u32 t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+static void dungeon_carve_room(Bit_Grid *grid, Dungeon_Room room)
+{
+    v2i max = room.get_max();
+    for (int row = room.y + 1; row < max.y - 1; row++)
+    {
+        bit_grid_set_span(grid, row, room.x + 1, max.x - 2, false);
+    }
+}
+
+static void dungeon_carve_corridor(Bit_Grid *grid, Rng *rng, v2i a, v2i b)
+{
+    int x_min = a.x < b.x ? a.x : b.x;
+    int x_max = a.x < b.x ? b.x : a.x;
+    int y_min = a.y < b.y ? a.y : b.y;
+    int y_max = a.y < b.y ? b.y : a.y;
+    bool is_horizontal_first = rng_next(rng) & 1;
+    bit_grid_set_span(grid, is_horizontal_first ? a.y : b.y, x_min, x_max, false);
+    int col = is_horizontal_first ? b.x : a.x;
+    for (int row = y_min; row <= y_max; row++)
+    {
+        bit_grid_set(grid, col, row, false);
+    }
+}
+
+Dungeon_Result generate_dungeon(Level *level, const Dungeon_Params *params)
+{
+    Dungeon_Result result = {};
+    int cols = params->cols;
+    int rows = params->rows;
+    Rng rng = rng_make(params->seed);
+
+    Bit_Grid grid;
+    bit_grid_init(&grid, cols, rows, true);
+
+    // One past the size, a room's max edge can sit on cols or rows
+    Bit_Grid occupied;
+    bit_grid_init(&occupied, cols + 1, rows + 1, false);
+    std::vector<Dungeon_Room> rooms;
+    i64 area = (i64)cols * rows;
+    for (const Dungeon_Room_Pass &pass : dungeon_room_passes)
+    {
+        if (cols < pass.max_w || rows < pass.max_h) continue;
+        i64 attempts = (i64)pass.attempts * area / DUNGEON_PASS_AREA;
+        for (i64 i = 0; i < attempts; i++)
+        {
+            Dungeon_Room room;
+            room.w = rng_range(&rng, pass.min_w, pass.max_w);
+            room.h = rng_range(&rng, pass.min_h, pass.max_h);
+            room.x = rng_range(&rng, 0, cols - room.w);
+            room.y = rng_range(&rng, 0, rows - room.h);
+            if (!dungeon_room_is_free(&occupied, room)) continue;
+            for (int row = room.y; row <= room.y + room.h; row++)
+            {
+                bit_grid_set_span(&occupied, row, room.x, room.x + room.w, true);
+            }
+            rooms.push_back(room);
+        }
+    }
+    result.room_count = (int)rooms.size();
+    bit_grid_free(&occupied);
+
+    for (Dungeon_Room &room : rooms)
+    {
+        dungeon_carve_room(&grid, room);
+    }
+
+    // Curve position in the high half, room index in the low half
+    std::vector<u64> order(rooms.size());
+    for (size_t i = 0; i < rooms.size(); i++)
+    {
+        v2i center = rooms[i].get_center();
+        order[i] = ((u64)dungeon_hilbert_index((u32)center.x, (u32)center.y) << 32) | i;
+    }
+    std::sort(order.begin(), order.end());
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        dungeon_carve_corridor(&grid, &rng, rooms[(u32)order[i - 1]].get_center(), rooms[(u32)order[i]].get_center());
+    }
+
+    result.spawn = rooms.empty() ? (v2i){{{cols / 2, rows / 2}}} : rooms[(u32)order[0]].get_center();
+    bit_grid_set(&grid, result.spawn.x, result.spawn.y, false);
+
+    // Everything past cols and rows is rock, so the open count is what's missing from the whole grid
+    i64 grid_tiles = (i64)grid.words_per_row * CHUNK_DIM * grid.word_rows;
+    i64 open = grid_tiles - bit_grid_count(&grid);
+    i64 target = (i64)(params->walk_fill * (f32)area);
+    if (open < target && cols > 2 && rows > 2)
+    {
+        // Bounded so a fill rate that can't be reached still finishes
+        i64 steps_left = area * 8;
+        while (open < target && steps_left > 0)
+        {
+            // From a random tile along the inside of a room's wall, walking from the middle mostly retreads the floor
+            v2i p = result.spawn;
+            if (!rooms.empty())
+            {
+                Dungeon_Room room = rooms[rng_range(&rng, 0, (int)rooms.size() - 1)];
+                v2i max = room.get_max();
+                u32 side = rng_next(&rng) & 3;
+                if (side < 2)
+                {
+                    p.x = side == 0 ? room.x + 1 : max.x - 2;
+                    p.y = rng_range(&rng, room.y + 1, max.y - 2);
+                }
+                else
+                {
+                    p.x = rng_range(&rng, room.x + 1, max.x - 2);
+                    p.y = side == 2 ? room.y + 1 : max.y - 2;
+                }
+            }
+            u32 dirs = 0;
+            for (int step = 0; step < DUNGEON_WALK_STEPS && open < target; step++, steps_left--)
+            {
+                static const int walk_dx[4] = {1, -1, 0, 0};
+                static const int walk_dy[4] = {0, 0, 1, -1};
+                // 16 steps per random number
+                if ((step & 15) == 0) dirs = rng_next(&rng);
+                int dir = (int)(dirs & 3);
+                dirs >>= 2;
+                int x = p.x + walk_dx[dir];
+                int y = p.y + walk_dy[dir];
+                // Keep the outer ring solid, a step into it is a step in place
+                bool is_inside = x >= 1 && y >= 1 && x < cols - 1 && y < rows - 1;
+                p.x = is_inside ? x : p.x;
+                p.y = is_inside ? y : p.y;
+
+                // Branch free, whether the walker is in rock or not is a coin flip for the predictor
+                u64 *word = &bit_grid_row(&grid, p.y)[p.x >> 6];
+                u64 bit = 1ull << (p.x & 63);
+                open += (*word & bit) != 0;
+                *word &= ~bit;
+            }
+        }
+    }
+    result.fill_rate = (f32)open / (f32)area;
+
+    level_write_bit_grid(level, &grid, (MapTile){MAP_TILE_WALL, true, true}, (MapTile){MAP_TILE_GROUND, false, false});
+    bit_grid_free(&grid);
+    return result;
+}
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+
+#include "types.hpp"
+#include "util.hpp"
+
+#include "level.cpp"
+
+/*
+ * Dijkstra maps: distance in steps from the nearest goal for every tile in a
+ * FLOW_DIM square window. 8 directions at one step each, diagonal steps can't
+ * cut wall corners, same moves as the pathfinder. Any number of entities can
+ * follow the field downhill with flow_get_step(), one lookup per neighbor.
+ *
+ * The full build is a breadth first search done a whole row of words at a time:
+ * the frontier, the visited set and the open tiles are bitsets, and each level
+ * expands the frontier with shifts and masks over every row it touches.
+ *
+ * flow_on_tile_changed() repairs the field after a wall goes up or comes down
+ * without rebuilding it: tiles whose distance may have leaned on the changed
+ * tile are cleared, then refilled from their still valid neighbors in distance
+ * order.
+ */
+
+#define FLOW_DIM 256
+#define FLOW_WORDS (FLOW_DIM / 64)
+#define FLOW_GOALS_MAX 64
+#define FLOW_UNREACHABLE 0xFFFF
+
+struct Flow_Field
+{
+    v2i window_min;
+    bool is_valid;
+
+    v2i goals[FLOW_GOALS_MAX];
+    int goal_count;
+
+    // Walkable snapshot of the window, kept in sync by flow_on_tile_changed
+    u64 open[FLOW_DIM][FLOW_WORDS];
+    u16 dist[FLOW_DIM][FLOW_DIM];
+
+    int build_count;
+    int repair_count;
+    int last_repair_size;
+};
+
+struct Flow_Queue_Entry
+{
+    u16 x, y;
+    u16 dist;
+};
+
+// Repair scratch, main thread only
+static Flow_Queue_Entry g_flow_seeds[FLOW_DIM * FLOW_DIM];
+static Flow_Queue_Entry g_flow_queue[FLOW_DIM * FLOW_DIM];
+static u64 g_flow_seeded[FLOW_DIM][FLOW_WORDS];
+
+static inline bool flow_is_open(Flow_Field *field, int x, int y)
+{
+    if (x < 0 || y < 0 || x >= FLOW_DIM || y >= FLOW_DIM) return false;
+    return (field->open[y][x >> 6] >> (x & 63)) & 1;
+}
+
+// Same move rules as path_get_directions: diagonals need both sides open
+static inline bool flow_can_step(Flow_Field *field, int x, int y, int dx, int dy)
+{
+    if (!flow_is_open(field, x + dx, y + dy)) return false;
+    if (dx != 0 && dy != 0) return flow_is_open(field, x + dx, y) && flow_is_open(field, x, y + dy);
+    return true;
+}
+
+// Toward higher x
+static inline void flow_shift_up(const u64 *src, u64 *dst)
+{
+    for (int w = FLOW_WORDS - 1; w >= 0; w--)
+    {
+        dst[w] = (src[w] << 1) | (w > 0 ? src[w - 1] >> 63 : 0);
+    }
+}
+
+// Toward lower x
+static inline void flow_shift_down(const u64 *src, u64 *dst)
+{
+    for (int w = 0; w < FLOW_WORDS; w++)
+    {
+        dst[w] = (src[w] >> 1) | (w < FLOW_WORDS - 1 ? src[w + 1] << 63 : 0);
+    }
+}
+
+static void flow_build(Level *level, Flow_Field *field, const v2i *goals, int goal_count, v2i center)
+{
+    field->window_min = (v2i){{{center.x - FLOW_DIM / 2, center.y - FLOW_DIM / 2}}};
+    field->goal_count = goal_count < FLOW_GOALS_MAX ? goal_count : FLOW_GOALS_MAX;
+    memcpy(field->goals, goals, field->goal_count * sizeof(v2i));
+
+    for (int y = 0; y < FLOW_DIM; y++)
+    {
+        for (int w = 0; w < FLOW_WORDS; w++)
+        {
+            field->open[y][w] = ~level->get_row_bits(TILE_PLANE_BLOCKING, field->window_min.x + w * 64, field->window_min.y + y);
+        }
+    }
+    memset(field->dist, 0xFF, sizeof(field->dist));
+
+    static u64 frontier[FLOW_DIM + 2][FLOW_WORDS];
+    static u64 next[FLOW_DIM + 2][FLOW_WORDS];
+    static u64 visited[FLOW_DIM][FLOW_WORDS];
+    memset(frontier, 0, sizeof(frontier));
+    memset(visited, 0, sizeof(visited));
+
+    // Rows are offset by one in frontier and next so row - 1 and row + 1 never go out of bounds
+    int row_min = FLOW_DIM;
+    int row_max = -1;
+    for (int i = 0; i < field->goal_count; i++)
+    {
+        int x = field->goals[i].x - field->window_min.x;
+        int y = field->goals[i].y - field->window_min.y;
+        if (!flow_is_open(field, x, y)) continue;
+        frontier[y + 1][x >> 6] |= 1ull << (x & 63);
+        visited[y][x >> 6] |= 1ull << (x & 63);
+        field->dist[y][x] = 0;
+        if (y < row_min) row_min = y;
+        if (y > row_max) row_max = y;
+    }
+
+    for (u16 level_dist = 1; row_min <= row_max; level_dist++)
+    {
+        int next_min = FLOW_DIM;
+        int next_max = -1;
+        int y_begin = row_min > 0 ? row_min - 1 : 0;
+        int y_end = row_max < FLOW_DIM - 1 ? row_max + 1 : FLOW_DIM - 1;
+        for (int y = y_begin; y <= y_end; y++)
+        {
+            const u64 *open_row = field->open[y];
+            const u64 *above = frontier[y];
+            const u64 *here = frontier[y + 1];
+            const u64 *below = frontier[y + 2];
+
+            u64 nearby = 0;
+            for (int w = 0; w < FLOW_WORDS; w++)
+            {
+                nearby |= above[w] | here[w] | below[w];
+            }
+            if (!nearby)
+            {
+                memset(next[y + 1], 0, sizeof(next[0]));
+                continue;
+            }
+
+            u64 left[FLOW_WORDS], right[FLOW_WORDS];
+            flow_shift_up(here, left);
+            flow_shift_down(here, right);
+
+            // Diagonal sources: a frontier tile in the row above or below whose step into this row is open
+            u64 from_above[FLOW_WORDS], from_below[FLOW_WORDS];
+            u64 above_up[FLOW_WORDS], above_down[FLOW_WORDS], below_up[FLOW_WORDS], below_down[FLOW_WORDS];
+            for (int w = 0; w < FLOW_WORDS; w++)
+            {
+                from_above[w] = y > 0 ? above[w] & open_row[w] : 0;
+                from_below[w] = y < FLOW_DIM - 1 ? below[w] & open_row[w] : 0;
+            }
+            flow_shift_up(from_above, above_up);
+            flow_shift_down(from_above, above_down);
+            flow_shift_up(from_below, below_up);
+            flow_shift_down(from_below, below_down);
+
+            bool any = false;
+            for (int w = 0; w < FLOW_WORDS; w++)
+            {
+                u64 open_above = y > 0 ? field->open[y - 1][w] : 0;
+                u64 open_below = y < FLOW_DIM - 1 ? field->open[y + 1][w] : 0;
+                u64 reached = left[w] | right[w] | above[w] | below[w]
+                            | ((above_up[w] | above_down[w]) & open_above)
+                            | ((below_up[w] | below_down[w]) & open_below);
+                u64 fresh = reached & open_row[w] & ~visited[y][w];
+                next[y + 1][w] = fresh;
+                visited[y][w] |= fresh;
+                any = any || fresh;
+
+                while (fresh)
+                {
+                    int x = w * 64 + __builtin_ctzll(fresh);
+                    fresh &= fresh - 1;
+                    field->dist[y][x] = level_dist;
+                }
+            }
+            if (any)
+            {
+                if (y < next_min) next_min = y;
+                if (y > next_max) next_max = y;
+            }
+        }
+
+        // Rows outside this range are already zero
+        for (int y = y_begin; y <= y_end; y++)
+        {
+            memcpy(frontier[y + 1], next[y + 1], sizeof(frontier[0]));
+        }
+        row_min = next_min;
+        row_max = next_max;
+    }
+
+    field->is_valid = true;
+    field->build_count++;
+}
+
+static inline u16 flow_get_distance(Flow_Field *field, int col, int row)
+{
+    int x = col - field->window_min.x;
+    int y = row - field->window_min.y;
+    if (!field->is_valid || x < 0 || y < 0 || x >= FLOW_DIM || y >= FLOW_DIM) return FLOW_UNREACHABLE;
+    return field->dist[y][x];
+}
+
+// Downhill direction from a tile, zero at a goal or where nothing is reachable
+static v2i flow_get_step(Flow_Field *field, int col, int row)
+{
+    v2i best = {};
+    u16 best_dist = flow_get_distance(field, col, row);
+    if (best_dist == FLOW_UNREACHABLE) return best;
+
+    int x = col - field->window_min.x;
+    int y = row - field->window_min.y;
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            if ((dx == 0 && dy == 0) || !flow_can_step(field, x, y, dx, dy)) continue;
+            u16 d = field->dist[y + dy][x + dx];
+            if (d < best_dist)
+            {
+                best_dist = d;
+                best = (v2i){{{dx, dy}}};
+            }
+        }
+    }
+    return best;
+}
+
+// Call after the blocking bit of a tile changed, keeps the field exact without a rebuild
+static void flow_on_tile_changed(Level *level, Flow_Field *field, int col, int row)
+{
+    int tx = col - field->window_min.x;
+    int ty = row - field->window_min.y;
+    if (!field->is_valid || tx < 0 || ty < 0 || tx >= FLOW_DIM || ty >= FLOW_DIM) return;
+
+    bool is_open = !level->get_tile_bit(TILE_PLANE_BLOCKING, col, row);
+    u64 bit = 1ull << (tx & 63);
+    field->open[ty][tx >> 6] = is_open ? (field->open[ty][tx >> 6] | bit) : (field->open[ty][tx >> 6] & ~bit);
+
+    // Clear the changed tile and, if it closed, everything that may have routed through it or
+    // around its corners: its neighbors and their descendants (one step further, one more away)
+    int cleared = 0;
+    g_flow_queue[cleared++] = Flow_Queue_Entry{(u16)tx, (u16)ty, field->dist[ty][tx]};
+    field->dist[ty][tx] = FLOW_UNREACHABLE;
+    if (!is_open)
+    {
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int x = tx + dx;
+                int y = ty + dy;
+                if (x < 0 || y < 0 || x >= FLOW_DIM || y >= FLOW_DIM || field->dist[y][x] == FLOW_UNREACHABLE) continue;
+                g_flow_queue[cleared++] = Flow_Queue_Entry{(u16)x, (u16)y, field->dist[y][x]};
+                field->dist[y][x] = FLOW_UNREACHABLE;
+            }
+        }
+        for (int i = 1; i < cleared; i++)
+        {
+            Flow_Queue_Entry e = g_flow_queue[i];
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int x = e.x + dx;
+                    int y = e.y + dy;
+                    if (x < 0 || y < 0 || x >= FLOW_DIM || y >= FLOW_DIM) continue;
+                    if (e.dist == FLOW_UNREACHABLE || field->dist[y][x] != e.dist + 1) continue;
+                    g_flow_queue[cleared++] = Flow_Queue_Entry{(u16)x, (u16)y, field->dist[y][x]};
+                    field->dist[y][x] = FLOW_UNREACHABLE;
+                }
+            }
+        }
+    }
+
+    // Seeds: still valid tiles bordering the cleared ones, and goals that got cleared
+    int seed_count = 0;
+    memset(g_flow_seeded, 0, sizeof(g_flow_seeded));
+    for (int i = 0; i < field->goal_count; i++)
+    {
+        int x = field->goals[i].x - field->window_min.x;
+        int y = field->goals[i].y - field->window_min.y;
+        if (flow_is_open(field, x, y) && field->dist[y][x] == FLOW_UNREACHABLE)
+        {
+            field->dist[y][x] = 0;
+            g_flow_seeded[y][x >> 6] |= 1ull << (x & 63);
+            g_flow_seeds[seed_count++] = Flow_Queue_Entry{(u16)x, (u16)y, 0};
+        }
+    }
+    for (int i = 0; i < cleared; i++)
+    {
+        Flow_Queue_Entry e = g_flow_queue[i];
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int x = e.x + dx;
+                int y = e.y + dy;
+                if (x < 0 || y < 0 || x >= FLOW_DIM || y >= FLOW_DIM || field->dist[y][x] == FLOW_UNREACHABLE) continue;
+                u64 seed_bit = 1ull << (x & 63);
+                if (g_flow_seeded[y][x >> 6] & seed_bit) continue;
+                g_flow_seeded[y][x >> 6] |= seed_bit;
+                g_flow_seeds[seed_count++] = Flow_Queue_Entry{(u16)x, (u16)y, field->dist[y][x]};
+            }
+        }
+    }
+    qsort(g_flow_seeds, seed_count, sizeof(Flow_Queue_Entry), [](const void *a, const void *b) {
+        return (int)((const Flow_Queue_Entry *)a)->dist - (int)((const Flow_Queue_Entry *)b)->dist;
+    });
+
+    // Unit steps: merging the sorted seeds with a FIFO pops tiles in distance order, no heap needed
+    int seed_next = 0;
+    int queue_head = 0;
+    int queue_tail = 0;
+    while (seed_next < seed_count || queue_head < queue_tail)
+    {
+        Flow_Queue_Entry e;
+        if (queue_head == queue_tail || (seed_next < seed_count && g_flow_seeds[seed_next].dist <= g_flow_queue[queue_head].dist))
+        {
+            e = g_flow_seeds[seed_next++];
+        }
+        else
+        {
+            e = g_flow_queue[queue_head++];
+        }
+        if (e.dist != field->dist[e.y][e.x]) continue;
+
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                if ((dx == 0 && dy == 0) || !flow_can_step(field, e.x, e.y, dx, dy)) continue;
+                int x = e.x + dx;
+                int y = e.y + dy;
+                if (field->dist[y][x] <= e.dist + 1) continue;
+                field->dist[y][x] = e.dist + 1;
+                g_flow_queue[queue_tail++] = Flow_Queue_Entry{(u16)x, (u16)y, (u16)(e.dist + 1)};
+            }
+        }
+    }
+
+    field->repair_count++;
+    field->last_repair_size = cleared;
+}
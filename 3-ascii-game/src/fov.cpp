@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "types.hpp"
+#include "util.hpp"
+
+#include "level.cpp"
+
+/*
+ * Recursive shadowcasting over the opaque bitplane.
+ *
+ * A Fov covers a square window of 2 * radius + 1 tiles around its origin. The
+ * opaque plane for the window is pulled in a word at a time, the octants are
+ * cast against that local copy, and the result stays in the Fov as one bit
+ * per tile. fov_update() only recomputes when the origin moved to another
+ * tile, the radius changed, or a chunk under the window changed opacity (or
+ * got paged in or out), so a viewer standing still costs a few compares.
+ */
+
+#define FOV_RADIUS_MAX 63
+#define FOV_DIM_MAX (2 * FOV_RADIUS_MAX + 1)
+#define FOV_WORDS 2
+#define FOV_CHUNKS_MAX 9
+
+static_assert(FOV_DIM_MAX <= FOV_WORDS * 64, "FOV window row must fit in FOV_WORDS");
+static_assert(FOV_DIM_MAX <= 2 * CHUNK_DIM + 1, "FOV window must span at most 3 chunks per axis");
+
+struct Fov_Chunk_Version
+{
+    v2i coord;
+    u32 version;
+};
+
+struct Fov
+{
+    v2i origin;
+    int radius;
+    v2i window_min;
+    int window_dim;
+    bool is_valid;
+
+    u64 visible[FOV_DIM_MAX][FOV_WORDS];
+
+    Fov_Chunk_Version chunk_versions[FOV_CHUNKS_MAX];
+    int chunk_version_count;
+
+    int compute_count;
+};
+
+struct Fov_Cast
+{
+    Fov *fov;
+    const u64 (*opaque)[FOV_WORDS];
+    int radius;
+};
+
+static inline bool fov_window_bit(const u64 (*rows)[FOV_WORDS], int x, int y)
+{
+    return (rows[y][x >> 6] >> (x & 63)) & 1;
+}
+
+static inline u32 fov_get_chunk_version(Level *level, int chunk_x, int chunk_y)
+{
+    Chunk *chunk = level->chunks.find(chunk_x, chunk_y);
+    return chunk ? chunk->opaque_version : 0;
+}
+
+static void fov_cast_octant(Fov_Cast *cast, int row, f32 start_slope, f32 end_slope, int xx, int xy, int yx, int yy)
+{
+    if (start_slope < end_slope) return;
+
+    int radius = cast->radius;
+    int center = radius;
+    f32 next_start_slope = start_slope;
+    for (int distance = row; distance <= radius; distance++)
+    {
+        bool is_blocked = false;
+        int dy = -distance;
+        // Skip straight to the first tile under start_slope instead of walking the row, the check below stays exact
+        int dx_begin = (int)floorf(start_slope * (dy - 0.5f) - 0.5f);
+        if (dx_begin < -distance) dx_begin = -distance;
+        for (int dx = dx_begin; dx <= 0; dx++)
+        {
+            f32 left_slope = (dx - 0.5f) / (dy + 0.5f);
+            f32 right_slope = (dx + 0.5f) / (dy - 0.5f);
+            if (start_slope < right_slope) continue;
+            if (end_slope > left_slope) break;
+
+            int x = center + dx * xx + dy * xy;
+            int y = center + dx * yx + dy * yy;
+            if (dx * dx + dy * dy <= radius * radius)
+            {
+                cast->fov->visible[y][x >> 6] |= 1ull << (x & 63);
+            }
+
+            bool is_opaque = fov_window_bit(cast->opaque, x, y);
+            if (is_blocked)
+            {
+                if (is_opaque)
+                {
+                    next_start_slope = right_slope;
+                    continue;
+                }
+                is_blocked = false;
+                start_slope = next_start_slope;
+            }
+            else if (is_opaque && distance < radius)
+            {
+                is_blocked = true;
+                fov_cast_octant(cast, distance + 1, start_slope, left_slope, xx, xy, yx, yy);
+                next_start_slope = right_slope;
+            }
+        }
+        if (is_blocked) break;
+    }
+}
+
+static void fov_compute(Level *level, Fov *fov, v2i origin, int radius)
+{
+    if (radius > FOV_RADIUS_MAX) radius = FOV_RADIUS_MAX;
+    if (radius < 0) radius = 0;
+
+    fov->origin = origin;
+    fov->radius = radius;
+    fov->window_dim = 2 * radius + 1;
+    fov->window_min = (v2i){{{origin.x - radius, origin.y - radius}}};
+    memset(fov->visible, 0, sizeof(fov->visible));
+
+    // Local copy of the opaque plane, two row reads per window row
+    u64 opaque[FOV_DIM_MAX][FOV_WORDS];
+    for (int y = 0; y < fov->window_dim; y++)
+    {
+        for (int w = 0; w < FOV_WORDS; w++)
+        {
+            opaque[y][w] = level->get_row_bits(TILE_PLANE_OPAQUE, fov->window_min.x + w * 64, fov->window_min.y + y);
+        }
+    }
+
+    fov->visible[radius][radius >> 6] |= 1ull << (radius & 63);
+
+    static const int octants[8][4] = {
+        { 1,  0,  0,  1}, { 0,  1,  1,  0}, { 0, -1,  1,  0}, {-1,  0,  0,  1},
+        {-1,  0,  0, -1}, { 0, -1, -1,  0}, { 0,  1, -1,  0}, { 1,  0,  0, -1},
+    };
+    Fov_Cast cast = {fov, opaque, radius};
+    for (int i = 0; i < 8; i++)
+    {
+        fov_cast_octant(&cast, 1, 1.0f, 0.0f, octants[i][0], octants[i][1], octants[i][2], octants[i][3]);
+    }
+
+    fov->chunk_version_count = 0;
+    int chunk_min_x = tile_to_chunk(fov->window_min.x);
+    int chunk_min_y = tile_to_chunk(fov->window_min.y);
+    int chunk_max_x = tile_to_chunk(fov->window_min.x + fov->window_dim - 1);
+    int chunk_max_y = tile_to_chunk(fov->window_min.y + fov->window_dim - 1);
+    for (int chunk_y = chunk_min_y; chunk_y <= chunk_max_y; chunk_y++)
+    {
+        for (int chunk_x = chunk_min_x; chunk_x <= chunk_max_x; chunk_x++)
+        {
+            Fov_Chunk_Version *v = &fov->chunk_versions[fov->chunk_version_count++];
+            v->coord = (v2i){{{chunk_x, chunk_y}}};
+            v->version = fov_get_chunk_version(level, chunk_x, chunk_y);
+        }
+    }
+
+    fov->is_valid = true;
+    fov->compute_count++;
+}
+
+// Returns true if it had to recompute
+static bool fov_update(Level *level, Fov *fov, v2i origin, int radius)
+{
+    bool is_stale = !fov->is_valid || fov->origin.x != origin.x || fov->origin.y != origin.y || fov->radius != radius;
+    for (int i = 0; !is_stale && i < fov->chunk_version_count; i++)
+    {
+        Fov_Chunk_Version *v = &fov->chunk_versions[i];
+        is_stale = fov_get_chunk_version(level, v->coord.x, v->coord.y) != v->version;
+    }
+    if (!is_stale) return false;
+
+    fov_compute(level, fov, origin, radius);
+    return true;
+}
+
+static bool fov_is_visible(Fov *fov, int col, int row)
+{
+    int x = col - fov->window_min.x;
+    int y = row - fov->window_min.y;
+    if (!fov->is_valid || x < 0 || y < 0 || x >= fov->window_dim || y >= fov->window_dim) return false;
+    return fov_window_bit(fov->visible, x, y);
+}
+
+// Copies the fov into the chunks' visible bits and adds it to their explored bits
+static void fov_apply_to_level(Level *level, Fov *fov)
+{
+    for (Chunk *chunk : level->visible_chunks)
+    {
+        memset(chunk->visible, 0, sizeof(chunk->visible));
+    }
+    level->visible_chunks.clear();
+
+    Chunk *last_chunk = nullptr;
+    for (int y = 0; y < fov->window_dim; y++)
+    {
+        int row = fov->window_min.y + y;
+        for (int w = 0; w < FOV_WORDS; w++)
+        {
+            u64 bits = fov->visible[y][w];
+            while (bits)
+            {
+                int x = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                int col = fov->window_min.x + x;
+                Chunk *chunk = level->find_chunk(tile_to_chunk(col), tile_to_chunk(row));
+                if (!chunk) continue;
+                if (chunk != last_chunk)
+                {
+                    // At most FOV_CHUNKS_MAX entries
+                    bool is_listed = false;
+                    for (Chunk *listed : level->visible_chunks)
+                    {
+                        if (listed == chunk) is_listed = true;
+                    }
+                    if (!is_listed) level->visible_chunks.push_back(chunk);
+                    last_chunk = chunk;
+                }
+
+                int local_row = tile_to_local(row);
+                u64 bit = 1ull << tile_to_local(col);
+                chunk->visible[local_row] |= bit;
+                if (chunk->data && !(chunk->data->explored[local_row] & bit))
+                {
+                    chunk->data->explored[local_row] |= bit;
+                    chunk->is_dirty = true;
+                }
+            }
+        }
+    }
+}
@@ -1,18 +1,28 @@
 #pragma once
 
+#include <chrono>
+
 #include <imgui.h>
 
 #include "types.hpp"
 
 #include "gl_tiles.cpp"
-
-#define GAME_COLOR_BLACK (v4){{{0.0f, 0.0f, 0.0f, 1.0f}}}
-#define GAME_COLOR_RED   (v4){{{1.0f, 0.0f, 0.0f, 1.0f}}}
-#define GAME_COLOR_GRAY1 (v4){{{0.1f, 0.1f, 0.1f, 1.0f}}}
-#define GAME_COLOR_GRAY3 (v4){{{0.5f, 0.5f, 0.5f, 1.0f}}}
-#define GAME_COLOR_GRAY4 (v4){{{0.7f, 0.7f, 0.7f, 1.0f}}}
-#define GAME_COLOR_GRAY5 (v4){{{0.85f, 0.85f, 0.85f, 1.0f}}}
-#define GAME_COLOR_ENTITY_BG (v4){{{0.3f, 0.3f, 0.3f, 0.8f}}}
+#include "level.cpp"
+#include "fov.cpp"
+#include "pathfinding.cpp"
+#include "flow_field.cpp"
+#include "hpa.cpp"
+#include "regions.cpp"
+#include "dungeon.cpp"
+#include "caves.cpp"
+#include "overworld.cpp"
+#include "wfc.cpp"
+
+#define GAME_COLOR_FOG_EXPLORED (v4){{{0.0f, 0.0f, 0.0f, 0.6f}}}
+#define GAME_COLOR_PATH (v4){{{0.9f, 0.8f, 0.2f, 0.35f}}}
+
+#define GAME_PATH_POINTS_MAX 256
+#define GAME_ROUTE_POINTS_MAX 1024
 
 struct Rect
 {
@@ -45,16 +55,10 @@ struct Rect
     }
 };
 
-struct Glyph
-{
-    int col, row;
-    v4 fg_color, bg_color;
-};
-
 Rect get_rect_for_tilemap_glyph(Glyph g)
 {
-    const int tilemap_rows = 16;
-    const int tilemap_cols = 16;
+    const int tilemap_rows = TILESET_ROWS;
+    const int tilemap_cols = TILESET_COLS;
     f32 q_w = 1.0f / tilemap_rows;
     f32 q_h = 1.0f / tilemap_cols;
     Rect result = {
@@ -64,150 +68,59 @@ Rect get_rect_for_tilemap_glyph(Glyph g)
     return result;
 }
 
-enum MapTileKind
-{
-    MAP_TILE_NONE,
-    MAP_TILE_GROUND,
-    MAP_TILE_WALL,
-    MAP_TILE_COUNT
-};
-
-struct MapTile
-{
-    MapTileKind kind;
-    bool is_blocking;
-    bool is_opaque;
-
-    Glyph get_glyph()
-    {
-        switch(kind)
-        {
-            case MAP_TILE_GROUND: return (Glyph){14, 2, GAME_COLOR_GRAY3, GAME_COLOR_GRAY1};
-            case MAP_TILE_WALL:   return (Glyph){3, 2,  GAME_COLOR_GRAY4, GAME_COLOR_GRAY1};
-            default:              return (Glyph){0, 0,  GAME_COLOR_RED,   GAME_COLOR_RED};
-        }
-    }
-
-    const char *get_name()
-    {
-        switch (kind)
-        {
-            case MAP_TILE_GROUND: return "Ground";
-            case MAP_TILE_WALL: return "Wall";
-
-            case MAP_TILE_NONE:
-            case MAP_TILE_COUNT:
-                return "Unknown";
-        }
-    }
-};
-
 static inline Glyph get_player_glyph()
 {
     return (Glyph){0, 4, GAME_COLOR_GRAY5, GAME_COLOR_ENTITY_BG};
 }
 
-f32 get_glyph_dim();
-
-struct Level
+struct Level_Draw_Stats
 {
-    static constexpr int COLS = 32;
-    static constexpr int ROWS = 32;
-    MapTile tiles[ROWS][COLS];
-
-    void set_tile(int col, int row, MapTile tile)
-    {
-        if (col >= 0 && col < COLS && row >= 0 && row < ROWS)
-        {
-            tiles[row][col] = tile;
-        }
-        else
-        {
-            warning("Out of bounds map access");
-        }
-    }
-
-    MapTile get_tile(int col, int row)
-    {
-        if (col >= 0 && col < COLS && row >= 0 && row < ROWS)
-        {
-            return tiles[row][col];
-        }
-        else
-        {
-            warning("Out of bounds map access");
-            return (MapTile){MAP_TILE_NONE, false, false};
-        }
-    }
-
-    MapTile get_tile(v2i p)
-    {
-        return get_tile(p.x, p.y);
-    }
-
-    v2 get_px_size()
-    {
-        v2 size = {{{COLS * get_glyph_dim(), ROWS * get_glyph_dim()}}};
-        return size;
-    }
-
-    v2i px_pos_to_tile_pos(v2 px_pos)
-    {
-        v2i tile_pos = {{{
-            truncate_to_int(px_pos.x / get_glyph_dim()),
-            truncate_to_int(px_pos.y / get_glyph_dim())
-        }}};
-        return tile_pos;
-    }
-
-    v2i world_pos_to_tile_pos(v2 world_pos)
-    {
-        v2i tile_pos = {{{
-            truncate_to_int(world_pos.x),
-            truncate_to_int(world_pos.y)
-        }}};
-        return tile_pos;
-    }
-
-    bool can_move_over_tile(v2i tile_p)
-    {
-        MapTile tile = get_tile(tile_p);
-        return !tile.is_blocking;
-    }
-
-    bool can_move_over_tile(v2 world_pos)
-    {
-        v2i tile_p = world_pos_to_tile_pos(world_pos);
-        return can_move_over_tile(tile_p);
-    }
+    int chunks_visible;
+    int sections_rebuilt;
+    int sections_drawn;
 };
 
-Level generate_level()
-{
-    Level level;
-    for (int row = 0; row < level.ROWS; row++)
-    {
-        for (int col = 0; col < level.COLS; col++)
-        {
-            if (row == 0 || row == level.ROWS - 1 || col == 0 || col == level.COLS - 1)
-            {
-                level.set_tile(col, row, (MapTile){MAP_TILE_WALL, true, true});
-            }
-            else
-            {
-                level.set_tile(col, row, (MapTile){MAP_TILE_GROUND, false, false});
-            }
-        }
-    }
-    return level;
-}
-
 struct GameState
 {
     GLTiles::Vert_Buf *vb;
+    GLTiles::Inst_Buf *ib;
+    GLuint tiles_shader;
+    bool use_instancing;
+    Level_Draw_Stats level_stats;
     v2 player_pos;
     Level level;
+    Job_Pool *jobs;
+    int dungeon_seed;
+    f32 dungeon_walk_fill;
+    f32 cave_rock_chance;
+    int cave_iterations;
+    Overworld overworld;
+    double wfc_bench_ms;
+    int wfc_bench_attempts;
+    double world_gen_ms;
+    char world_gen_stats[64];
     f32 glyph_dim;
+    v2 camera_px;
+    v2 view_size;
+    Fov player_fov;
+    int fov_radius;
+    bool show_fog;
+    double fov_us;
+    double fov_bench_us;
+    Path_Service paths;
+    Path_Request player_path;
+    v2i player_path_points[GAME_PATH_POINTS_MAX];
+    double path_bench_ms;
+    int path_bench_found;
+    Hpa_Graph routes;
+    Regions regions;
+    Hpa_Request player_route;
+    v2i player_route_points[GAME_ROUTE_POINTS_MAX];
+    double route_us;
+    Flow_Field player_flow;
+    v2i player_flow_goal;
+    double flow_build_us;
+    double flow_repair_us;
     v2 player_move_input;
     bool mouse_left_clicked;
     v2 mouse_pos;
@@ -221,12 +134,25 @@ f32 get_glyph_dim()
     return g_GameState.glyph_dim;
 }
 
-void game_init(GLTiles::Vert_Buf *vb)
+void game_init(GLTiles::Vert_Buf *vb, GLTiles::Inst_Buf *ib, GLuint tiles_shader, Chunk_Pager *pager, Job_Pool *jobs)
 {
     g_GameState.vb = vb;
-    g_GameState.level = generate_level();
+    g_GameState.ib = ib;
+    g_GameState.tiles_shader = tiles_shader;
+    g_GameState.level.pager = pager && pager->is_enabled() ? pager : nullptr;
+    generate_level(&g_GameState.level);
     g_GameState.player_pos = (v2){{{10.0f, 10.0f}}};
     g_GameState.glyph_dim = 16.0f;
+    g_GameState.fov_radius = 40;
+    g_GameState.dungeon_seed = 1;
+    g_GameState.dungeon_walk_fill = 0.35f;
+    g_GameState.cave_rock_chance = 0.45f;
+    g_GameState.cave_iterations = 5;
+    g_GameState.jobs = jobs;
+    g_GameState.show_fog = true;
+    g_GameState.paths.init(jobs, &g_GameState.level);
+    g_GameState.routes.init(&g_GameState.level);
+    g_GameState.regions.init(&g_GameState.level, jobs);
 }
 
 GameState *get_game_state()
@@ -234,6 +160,21 @@ GameState *get_game_state()
     return &g_GameState;
 }
 
+// After the level was regenerated: caches keyed by chunk versions could match the new chunks by accident,
+// and a running overworld would keep streaming its chunks into the new level
+static void reset_world(v2 player_pos)
+{
+    GameState *gs = get_game_state();
+    gs->overworld.stop();
+    gs->routes.clear();
+    gs->regions.clear();
+    gs->player_fov.is_valid = false;
+    gs->player_flow.is_valid = false;
+    gs->player_path = {};
+    gs->player_route = {};
+    gs->player_pos = player_pos;
+}
+
 void try_move_player(v2 new_p)
 {
     GameState *gs = get_game_state();
@@ -243,6 +184,25 @@ void try_move_player(v2 new_p)
     }
 }
 
+// Keeps the player in the middle of the view
+static void update_camera()
+{
+    GameState *gs = get_game_state();
+    gs->camera_px.x = floorf((gs->player_pos.x + 0.5f) * get_glyph_dim() - gs->view_size.x * 0.5f);
+    gs->camera_px.y = floorf((gs->player_pos.y + 0.5f) * get_glyph_dim() - gs->view_size.y * 0.5f);
+}
+
+// Tile range covered by the view, max is exclusive
+static void get_visible_tiles(v2i *tile_min, v2i *tile_max)
+{
+    GameState *gs = get_game_state();
+    *tile_min = gs->level.px_pos_to_tile_pos(gs->camera_px);
+    v2 view_max = {{{gs->camera_px.x + gs->view_size.x, gs->camera_px.y + gs->view_size.y}}};
+    *tile_max = gs->level.px_pos_to_tile_pos(view_max);
+    tile_max->x++;
+    tile_max->y++;
+}
+
 void process_input(f32 delta)
 {
     GameState *gs = get_game_state();
@@ -253,19 +213,76 @@ void process_input(f32 delta)
     if (tentative_player_p.x != gs->player_pos.x || tentative_player_p.y != gs->player_pos.y)
         try_move_player(tentative_player_p);
 
+    update_camera();
+
+    v2i view_min, view_max;
+    get_visible_tiles(&view_min, &view_max);
+    gs->overworld.update(view_min, view_max);
+
+    v2 view_center = {{{gs->camera_px.x + gs->view_size.x * 0.5f, gs->camera_px.y + gs->view_size.y * 0.5f}}};
+    v2i focus_tiles[] = {
+        gs->level.world_pos_to_tile_pos(gs->player_pos),
+        gs->level.px_pos_to_tile_pos(view_center),
+    };
+    gs->level.update_paging(focus_tiles, array_size(focus_tiles));
+    gs->regions.update();
+
+    auto fov_start = std::chrono::steady_clock::now();
+    if (fov_update(&gs->level, &gs->player_fov, focus_tiles[0], gs->fov_radius))
+    {
+        fov_apply_to_level(&gs->level, &gs->player_fov);
+        gs->fov_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - fov_start).count();
+    }
+
+    // Everything chasing the player follows this field, so it's rebuilt only when the player changes tile
+    if (!gs->player_flow.is_valid || gs->player_flow_goal.x != focus_tiles[0].x || gs->player_flow_goal.y != focus_tiles[0].y)
+    {
+        auto flow_start = std::chrono::steady_clock::now();
+        gs->player_flow_goal = focus_tiles[0];
+        flow_build(&gs->level, &gs->player_flow, &gs->player_flow_goal, 1, gs->player_flow_goal);
+        gs->flow_build_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - flow_start).count();
+    }
+
     if (gs->mouse_left_clicked)
     {
-        v2 level_px_size = gs->level.get_px_size();
-        if (gs->mouse_pos.x < level_px_size.x && gs->mouse_pos.y < level_px_size.y)
+        v2 mouse_world_px = {{{gs->mouse_pos.x + gs->camera_px.x, gs->mouse_pos.y + gs->camera_px.y}}};
+        v2i clicked_tile = gs->level.px_pos_to_tile_pos(mouse_world_px);
+        if (clicked_tile.x != gs->inspect_tile_pos.x || clicked_tile.y != gs->inspect_tile_pos.y || gs->player_path.status == PATH_PENDING)
         {
-            gs->inspect_tile_pos = gs->level.px_pos_to_tile_pos(gs->mouse_pos);
+            gs->inspect_tile_pos = clicked_tile;
+            gs->player_path = Path_Request{focus_tiles[0], clicked_tile, PATH_JPS, gs->player_path_points, GAME_PATH_POINTS_MAX};
+            gs->player_route = Hpa_Request{focus_tiles[0], clicked_tile, gs->player_route_points, GAME_ROUTE_POINTS_MAX};
+
+            // Different regions can't be joined by any path, no point searching the whole window to find out.
+            // Unknown while chunks on the way are still being labeled, the search decides then.
+            if (gs->regions.get_reachability(focus_tiles[0], clicked_tile) == REACHABILITY_NO)
+            {
+                gs->player_path.status = PATH_NOT_FOUND;
+                gs->player_route.status = PATH_NOT_FOUND;
+            }
+            else
+            {
+                gs->paths.find(&gs->player_path);
+            }
+
+            // Too far for one search window: route over chunk entrances, then refine just the first leg
+            if (gs->player_path.status == PATH_TOO_FAR)
+            {
+                auto route_start = std::chrono::steady_clock::now();
+                gs->routes.find(&gs->player_route);
+                gs->route_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - route_start).count();
+                if (gs->player_route.status == PATH_FOUND && gs->player_route.point_count > 1)
+                {
+                    gs->player_path = Path_Request{focus_tiles[0], gs->player_route.points[1], PATH_JPS, gs->player_path_points, GAME_PATH_POINTS_MAX};
+                    gs->paths.find(&gs->player_path);
+                }
+            }
         }
     }
 }
 
-void draw_tile(Glyph glyph, Rect screen_pos)
+static void make_tile_verts(Glyph glyph, Rect screen_pos, GLTiles::Vert out[4])
 {
-    int index_base = GLTiles::vb_next_vert_index(g_GameState.vb);
     v2 a = screen_pos.get_a();
     v2 b = screen_pos.get_b();
     v2 c = screen_pos.get_c();
@@ -279,39 +296,225 @@ void draw_tile(Glyph glyph, Rect screen_pos)
     v2 t_c = q.get_c();
     v2 t_d = q.get_d();
 
-    GLTiles::vb_add_vert(g_GameState.vb, GLTiles::make_vert(a, t_a, glyph.fg_color, glyph.bg_color));
-    GLTiles::vb_add_vert(g_GameState.vb, GLTiles::make_vert(b, t_b, glyph.fg_color, glyph.bg_color));
-    GLTiles::vb_add_vert(g_GameState.vb, GLTiles::make_vert(c, t_c, glyph.fg_color, glyph.bg_color));
-    GLTiles::vb_add_vert(g_GameState.vb, GLTiles::make_vert(d, t_d, glyph.fg_color, glyph.bg_color));
+    out[0] = GLTiles::make_vert(a, t_a, glyph.fg_color, glyph.bg_color);
+    out[1] = GLTiles::make_vert(b, t_b, glyph.fg_color, glyph.bg_color);
+    out[2] = GLTiles::make_vert(c, t_c, glyph.fg_color, glyph.bg_color);
+    out[3] = GLTiles::make_vert(d, t_d, glyph.fg_color, glyph.bg_color);
+}
 
-    GLTiles::vb_add_indices(g_GameState.vb, index_base, (int[]){0, 1, 3, 1, 2, 3}, 6);
+void draw_tile(Glyph glyph, Rect screen_pos)
+{
+    if (g_GameState.use_instancing)
+    {
+        GLTiles::ib_add(g_GameState.ib, GLTiles::make_tile_instance(screen_pos.min, glyph.col, glyph.row, glyph.fg_color, glyph.bg_color));
+        return;
+    }
+
+    GLTiles::Vert verts[4];
+    make_tile_verts(glyph, screen_pos, verts);
+    GLTiles::vb_add_quad(g_GameState.vb, verts);
+}
+
+// Positions are relative to the section origin, so they stay small enough for the packed layout
+static void build_level_section(Chunk *chunk, int section_col, int section_row, GLTiles::Mesh *mesh)
+{
+    // Big enough for either vert layout, filled with the layout the frame's Vert_Buf uses
+    static GLTiles::Vert verts[CHUNK_SECTION_DIM * CHUNK_SECTION_DIM * 4];
+    GLTiles::Vert_Layout layout = g_GameState.vb->layout;
+    int vert_count = 0;
+
+    int col_min = section_col * CHUNK_SECTION_DIM;
+    int row_min = section_row * CHUNK_SECTION_DIM;
+
+    for (int row = 0; row < CHUNK_SECTION_DIM; row++)
+    {
+        for (int col = 0; col < CHUNK_SECTION_DIM; col++)
+        {
+            MapTile tile = chunk->data->tiles[row_min + row][col_min + col];
+            if (tile.kind == MAP_TILE_NONE) continue;
+
+            Rect screen_rect = {
+                .min = (v2){{{col * get_glyph_dim(), row * get_glyph_dim()}}},
+                .ext = (v2){{{get_glyph_dim(), get_glyph_dim()}}}
+            };
+            GLTiles::Vert tile_verts[4];
+            make_tile_verts(tile.get_glyph(), screen_rect, tile_verts);
+            for (int i = 0; i < 4; i++)
+            {
+                GLTiles::vert_write(layout, verts, vert_count + i, tile_verts[i]);
+            }
+            vert_count += 4;
+        }
+    }
+
+    if (mesh->vao == 0)
+    {
+        *mesh = GLTiles::mesh_make(layout);
+    }
+    GLTiles::mesh_upload(mesh, verts, vert_count / 4);
 }
 
+// Instanced path: one instance per visible tile every frame
+static void draw_level_instanced()
+{
+    GameState *gs = get_game_state();
+    Level *level = &gs->level;
+    v2i tile_min, tile_max;
+    get_visible_tiles(&tile_min, &tile_max);
+
+    for (int row = tile_min.y; row < tile_max.y; row++)
+    {
+        for (int col = tile_min.x; col < tile_max.x; col++)
+        {
+            MapTile tile = level->get_tile(col, row);
+            if (tile.kind == MAP_TILE_NONE) continue;
+            Glyph g = tile.get_glyph();
+            v2 p = {{{col * get_glyph_dim() - gs->camera_px.x, row * get_glyph_dim() - gs->camera_px.y}}};
+            GLTiles::ib_add(gs->ib, GLTiles::make_tile_instance(p, g.col, g.row, g.fg_color, g.bg_color));
+        }
+    }
+}
+
+// Only chunks and sections under the view are touched, so the cost doesn't grow with the world.
+// Sections are cached on the GPU and rebuilt only when set_tile dirtied them.
 void draw_level()
 {
-    Level *level = &g_GameState.level;
-    Rect screen_rect = {
-        .min = (v2){{{0.0f, 0.0f}}},
-        .ext = (v2){{{get_glyph_dim(), get_glyph_dim()}}}
-    };
-    for (int row = 0; row < level->ROWS; row++)
+    GameState *gs = get_game_state();
+    Level *level = &gs->level;
+    Level_Draw_Stats *stats = &gs->level_stats;
+    *stats = {};
+
+    if (gs->use_instancing)
+    {
+        draw_level_instanced();
+        return;
+    }
+
+    v2i tile_min, tile_max;
+    get_visible_tiles(&tile_min, &tile_max);
+    GLint mvp_loc = GLTiles::gl_uniform_location(gs->tiles_shader, "uMvp");
+
+    for (int chunk_y = tile_to_chunk(tile_min.y); chunk_y <= tile_to_chunk(tile_max.y - 1); chunk_y++)
+    {
+        for (int chunk_x = tile_to_chunk(tile_min.x); chunk_x <= tile_to_chunk(tile_max.x - 1); chunk_x++)
+        {
+            Chunk *chunk = level->find_chunk(chunk_x, chunk_y);
+            if (!chunk) continue;
+            stats->chunks_visible++;
+            // Paged out, the read ahead is already bringing it in
+            if (!chunk->data) continue;
+
+            bool rebuild_all = chunk->built_glyph_dim != get_glyph_dim();
+            chunk->built_glyph_dim = get_glyph_dim();
+
+            int chunk_col = chunk_x * CHUNK_DIM;
+            int chunk_row = chunk_y * CHUNK_DIM;
+            for (int section_row = 0; section_row < CHUNK_SECTIONS; section_row++)
+            {
+                int row = chunk_row + section_row * CHUNK_SECTION_DIM;
+                if (row + CHUNK_SECTION_DIM <= tile_min.y || row >= tile_max.y) continue;
+
+                for (int section_col = 0; section_col < CHUNK_SECTIONS; section_col++)
+                {
+                    int col = chunk_col + section_col * CHUNK_SECTION_DIM;
+                    if (col + CHUNK_SECTION_DIM <= tile_min.x || col >= tile_max.x) continue;
+
+                    GLTiles::Mesh *mesh = &chunk->section_meshes[section_row][section_col];
+                    if (rebuild_all || chunk->section_dirty[section_row][section_col] || mesh->vao == 0)
+                    {
+                        build_level_section(chunk, section_col, section_row, mesh);
+                        chunk->section_dirty[section_row][section_col] = false;
+                        stats->sections_rebuilt++;
+                    }
+                    if (mesh->quad_count == 0) continue;
+
+                    // Same screen ortho, shifted so section local positions land in place
+                    f32 left = gs->camera_px.x - col * get_glyph_dim();
+                    f32 top = gs->camera_px.y - row * get_glyph_dim();
+                    m4 proj = m4_proj_ortho(left, left + gs->view_size.x, top + gs->view_size.y, top, -1, 1);
+                    glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, proj.d);
+                    GLTiles::mesh_draw(mesh);
+                    stats->sections_drawn++;
+                }
+            }
+        }
+    }
+
+    m4 proj = m4_proj_ortho(0, gs->view_size.x, gs->view_size.y, 0, -1, 1);
+    glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, proj.d);
+}
+
+// Marks every tile along the path to the inspected tile, segments between jump points are straight or diagonal.
+// Legs of a long route past the first one aren't refined yet, only their waypoints are marked.
+void draw_player_path()
+{
+    GameState *gs = get_game_state();
+    Glyph g = {0, 0, GAME_COLOR_PATH, GAME_COLOR_PATH};
+    Hpa_Request *route = &gs->player_route;
+    if (route->status == PATH_FOUND)
+    {
+        for (int i = 2; i < route->point_count; i++)
+        {
+            v2i p = route->points[i];
+            Rect screen_rect = {
+                .min = (v2){{{p.x * get_glyph_dim() - gs->camera_px.x, p.y * get_glyph_dim() - gs->camera_px.y}}},
+                .ext = (v2){{{get_glyph_dim(), get_glyph_dim()}}}
+            };
+            draw_tile(g, screen_rect);
+        }
+    }
+
+    Path_Request *path = &gs->player_path;
+    if (path->status != PATH_FOUND) return;
+
+    for (int i = 1; i < path->point_count; i++)
+    {
+        v2i p = path->points[i - 1];
+        v2i to = path->points[i];
+        int dx = path_sign(to.x - p.x);
+        int dy = path_sign(to.y - p.y);
+        while (p.x != to.x || p.y != to.y)
+        {
+            p.x += dx;
+            p.y += dy;
+            Rect screen_rect = {
+                .min = (v2){{{p.x * get_glyph_dim() - gs->camera_px.x, p.y * get_glyph_dim() - gs->camera_px.y}}},
+                .ext = (v2){{{get_glyph_dim(), get_glyph_dim()}}}
+            };
+            draw_tile(g, screen_rect);
+        }
+    }
+}
+
+// Darkens explored tiles out of sight and hides the ones never seen
+void draw_fog()
+{
+    GameState *gs = get_game_state();
+    if (!gs->show_fog) return;
+
+    v2i tile_min, tile_max;
+    get_visible_tiles(&tile_min, &tile_max);
+    for (int row = tile_min.y; row < tile_max.y; row++)
     {
-        for (int col = 0; col < level->COLS; col++)
+        for (int col = tile_min.x; col < tile_max.x; col++)
         {
-            Glyph glyph = level->get_tile(col, row).get_glyph();
-            draw_tile(glyph, screen_rect);
-            screen_rect.min.x += get_glyph_dim();
+            if (gs->level.is_tile_visible(col, row)) continue;
+            v4 fog = gs->level.is_tile_explored(col, row) ? GAME_COLOR_FOG_EXPLORED : GAME_COLOR_BLACK;
+            Rect screen_rect = {
+                .min = (v2){{{col * get_glyph_dim() - gs->camera_px.x, row * get_glyph_dim() - gs->camera_px.y}}},
+                .ext = (v2){{{get_glyph_dim(), get_glyph_dim()}}}
+            };
+            draw_tile((Glyph){0, 0, fog, fog}, screen_rect);
         }
-        screen_rect.min.x = 0.0f;
-        screen_rect.min.y += get_glyph_dim();
     }
 }
 
 void draw_player()
 {
+    GameState *gs = get_game_state();
     Glyph g = get_player_glyph();
     Rect screen_rect = {
-        .min = (v2){{{g_GameState.player_pos.x * get_glyph_dim(), g_GameState.player_pos.y * get_glyph_dim()}}},
+        .min = (v2){{{gs->player_pos.x * get_glyph_dim() - gs->camera_px.x, gs->player_pos.y * get_glyph_dim() - gs->camera_px.y}}},
         .ext = (v2){{{get_glyph_dim(), get_glyph_dim()}}}
     };
     draw_tile(g, screen_rect);
@@ -325,12 +528,203 @@ void window_game_debug()
     ImGui::InputFloat("Player Y", &gs->player_pos.y);
     ImGui::Separator();
     ImGui::InputFloat("Glyph Dim", &gs->glyph_dim);
+    ImGui::SeparatorText("World");
+    v2i world_size = gs->level.get_tile_size();
+    ImGui::BulletText("Size: %d x %d tiles", world_size.x, world_size.y);
+    ImGui::BulletText("Chunks: %u (%llu tiles stored)", gs->level.chunks.count, (unsigned long long)gs->level.get_tile_count());
+    if (gs->overworld.is_active)
+    {
+        ImGui::BulletText("Overworld: %d chunks generated, %u pending", gs->overworld.generated_count, gs->overworld.pending.count);
+    }
+    Chunk_Pager *pager = gs->level.pager;
+    if (pager)
+    {
+        ImGui::BulletText("Resident: %d of %d budget, %d loading", (int)pager->resident.size(), pager->get_budget_chunks(), pager->loads_in_flight);
+        ImGui::BulletText("Paged: %d in, %d out, %d written", pager->load_count, pager->evict_count, pager->write_count);
+        int budget_mb = (int)(pager->budget_bytes / (1024 * 1024));
+        if (ImGui::SliderInt("Budget MB", &budget_mb, 1, 1024))
+        {
+            pager->budget_bytes = (size_t)budget_mb * 1024 * 1024;
+        }
+    }
+    if (ImGui::Button("Room"))
+    {
+        generate_level(&gs->level);
+        reset_world((v2){{{10.0f, 10.0f}}});
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Big world"))
+    {
+        generate_big_level(&gs->level, 4096, 4096);
+        reset_world((v2){{{10.0f, 10.0f}}});
+    }
+    ImGui::InputInt("Seed", &gs->dungeon_seed);
+    ImGui::SliderFloat("Walk fill", &gs->dungeon_walk_fill, 0.0f, 0.6f);
+    if (ImGui::Button("Dungeon"))
+    {
+        Dungeon_Params params = {(u64)gs->dungeon_seed, 4096, 4096, gs->dungeon_walk_fill};
+        auto gen_start = std::chrono::steady_clock::now();
+        Dungeon_Result dungeon = generate_dungeon(&gs->level, &params);
+        gs->world_gen_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gen_start).count();
+        snprintf(gs->world_gen_stats, sizeof(gs->world_gen_stats), "%d rooms, %.0f%% open", dungeon.room_count, dungeon.fill_rate * 100.0f);
+        reset_world((v2){{{(f32)dungeon.spawn.x, (f32)dungeon.spawn.y}}});
+    }
+    ImGui::SliderFloat("Rock chance", &gs->cave_rock_chance, 0.3f, 0.6f);
+    ImGui::SliderInt("Iterations", &gs->cave_iterations, 0, 16);
+    if (ImGui::Button("Caves"))
+    {
+        Cave_Params params = {(u64)gs->dungeon_seed, 4096, 4096, gs->cave_rock_chance, gs->cave_iterations};
+        auto gen_start = std::chrono::steady_clock::now();
+        Cave_Result caves = generate_caves(&gs->level, gs->jobs, &params);
+        gs->world_gen_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gen_start).count();
+        snprintf(gs->world_gen_stats, sizeof(gs->world_gen_stats), "%.0f%% open", caves.fill_rate * 100.0f);
+        reset_world((v2){{{(f32)caves.spawn.x, (f32)caves.spawn.y}}});
+    }
+    if (ImGui::Button("Overworld"))
+    {
+        reset_world((v2){});
+        auto gen_start = std::chrono::steady_clock::now();
+        v2i spawn = gs->overworld.start(&gs->level, gs->jobs, (u64)gs->dungeon_seed);
+        gs->world_gen_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gen_start).count();
+        snprintf(gs->world_gen_stats, sizeof(gs->world_gen_stats), "first %u chunks", gs->level.chunks.count);
+        gs->player_pos = (v2){{{(f32)spawn.x, (f32)spawn.y}}};
+    }
+    if (ImGui::Button("WFC"))
+    {
+        Wfc_Params params = {(u64)gs->dungeon_seed, 256, 256, 10};
+        auto gen_start = std::chrono::steady_clock::now();
+        Wfc_Result wfc = generate_wfc(&gs->level, &params);
+        gs->world_gen_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gen_start).count();
+        snprintf(gs->world_gen_stats, sizeof(gs->world_gen_stats), "%d patterns, %d attempts%s", wfc.pattern_count, wfc.attempts,
+            wfc.is_complete ? "" : ", failed");
+        if (wfc.is_complete) reset_world((v2){{{(f32)wfc.spawn.x, (f32)wfc.spawn.y}}});
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Bench WFC 256x256"))
+    {
+        // Solver only, 5 seeds, the level is left alone
+        Wfc_Model model;
+        model.build();
+        gs->wfc_bench_attempts = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 5; i++)
+        {
+            Wfc_Params params = {(u64)gs->dungeon_seed + (u64)i, 256, 256, 10};
+            Bit_Grid grid;
+            int attempts;
+            if (wfc_run(&model, &params, &grid, &attempts)) bit_grid_free(&grid);
+            gs->wfc_bench_attempts += attempts;
+        }
+        gs->wfc_bench_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / 5.0;
+    }
+    if (gs->wfc_bench_ms > 0.0)
+    {
+        ImGui::SameLine();
+        ImGui::Text("%.1f ms per map, %d attempts", gs->wfc_bench_ms, gs->wfc_bench_attempts);
+    }
+    if (gs->world_gen_ms > 0.0)
+    {
+        ImGui::SameLine();
+        ImGui::Text("%.1f ms, %s", gs->world_gen_ms, gs->world_gen_stats);
+    }
+    ImGui::SeparatorText("Field of view");
+    ImGui::Checkbox("Fog", &gs->show_fog);
+    ImGui::SliderInt("Radius", &gs->fov_radius, 1, FOV_RADIUS_MAX);
+    ImGui::BulletText("Computed %d times, last %.1f us", gs->player_fov.compute_count, gs->fov_us);
+    if (ImGui::Button("Bench 500 viewers"))
+    {
+        // Worst case for monsters: every viewer recomputes
+        static Fov bench_fov;
+        v2i center = gs->level.world_pos_to_tile_pos(gs->player_pos);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 500; i++)
+        {
+            v2i origin = {{{center.x + (int)(Chunk_Map::hash(i, 0) % 41) - 20, center.y + (int)(Chunk_Map::hash(0, i) % 41) - 20}}};
+            fov_compute(&gs->level, &bench_fov, origin, gs->fov_radius);
+        }
+        gs->fov_bench_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / 500.0;
+    }
+    if (gs->fov_bench_us > 0.0)
+    {
+        ImGui::SameLine();
+        ImGui::Text("%.1f us per viewer", gs->fov_bench_us);
+    }
+    ImGui::SeparatorText("Pathfinding");
+    static const char *path_status_names[] = {"None", "Found", "Not found", "Too far"};
+    ImGui::BulletText("Path: %s, cost %u, %d points, %d expanded", path_status_names[gs->player_path.status],
+        gs->player_path.cost, gs->player_path.point_count, gs->player_path.expanded_count);
+    if (ImGui::Button("Bench 2000 paths"))
+    {
+        // Random pairs up to 64 tiles apart around the player, spread over the job pool
+        static Path_Request bench_requests[2000];
+        v2i center = gs->level.world_pos_to_tile_pos(gs->player_pos);
+        for (int i = 0; i < (int)array_size(bench_requests); i++)
+        {
+            v2i start = {{{center.x + (int)(Chunk_Map::hash(i, 1) % 129) - 64, center.y + (int)(Chunk_Map::hash(i, 2) % 129) - 64}}};
+            v2i goal = {{{start.x + (int)(Chunk_Map::hash(i, 3) % 129) - 64, start.y + (int)(Chunk_Map::hash(i, 4) % 129) - 64}}};
+            bench_requests[i] = Path_Request{start, goal, PATH_JPS, nullptr, 0};
+        }
+        auto start = std::chrono::steady_clock::now();
+        gs->paths.find_batch(bench_requests, array_size(bench_requests));
+        gs->path_bench_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        gs->path_bench_found = 0;
+        for (Path_Request &r : bench_requests)
+        {
+            if (r.status == PATH_FOUND) gs->path_bench_found++;
+        }
+    }
+    if (gs->path_bench_ms > 0.0)
+    {
+        ImGui::SameLine();
+        ImGui::Text("%.2f ms, %d found, %d threads", gs->path_bench_ms, gs->path_bench_found, gs->paths.context_count);
+    }
+    ImGui::BulletText("Route: %s, cost %u, %d waypoints, %d expanded, %d chunks built, %.1f us", path_status_names[gs->player_route.status],
+        gs->player_route.cost, gs->player_route.point_count, gs->player_route.expanded_count, gs->player_route.chunks_built, gs->route_us);
+    ImGui::BulletText("Route graph: %u chunks cached, %d builds", gs->routes.chunks.count, gs->routes.build_count);
+    if (ImGui::Button("Route across the world"))
+    {
+        // Corner to corner, the first run pays for building the chunks it touches
+        v2i start = {{{gs->level.tile_min.x + 1, gs->level.tile_min.y + 1}}};
+        v2i goal = {{{gs->level.tile_max.x - 2, gs->level.tile_max.y - 2}}};
+        gs->player_route = Hpa_Request{start, goal, gs->player_route_points, GAME_ROUTE_POINTS_MAX};
+        gs->player_path = {};
+        auto route_start = std::chrono::steady_clock::now();
+        gs->routes.find(&gs->player_route);
+        gs->route_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - route_start).count();
+    }
+    ImGui::SeparatorText("Regions");
+    ImGui::BulletText("%u regions over %u chunks, %d pending", gs->regions.region_count, gs->regions.chunks.count, gs->regions.pending_count);
+    ImGui::BulletText("Updated %d times, %d chunks labeled, last %d chunks joined in %.1f us", gs->regions.update_count,
+        gs->regions.relabel_count, gs->regions.joined_chunk_count, gs->regions.last_update_us);
+    ImGui::SeparatorText("Flow field");
+    ImGui::BulletText("Built %d times, last %.1f us", gs->player_flow.build_count, gs->flow_build_us);
+    ImGui::BulletText("Repaired %d times, last %.1f us, %d tiles", gs->player_flow.repair_count, gs->flow_repair_us, gs->player_flow.last_repair_size);
     ImGui::SeparatorText("Inspect tile");
     ImGui::BulletText("Pos: %d, %d", gs->inspect_tile_pos.x, gs->inspect_tile_pos.y);
     MapTile tile = gs->level.get_tile(gs->inspect_tile_pos);
     ImGui::BulletText("%s", tile.get_name());
     ImGui::BulletText("Blocking: %s", tile.is_blocking ? "Yes" : "No");
     ImGui::BulletText("Opaque: %s", tile.is_opaque ? "Yes" : "No");
+    v2i player_tile = gs->level.world_pos_to_tile_pos(gs->player_pos);
+    static const char *reachability_names[] = {"No", "Yes", "Unknown"};
+    u32 region = gs->regions.get_region(gs->inspect_tile_pos);
+    if (region == REGION_UNKNOWN) ImGui::BulletText("Region: not labeled yet");
+    else ImGui::BulletText("Region: %u", region);
+    ImGui::BulletText("Reachable from player: %s", reachability_names[gs->regions.get_reachability(player_tile, gs->inspect_tile_pos)]);
+    ImGui::BulletText("In line of sight: %s", gs->level.has_line_of_sight(player_tile, gs->inspect_tile_pos) ? "Yes" : "No");
+    u16 flow_dist = flow_get_distance(&gs->player_flow, gs->inspect_tile_pos.x, gs->inspect_tile_pos.y);
+    v2i flow_step = flow_get_step(&gs->player_flow, gs->inspect_tile_pos.x, gs->inspect_tile_pos.y);
+    if (flow_dist == FLOW_UNREACHABLE) ImGui::BulletText("Steps to player: unreachable");
+    else ImGui::BulletText("Steps to player: %d, next %d, %d", flow_dist, flow_step.x, flow_step.y);
+    if (ImGui::Button("Toggle wall"))
+    {
+        MapTile wall = {MAP_TILE_WALL, true, true};
+        MapTile ground = {MAP_TILE_GROUND, false, false};
+        gs->level.set_tile(gs->inspect_tile_pos.x, gs->inspect_tile_pos.y, tile.is_blocking ? ground : wall);
+        auto repair_start = std::chrono::steady_clock::now();
+        flow_on_tile_changed(&gs->level, &gs->player_flow, gs->inspect_tile_pos.x, gs->inspect_tile_pos.y);
+        gs->flow_repair_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - repair_start).count();
+    }
     ImGui::End();
 
 }
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstring>
+
+#include <OpenGL/gl3.h>
+
+#include "types.hpp"
+#include "util.hpp"
+
+/*
+ * Thin GL state cache. Binds go through here and are skipped when the object
+ * is already bound. ImGui's backend binds behind our back (it restores what it
+ * found, but still), so the cache is forgotten at the start of every frame.
+ *
+ * Deleting a bound object makes GL rebind 0 and the name can be reused, so
+ * anything that deletes GL objects calls gl_state_forget().
+ */
+
+namespace GLTiles
+{
+    #define GL_STATE_UNKNOWN 0xFFFFFFFFu
+    #define GL_STATE_TEXTURE_UNITS 8
+    #define GL_UNIFORM_CACHE_SIZE 256
+
+    struct GL_Uniform_Entry
+    {
+        GLuint program;
+        const char *name;
+        GLint location;
+    };
+
+    struct GL_State
+    {
+        GLuint program;
+        GLuint vao;
+        GLuint array_buffer;
+        GLuint element_buffer;
+        GLuint active_unit;
+        GLuint textures[GL_STATE_TEXTURE_UNITS];
+
+        int binds_this_frame;
+        int skipped_this_frame;
+        int binds_last_frame;
+        int skipped_last_frame;
+
+        GL_Uniform_Entry uniforms[GL_UNIFORM_CACHE_SIZE];
+        int uniform_count;
+    };
+
+    static GL_State g_gl_state;
+
+    static void gl_state_forget()
+    {
+        GL_State *s = &g_gl_state;
+        s->program = GL_STATE_UNKNOWN;
+        s->vao = GL_STATE_UNKNOWN;
+        s->array_buffer = GL_STATE_UNKNOWN;
+        s->element_buffer = GL_STATE_UNKNOWN;
+        s->active_unit = GL_STATE_UNKNOWN;
+        for (int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+        {
+            s->textures[i] = GL_STATE_UNKNOWN;
+        }
+    }
+
+    static void gl_state_begin_frame()
+    {
+        GL_State *s = &g_gl_state;
+        s->binds_last_frame = s->binds_this_frame;
+        s->skipped_last_frame = s->skipped_this_frame;
+        s->binds_this_frame = 0;
+        s->skipped_this_frame = 0;
+        gl_state_forget();
+    }
+
+    // Returns true if the bind has to go to GL, counts it either way
+    static bool gl_state_update(GLuint *cached, GLuint value)
+    {
+        if (*cached == value)
+        {
+            g_gl_state.skipped_this_frame++;
+            return false;
+        }
+        *cached = value;
+        g_gl_state.binds_this_frame++;
+        return true;
+    }
+
+    static void gl_use_program(GLuint program)
+    {
+        if (gl_state_update(&g_gl_state.program, program)) glUseProgram(program);
+    }
+
+    static void gl_bind_vao(GLuint vao)
+    {
+        if (gl_state_update(&g_gl_state.vao, vao))
+        {
+            glBindVertexArray(vao);
+            // The element buffer binding belongs to the VAO
+            g_gl_state.element_buffer = GL_STATE_UNKNOWN;
+        }
+    }
+
+    static void gl_bind_buffer(GLenum target, GLuint buffer)
+    {
+        GLuint *cached = nullptr;
+        if (target == GL_ARRAY_BUFFER) cached = &g_gl_state.array_buffer;
+        else if (target == GL_ELEMENT_ARRAY_BUFFER) cached = &g_gl_state.element_buffer;
+
+        if (!cached)
+        {
+            glBindBuffer(target, buffer);
+            return;
+        }
+        if (gl_state_update(cached, buffer)) glBindBuffer(target, buffer);
+    }
+
+    static void gl_bind_texture(int unit, GLuint texture)
+    {
+        if (unit < 0 || unit >= GL_STATE_TEXTURE_UNITS)
+        {
+            warning("Texture unit %d is past GL_STATE_TEXTURE_UNITS", unit);
+            return;
+        }
+        if (g_gl_state.textures[unit] == texture)
+        {
+            g_gl_state.skipped_this_frame++;
+            return;
+        }
+        if (gl_state_update(&g_gl_state.active_unit, (GLuint)unit)) glActiveTexture(GL_TEXTURE0 + unit);
+        g_gl_state.textures[unit] = texture;
+        g_gl_state.binds_this_frame++;
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    // Locations are looked up once per (program, name). The name is kept, pass string literals.
+    static GLint gl_uniform_location(GLuint program, const char *name)
+    {
+        GL_State *s = &g_gl_state;
+        u32 hash = 2166136261u ^ program;
+        for (const char *c = name; *c; c++)
+        {
+            hash = (hash ^ (u8)*c) * 16777619u;
+        }
+
+        for (int probe = 0; probe < GL_UNIFORM_CACHE_SIZE; probe++)
+        {
+            GL_Uniform_Entry *e = &s->uniforms[(hash + probe) % GL_UNIFORM_CACHE_SIZE];
+            if (!e->name)
+            {
+                e->program = program;
+                e->name = name;
+                e->location = glGetUniformLocation(program, name);
+                if (e->location < 0) warning("Uniform %s not found in program %u", name, program);
+                s->uniform_count++;
+                return e->location;
+            }
+            if (e->program == program && strcmp(e->name, name) == 0)
+            {
+                return e->location;
+            }
+        }
+
+        warning("Uniform cache is full");
+        return glGetUniformLocation(program, name);
+    }
+}
@@ -5,14 +5,158 @@
 
 
 #include <cstdlib>
+#include <cstring>
 
 #include <OpenGL/gl3.h>
 #include <stb_image.h>
 
 #include "lin_math.cpp"
+#include "gl_state.cpp"
 
 namespace GLTiles
 {
+    // Tileset layout, glyphs are addressed as row * TILESET_COLS + col
+    #define TILESET_COLS 16
+    #define TILESET_ROWS 16
+
+    // Streaming buffer: a ring of STREAM_PARTITIONS partitions the CPU writes straight into.
+    // A partition is only reused once the fence placed after its draw has signaled, so maps
+    // are unsynchronized and the driver never allocates or copies on our behalf.
+    // Uses a persistent coherent mapping when ARB_buffer_storage (GL 4.4) is available,
+    // otherwise maps the partition with glMapBufferRange every frame.
+    #define STREAM_PARTITIONS 3
+    struct Stream_Buf
+    {
+        GLenum target;
+        GLuint buffer;
+        size_t partition_size;
+        int partition;
+        GLsync fences[STREAM_PARTITIONS];
+
+        u8 *persistent;
+        u8 *mapped;
+
+        int stall_count;
+    };
+
+    static bool gl_has_buffer_storage()
+    {
+    #ifdef GL_MAP_PERSISTENT_BIT
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        return major > 4 || (major == 4 && minor >= 4);
+    #else
+        return false;
+    #endif
+    }
+
+    // Expects the buffer to be bound to target, so the caller's VAO picks it up
+    static Stream_Buf stream_make(GLenum target, size_t partition_size)
+    {
+        Stream_Buf sb = {};
+        sb.target = target;
+        sb.partition_size = partition_size;
+        size_t total_size = partition_size * STREAM_PARTITIONS;
+
+        glGenBuffers(1, &sb.buffer);
+        gl_bind_buffer(target, sb.buffer);
+    #ifdef GL_MAP_PERSISTENT_BIT
+        if (gl_has_buffer_storage())
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, total_size, NULL, flags);
+            sb.persistent = (u8 *)glMapBufferRange(target, 0, total_size, flags);
+            if (!sb.persistent) warning("Persistent map failed, falling back to glMapBufferRange per frame");
+        }
+        if (!sb.persistent)
+    #endif
+        {
+            glBufferData(target, total_size, NULL, GL_STREAM_DRAW);
+        }
+        return sb;
+    }
+
+    static void stream_free(Stream_Buf *sb)
+    {
+        for (int i = 0; i < STREAM_PARTITIONS; i++)
+        {
+            if (sb->fences[i]) glDeleteSync(sb->fences[i]);
+        }
+        if (sb->persistent || sb->mapped)
+        {
+            gl_bind_buffer(sb->target, sb->buffer);
+            glUnmapBuffer(sb->target);
+        }
+        glDeleteBuffers(1, &sb->buffer);
+        gl_state_forget();
+        *sb = {};
+    }
+
+    static void stream_wait_fence(Stream_Buf *sb, int partition)
+    {
+        GLsync fence = sb->fences[partition];
+        if (!fence) return;
+
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            sb->stall_count++;
+            do
+            {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while (result == GL_TIMEOUT_EXPIRED);
+        }
+        if (result == GL_WAIT_FAILED) warning("glClientWaitSync failed");
+
+        glDeleteSync(fence);
+        sb->fences[partition] = 0;
+    }
+
+    static size_t stream_partition_offset(const Stream_Buf *sb)
+    {
+        return sb->partition_size * sb->partition;
+    }
+
+    // Returns the current partition's memory, valid until stream_unmap()
+    static u8 *stream_map(Stream_Buf *sb)
+    {
+        if (sb->mapped) return sb->mapped;
+
+        stream_wait_fence(sb, sb->partition);
+        if (sb->persistent)
+        {
+            sb->mapped = sb->persistent + stream_partition_offset(sb);
+        }
+        else
+        {
+            gl_bind_buffer(sb->target, sb->buffer);
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+            sb->mapped = (u8 *)glMapBufferRange(sb->target, stream_partition_offset(sb), sb->partition_size, flags);
+            if (!sb->mapped) warning("glMapBufferRange failed");
+        }
+        return sb->mapped;
+    }
+
+    // Ends CPU writes to the current partition, draws can source it after this
+    static void stream_unmap(Stream_Buf *sb)
+    {
+        if (!sb->mapped) return;
+        if (!sb->persistent)
+        {
+            gl_bind_buffer(sb->target, sb->buffer);
+            glUnmapBuffer(sb->target);
+        }
+        sb->mapped = nullptr;
+    }
+
+    // Call after the draws that read the current partition, moves on to the next one
+    static void stream_fence(Stream_Buf *sb)
+    {
+        sb->fences[sb->partition] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        sb->partition = (sb->partition + 1) % STREAM_PARTITIONS;
+    }
+
     // Vert buffer
     struct Vert
     {
@@ -31,117 +175,434 @@ namespace GLTiles
         return v;
     }
 
-    #define VERT_MAX 65536
-    #define INDEX_MAX 131072
+    // Compact layout: pixel positions, normalized UVs and RGBA8 colors.
+    // The attributes are converted to floats by GL, the tiles shader takes either layout.
+    struct Vert_Packed
+    {
+        i16 x, y;
+        u16 u, v;
+        u32 fg;
+        u32 bg;
+    };
+    static_assert(sizeof(Vert_Packed) == 16, "Vert_Packed should stay 16 bytes");
+
+    enum Vert_Layout
+    {
+        VERT_LAYOUT_FLOAT,
+        VERT_LAYOUT_PACKED,
+    };
+
+    static u32 pack_rgba8(v4 c)
+    {
+        u32 r = (u32)(c.r * 255.0f + 0.5f);
+        u32 g = (u32)(c.g * 255.0f + 0.5f);
+        u32 b = (u32)(c.b * 255.0f + 0.5f);
+        u32 a = (u32)(c.a * 255.0f + 0.5f);
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
+    static i16 pack_pos(f32 p)
+    {
+        if (p < -32768.0f) return -32768;
+        if (p > 32767.0f) return 32767;
+        return (i16)(p < 0.0f ? p - 0.5f : p + 0.5f);
+    }
+
+    static u16 pack_unorm16(f32 t)
+    {
+        if (t <= 0.0f) return 0;
+        if (t >= 1.0f) return 65535;
+        return (u16)(t * 65535.0f + 0.5f);
+    }
+
+    static Vert_Packed pack_vert(Vert v)
+    {
+        Vert_Packed p;
+        p.x = pack_pos(v.x); p.y = pack_pos(v.y);
+        p.u = pack_unorm16(v.u); p.v = pack_unorm16(v.v);
+        p.fg = pack_rgba8((v4){{{v.fg[0], v.fg[1], v.fg[2], v.fg[3]}}});
+        p.bg = pack_rgba8((v4){{{v.bg[0], v.bg[1], v.bg[2], v.bg[3]}}});
+        return p;
+    }
+
+    static size_t vert_layout_stride(Vert_Layout layout)
+    {
+        return layout == VERT_LAYOUT_PACKED ? sizeof(Vert_Packed) : sizeof(Vert);
+    }
+
+    // Writes vert at index into an array of the given layout
+    static void vert_write(Vert_Layout layout, void *dst, int index, Vert vert)
+    {
+        if (layout == VERT_LAYOUT_PACKED)
+        {
+            ((Vert_Packed *)dst)[index] = pack_vert(vert);
+        }
+        else
+        {
+            ((Vert *)dst)[index] = vert;
+        }
+    }
+
+    // Quad index buffer: every quad renderer draws 4 verts per quad, a-b-c-d around the edge,
+    // so one immutable {0, 1, 2, 0, 2, 3} pattern built at startup serves all of them.
+    #define QUAD_MAX 16384
+    static GLuint g_quad_ebo;
+
+    // Binds the shared quad indices as the current VAO's element buffer, builds them on first use
+    static void gl_bind_quad_indices()
+    {
+        if (g_quad_ebo == 0)
+        {
+            static u16 indices[QUAD_MAX * 6];
+            for (int quad = 0; quad < QUAD_MAX; quad++)
+            {
+                u16 base = (u16)(quad * 4);
+                u16 *out = indices + quad * 6;
+                out[0] = base + 0; out[1] = base + 1; out[2] = base + 2;
+                out[3] = base + 0; out[4] = base + 2; out[5] = base + 3;
+            }
+
+            glGenBuffers(1, &g_quad_ebo);
+            gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, g_quad_ebo);
+        #ifdef GL_MAP_PERSISTENT_BIT
+            if (gl_has_buffer_storage())
+            {
+                glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, 0);
+                return;
+            }
+        #endif
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+            return;
+        }
+        gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, g_quad_ebo);
+    }
+
+    // One batch fills one stream partition. A full batch is drawn and the next one starts in the
+    // next partition, so a frame can hold any amount of geometry. Quads are drawn from the
+    // shared quad indices, 16 bit indices always fit a batch.
+    #define VERT_MAX (QUAD_MAX * 4)
     struct Vert_Buf
     {
-        Vert verts[VERT_MAX];
+        Vert_Layout layout;
+        size_t vert_stride;
+
+        // Points into the mapped stream partition between vb_clear() and vb_draw_call(),
+        // counts are for the current batch
+        u8 *vert_data;
         int vert_count;
 
-        u32 indices[INDEX_MAX];
-        int index_count;
+        int frame_vert_count;
+        int frame_batch_count;
 
-        GLuint vao, vbo, ebo;
+        GLuint vao;
+        Stream_Buf vert_stream;
     };
 
     static size_t vb_vert_size(const Vert_Buf *vb)
     {
-        return sizeof(vb->verts[0]) * vb->vert_count;
+        return vb->vert_stride * vb->vert_count;
     }
 
     static size_t vb_max_vert_size(const Vert_Buf *vb)
     {
-        return sizeof(vb->verts[0]) * VERT_MAX;
-    }
-
-    static size_t vb_index_size(const Vert_Buf *vb)
-    {
-        return sizeof(vb->indices[0]) * vb->index_count;
+        return vb->vert_stride * VERT_MAX;
     }
 
-    static size_t vb_max_index_size(const Vert_Buf *vb)
+    // Expects the VAO and the vertex buffer to be bound
+    static void vert_attrib_setup(Vert_Layout layout)
     {
-        return sizeof(vb->indices[0]) * INDEX_MAX;
+        if (layout == VERT_LAYOUT_PACKED)
+        {
+            glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(Vert_Packed), (void *)0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Vert_Packed), (void *)(offsetof(Vert_Packed, u)));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vert_Packed), (void *)(offsetof(Vert_Packed, fg)));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vert_Packed), (void *)(offsetof(Vert_Packed, bg)));
+            glEnableVertexAttribArray(3);
+        }
+        else
+        {
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)(offsetof(Vert, u)));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)(offsetof(Vert, fg)));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)(offsetof(Vert, bg)));
+            glEnableVertexAttribArray(3);
+        }
     }
 
-    static Vert_Buf *vb_make()
+    static Vert_Buf *vb_make(Vert_Layout layout)
     {
         Vert_Buf *vb = (Vert_Buf *)malloc(sizeof(Vert_Buf));
+        vb->layout = layout;
+        vb->vert_stride = vert_layout_stride(layout);
+        vb->vert_data = nullptr;
         vb->vert_count = 0;
-        vb->index_count = 0;
 
         glGenVertexArrays(1, &vb->vao);
-        glGenBuffers(1, &vb->vbo);
-        glGenBuffers(1, &vb->ebo);
-
-        glBindVertexArray(vb->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vb->vbo);
-        glBufferData(GL_ARRAY_BUFFER, vb_max_vert_size(vb), NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vb->ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, vb_max_index_size(vb), NULL, GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)(offsetof(Vert, u)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)(offsetof(Vert, fg)));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)(offsetof(Vert, bg)));
-        glEnableVertexAttribArray(3);
-        glBindVertexArray(0);
+        gl_bind_vao(vb->vao);
+        // Partitions are a whole number of verts, so a partition starts at base vertex offset / stride
+        vb->vert_stream = stream_make(GL_ARRAY_BUFFER, vb_max_vert_size(vb));
+        gl_bind_quad_indices();
+        vert_attrib_setup(layout);
+        gl_bind_vao(0);
 
         return vb;
     }
 
-    static void vb_clear(Vert_Buf *vb)
+    static void vb_begin_batch(Vert_Buf *vb)
     {
         vb->vert_count = 0;
-        vb->index_count = 0;
+        vb->vert_data = stream_map(&vb->vert_stream);
+    }
+
+    static void vb_end_batch(Vert_Buf *vb)
+    {
+        stream_unmap(&vb->vert_stream);
+        vb->vert_data = nullptr;
+
+        int quad_count = vb->vert_count / 4;
+        if (quad_count > 0)
+        {
+            gl_bind_vao(vb->vao);
+            GLint base_vertex = (GLint)(stream_partition_offset(&vb->vert_stream) / vb->vert_stride);
+            glDrawElementsBaseVertex(GL_TRIANGLES, quad_count * 6, GL_UNSIGNED_SHORT, 0, base_vertex);
+            vb->frame_batch_count++;
+        }
+
+        stream_fence(&vb->vert_stream);
+    }
+
+    // Starts a new frame of geometry, maps the next stream partition for writing
+    static void vb_clear(Vert_Buf *vb)
+    {
+        vb->frame_vert_count = 0;
+        vb->frame_batch_count = 0;
+        vb_begin_batch(vb);
     }
 
     static void vb_free(Vert_Buf *vb)
     {
-        glDeleteBuffers(1, &vb->vbo);
-        glDeleteBuffers(1, &vb->ebo);
+        stream_free(&vb->vert_stream);
         glDeleteVertexArrays(1, &vb->vao);
+        gl_state_forget();
         free(vb);
     }
 
-    static void vb_add_vert(Vert_Buf *vert_buffer, Vert vert)
+    // Verts a-b-c-d around the quad's edge. Draws the current batch first if the quad doesn't fit,
+    // so the shader the batch is drawn with has to stay bound while quads are added.
+    static void vb_add_quad(Vert_Buf *vb, const Vert verts[4])
     {
-        if (vert_buffer->vert_count < VERT_MAX)
+        if (vb->vert_count + 4 > VERT_MAX)
         {
-            vert_buffer->verts[vert_buffer->vert_count++] = vert;
+            vb_end_batch(vb);
+            vb_begin_batch(vb);
         }
+        if (!vb->vert_data) return;
+
+        for (int i = 0; i < 4; i++)
+        {
+            vert_write(vb->layout, vb->vert_data, vb->vert_count++, verts[i]);
+        }
+        vb->frame_vert_count += 4;
+    }
+
+    // Draws the last batch and unmaps what vb_clear() mapped, so it has to be called every frame
+    static void vb_draw_call(Vert_Buf *vb)
+    {
+        vb_end_batch(vb);
+    }
+
+    // Instanced tiles: one 20 byte instance per tile, the vertex shader expands it into a quad
+    struct Tile_Instance
+    {
+        f32 x, y;
+        u32 glyph;
+        u32 fg;
+        u32 bg;
+    };
+
+    static Tile_Instance make_tile_instance(v2 p, int glyph_col, int glyph_row, v4 fg, v4 bg)
+    {
+        Tile_Instance inst;
+        inst.x = p.x; inst.y = p.y;
+        inst.glyph = (u32)(glyph_row * TILESET_COLS + glyph_col);
+        inst.fg = pack_rgba8(fg);
+        inst.bg = pack_rgba8(bg);
+        return inst;
+    }
+
+    // Like Vert_Buf, a full batch is drawn and the next one starts in the next partition. Instances
+    // are added while other shaders are bound, so a batch binds the program it was made with and
+    // puts the previous one back. That program's uniforms have to be set before the first add.
+    #define INST_MAX 262144
+    struct Inst_Buf
+    {
+        GLuint program;
+
+        // Points into the mapped stream partition between ib_clear() and ib_draw_call(),
+        // inst_count is for the current batch
+        Tile_Instance *instances;
+        int inst_count;
+
+        int frame_inst_count;
+        int frame_batch_count;
+
+        GLuint vao;
+        Stream_Buf stream;
+    };
+
+    // Instance attributes can't be rebased like base vertex, so they're re-pointed at the partition
+    static void inst_attrib_setup(size_t offset)
+    {
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Tile_Instance), (void *)offset);
+        glEnableVertexAttribArray(0);
+        glVertexAttribDivisor(0, 1);
+        glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(Tile_Instance), (void *)(offset + offsetof(Tile_Instance, glyph)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Tile_Instance), (void *)(offset + offsetof(Tile_Instance, fg)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribDivisor(2, 1);
+        glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Tile_Instance), (void *)(offset + offsetof(Tile_Instance, bg)));
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+    }
+
+    static Inst_Buf *ib_make(GLuint program)
+    {
+        Inst_Buf *ib = (Inst_Buf *)malloc(sizeof(Inst_Buf));
+        ib->program = program;
+        ib->instances = nullptr;
+        ib->inst_count = 0;
+        ib->frame_inst_count = 0;
+        ib->frame_batch_count = 0;
+
+        glGenVertexArrays(1, &ib->vao);
+        gl_bind_vao(ib->vao);
+        ib->stream = stream_make(GL_ARRAY_BUFFER, sizeof(Tile_Instance) * INST_MAX);
+        inst_attrib_setup(0);
+        gl_bind_vao(0);
+
+        return ib;
     }
 
-    static int vb_next_vert_index(const Vert_Buf *vb)
+    static void ib_begin_batch(Inst_Buf *ib)
     {
-        return vb->vert_count;
+        ib->inst_count = 0;
+        ib->instances = (Tile_Instance *)stream_map(&ib->stream);
     }
 
-    static void vb_add_indices(Vert_Buf *vb, int base, int *indices, int index_count)
+    static void ib_end_batch(Inst_Buf *ib)
     {
-        for (int i = 0; i < index_count; i++)
+        stream_unmap(&ib->stream);
+        ib->instances = nullptr;
+
+        if (ib->inst_count > 0)
         {
-            if (vb->index_count < INDEX_MAX)
-            {
-                vb->indices[vb->index_count++] = base + indices[i];
-            }
+            GLuint prev_program = g_gl_state.program;
+            gl_use_program(ib->program);
+            gl_bind_vao(ib->vao);
+            gl_bind_buffer(GL_ARRAY_BUFFER, ib->stream.buffer);
+            inst_attrib_setup(stream_partition_offset(&ib->stream));
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, ib->inst_count);
+            ib->frame_batch_count++;
+            if (prev_program != GL_STATE_UNKNOWN) gl_use_program(prev_program);
+        }
+
+        stream_fence(&ib->stream);
+    }
+
+    // Starts a new frame of instances, maps the next stream partition for writing
+    static void ib_clear(Inst_Buf *ib)
+    {
+        ib->frame_inst_count = 0;
+        ib->frame_batch_count = 0;
+        ib_begin_batch(ib);
+    }
+
+    static void ib_free(Inst_Buf *ib)
+    {
+        stream_free(&ib->stream);
+        glDeleteVertexArrays(1, &ib->vao);
+        gl_state_forget();
+        free(ib);
+    }
+
+    // Draws the current batch first if it's full
+    static void ib_add(Inst_Buf *ib, Tile_Instance inst)
+    {
+        if (ib->inst_count == INST_MAX)
+        {
+            ib_end_batch(ib);
+            ib_begin_batch(ib);
         }
+        if (!ib->instances) return;
+
+        ib->instances[ib->inst_count++] = inst;
+        ib->frame_inst_count++;
     }
 
-    static void vb_draw_call(const Vert_Buf *vb)
+    // Draws the last batch and unmaps what ib_clear() mapped, so it has to be called every frame
+    static void ib_draw_call(Inst_Buf *ib)
     {
-        glBindVertexArray(vb->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vb->vbo);
-        glBufferData(GL_ARRAY_BUFFER, vb_max_vert_size(vb), NULL, GL_DYNAMIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, vb_vert_size(vb), vb->verts);
+        ib_end_batch(ib);
+    }
+
+    // Static mesh: geometry that lives on the GPU and is only re-uploaded when it changes
+    struct Mesh
+    {
+        GLuint vao, vbo;
+        Vert_Layout layout;
+        int quad_count;
+    };
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vb->ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, vb_max_index_size(vb), NULL, GL_DYNAMIC_DRAW);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vb_index_size(vb), vb->indices);
+    static Mesh mesh_make(Vert_Layout layout)
+    {
+        Mesh mesh = {};
+        mesh.layout = layout;
+        glGenVertexArrays(1, &mesh.vao);
+        glGenBuffers(1, &mesh.vbo);
+
+        gl_bind_vao(mesh.vao);
+        gl_bind_buffer(GL_ARRAY_BUFFER, mesh.vbo);
+        gl_bind_quad_indices();
+        vert_attrib_setup(layout);
+        gl_bind_vao(0);
+
+        return mesh;
+    }
 
-        glDrawElements(GL_TRIANGLES, vb->index_count, GL_UNSIGNED_INT, 0);
+    // vert_data is an array of quads in the mesh's layout, see vert_write
+    static void mesh_upload(Mesh *mesh, const void *vert_data, int quad_count)
+    {
+        if (quad_count > QUAD_MAX)
+        {
+            warning("Mesh of %d quads is over QUAD_MAX, truncating", quad_count);
+            quad_count = QUAD_MAX;
+        }
+        gl_bind_buffer(GL_ARRAY_BUFFER, mesh->vbo);
+        glBufferData(GL_ARRAY_BUFFER, vert_layout_stride(mesh->layout) * quad_count * 4, vert_data, GL_STATIC_DRAW);
+        mesh->quad_count = quad_count;
+    }
+
+    static void mesh_draw(const Mesh *mesh)
+    {
+        if (mesh->quad_count == 0) return;
+        gl_bind_vao(mesh->vao);
+        glDrawElements(GL_TRIANGLES, mesh->quad_count * 6, GL_UNSIGNED_SHORT, 0);
+    }
+
+    static void mesh_free(Mesh *mesh)
+    {
+        glDeleteBuffers(1, &mesh->vbo);
+        glDeleteVertexArrays(1, &mesh->vao);
+        gl_state_forget();
+        *mesh = {};
     }
 
     // GL: Shaders
@@ -233,11 +694,61 @@ namespace GLTiles
 
         GLuint prog = gl_create_shader_program(vs_src, fs_src);
 
-        glUseProgram(prog);
+        gl_use_program(prog);
         m4 ident = m4_identity();
-        glUniformMatrix4fv(glGetUniformLocation(prog, "uMvp"), 1, GL_FALSE, ident.d);
-        glUniform1i(glGetUniformLocation(prog, "uTex"), 0);
-        glUseProgram(0);
+        glUniformMatrix4fv(gl_uniform_location(prog, "uMvp"), 1, GL_FALSE, ident.d);
+        glUniform1i(gl_uniform_location(prog, "uTex"), 0);
+        gl_use_program(0);
+
+        return prog;
+    }
+
+    static GLuint gl_create_tiles_instanced_shader()
+    {
+        const char *vs_src =
+            "#version 330 core\n"
+            "layout (location = 0) in vec2 inPos;\n"
+            "layout (location = 1) in uint inGlyph;\n"
+            "layout (location = 2) in vec4 inFgColor;\n"
+            "layout (location = 3) in vec4 inBgColor;\n"
+            "uniform mat4 uMvp;\n"
+            "uniform float uTileDim;\n"
+            "uniform vec2 uTilesetGrid;\n"
+            "out vec2 TexCoord;\n"
+            "out vec4 FgColor;\n"
+            "out vec4 BgColor;\n"
+            "void main() {\n"
+            // Triangle strip: top-left, bottom-left, top-right, bottom-right
+            "    vec2 corner = vec2(float(gl_VertexID >> 1), float(gl_VertexID & 1));\n"
+            "    gl_Position = uMvp * vec4(inPos + corner * uTileDim, 0.0, 1.0);\n"
+            "    vec2 cell = vec2(float(inGlyph % uint(uTilesetGrid.x)), float(inGlyph / uint(uTilesetGrid.x)));\n"
+            // Same rect as get_rect_for_tilemap_glyph: rows count down from the top of the flipped texture
+            "    TexCoord = vec2((cell.x + corner.x) / uTilesetGrid.x, 1.0 - (cell.y + corner.y) / uTilesetGrid.y);\n"
+            "    FgColor = inFgColor;\n"
+            "    BgColor = inBgColor;\n"
+            "}\n";
+
+        const char *fs_src =
+            "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "in vec2 TexCoord;\n"
+            "in vec4 FgColor;\n"
+            "in vec4 BgColor;\n"
+            "uniform sampler2D uTex;\n"
+            "void main() {\n"
+            "    float t = texture(uTex, TexCoord).r;\n"
+            "    FragColor = mix(BgColor, FgColor, t);\n"
+            "}\n";
+
+        GLuint prog = gl_create_shader_program(vs_src, fs_src);
+
+        gl_use_program(prog);
+        m4 ident = m4_identity();
+        glUniformMatrix4fv(gl_uniform_location(prog, "uMvp"), 1, GL_FALSE, ident.d);
+        glUniform1i(gl_uniform_location(prog, "uTex"), 0);
+        glUniform1f(gl_uniform_location(prog, "uTileDim"), 16.0f);
+        glUniform2f(gl_uniform_location(prog, "uTilesetGrid"), (f32)TILESET_COLS, (f32)TILESET_ROWS);
+        gl_use_program(0);
 
         return prog;
     }
@@ -250,27 +761,59 @@ namespace GLTiles
         GLenum internal_format, format;
     };
 
-    static Texture gl_load_texture(const char *path, GLint sampling_type, bool flip_vertically)
+    // Decoded images are flipped here rather than with stbi's global flag, so decoding is safe off the main thread
+    static void flip_rows(u8 *pixels, int w, int h, int ch)
     {
-        Texture tex;
-
-        stbi_set_flip_vertically_on_load(flip_vertically);
-
-        unsigned char *tex_data = stbi_load(path, &tex.w, &tex.h, &tex.ch, 0);
+        size_t stride = (size_t)w * ch;
+        u8 row[STR_BUF_LARGE * 16];
+        for (int y = 0; y < h / 2; y++)
+        {
+            u8 *a = pixels + stride * y;
+            u8 *b = pixels + stride * (h - 1 - y);
+            for (size_t done = 0; done < stride; done += sizeof(row))
+            {
+                size_t n = stride - done < sizeof(row) ? stride - done : sizeof(row);
+                memcpy(row, a + done, n);
+                memcpy(a + done, b + done, n);
+                memcpy(b + done, row, n);
+            }
+        }
+    }
 
-        if (tex.ch == 4) { tex.internal_format = GL_RGBA8; tex.format = GL_RGBA; }
-        else if (tex.ch == 3) { tex.internal_format = GL_RGB8; tex.format = GL_RGB; }
-        else if (tex.ch == 2) { tex.internal_format = GL_RG8; tex.format = GL_RG; }
-        else if (tex.ch == 1) { tex.internal_format = GL_R8; tex.format = GL_RED; }
+    // Expects tex w, h, ch to be set, fills in the rest
+    static void gl_upload_texture(Texture *tex, const u8 *pixels, GLint sampling_type)
+    {
+        if (tex->ch == 4) { tex->internal_format = GL_RGBA8; tex->format = GL_RGBA; }
+        else if (tex->ch == 3) { tex->internal_format = GL_RGB8; tex->format = GL_RGB; }
+        else if (tex->ch == 2) { tex->internal_format = GL_RG8; tex->format = GL_RG; }
+        else if (tex->ch == 1) { tex->internal_format = GL_R8; tex->format = GL_RED; }
 
-        glGenTextures(1, &tex.texture_id);
-        glBindTexture(GL_TEXTURE_2D, tex.texture_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, tex.internal_format, tex.w, tex.h, 0, tex.format, GL_UNSIGNED_BYTE, tex_data);
+        glGenTextures(1, &tex->texture_id);
+        gl_bind_texture(0, tex->texture_id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, tex->internal_format, tex->w, tex->h, 0, tex->format, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampling_type);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampling_type);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        gl_bind_texture(0, 0);
+    }
+
+    // Synchronous, see texture_loader.cpp for loading on the job pool
+    static Texture gl_load_texture(const char *path, GLint sampling_type, bool flip_vertically)
+    {
+        Texture tex = {};
+
+        unsigned char *tex_data = stbi_load(path, &tex.w, &tex.h, &tex.ch, 0);
+        if (!tex_data)
+        {
+            warning("Can't load texture %s: %s", path, stbi_failure_reason());
+            return tex;
+        }
+
+        if (flip_vertically) flip_rows(tex_data, tex.w, tex.h, tex.ch);
+        gl_upload_texture(&tex, tex_data, sampling_type);
 
         stbi_image_free(tex_data);
 
@@ -280,5 +823,6 @@ namespace GLTiles
     static void gl_delete_texture(Texture *tex)
     {
         glDeleteTextures(1, &tex->texture_id);
+        gl_state_forget();
     }
 }
@@ -0,0 +1,623 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "types.hpp"
+#include "util.hpp"
+
+#include "level.cpp"
+#include "pathfinding.cpp"
+
+/*
+ * Hierarchical pathfinding (HPA*) for routes too long for a grid search window.
+ *
+ * Chunks are the clusters. Along each chunk border, every run of tiles open on
+ * both sides becomes an entrance: one node in the middle of a short run, one at
+ * each end of a long one. Each chunk caches its border nodes and the shortest
+ * distance between every pair of them, moving only inside the chunk. Nodes that
+ * face each other across a border are joined by a single straight step.
+ *
+ * A query finds the start's and goal's distances to their chunk's nodes and runs
+ * A* over that graph. The result is a list of waypoints, consecutive ones share a
+ * chunk or face each other across a border, so each leg is short enough for
+ * Path_Service to refine once it's actually walked.
+ *
+ * Routes bend through entrances, so they run a few percent over the true
+ * shortest path (more on short ones, which Path_Service handles better anyway).
+ * The heuristic is weighted by about as much: it costs little extra length and
+ * stops a long search from opening every node within that slack.
+ *
+ * Caches are built the first time a search touches a chunk and checked against
+ * the chunk's blocking_version and the facing edge_versions of its neighbors, so
+ * changing a tile only rebuilds that chunk, plus the one across the edge if the
+ * tile was on it. A chunk that isn't cached and isn't resident reads as blocked.
+ *
+ * Main thread only, chunk builds share one static scratch buffer.
+ */
+
+#define HPA_ENTRANCE_SPLIT 6
+#define HPA_CHUNK_NODES_MAX 128 // at most 32 runs per side
+#define HPA_COST_UNREACHABLE 0xFFFF
+#define HPA_VERSION_UNKNOWN 0xFFFFFFFFu
+#define HPA_BUCKETS 8
+#define HPA_HEURISTIC_WEIGHT 5 // percent over octile
+
+// Same order as Chunk::edge_versions, opposite sides pair up as side ^ 1
+enum Hpa_Side
+{
+    HPA_SIDE_LEFT,
+    HPA_SIDE_RIGHT,
+    HPA_SIDE_UP,
+    HPA_SIDE_DOWN,
+    HPA_SIDE_COUNT,
+};
+
+static const int hpa_side_dx[HPA_SIDE_COUNT] = {-1, 1, 0, 0};
+static const int hpa_side_dy[HPA_SIDE_COUNT] = {0, 0, -1, 1};
+
+struct Hpa_Chunk;
+
+struct Hpa_Node
+{
+    // Chunk local, always on the edge of the chunk
+    u8 x, y;
+    u8 side;
+
+    // Search state, stamped with the query generation like Path_Node
+    bool is_closed;
+    u32 generation;
+    u32 g;
+    Hpa_Chunk *parent_chunk; // null for the query start
+    u32 parent_index;
+};
+
+struct Hpa_Chunk
+{
+    v2i coord;
+    bool is_built;
+    u32 checked_generation; // validated during this query already
+
+    // What the cache was built from
+    u32 blocking_version;
+    u32 facing_versions[HPA_SIDE_COUNT]; // neighbor edge_versions, 0 for a missing neighbor
+
+    int node_count;
+    Hpa_Node *nodes;
+    u16 *costs; // node_count x node_count, HPA_COST_UNREACHABLE if no path inside the chunk
+};
+
+struct Hpa_Heap_Entry
+{
+    u64 key; // f in the high half, h in the low half
+    Hpa_Chunk *chunk; // null for the goal
+    u32 index;
+};
+
+struct Hpa_Request
+{
+    v2i start;
+    v2i goal;
+
+    // Caller owned waypoints, start and goal included. Only the first point_capacity points are written.
+    v2i *points;
+    int point_capacity;
+
+    Path_Status status;
+    int point_count;
+    u32 cost;
+    int expanded_count;
+    int chunks_built;
+};
+
+// Chunk builds and the start and goal searches run on the main thread only
+static u16 g_hpa_dist[CHUNK_DIM * CHUNK_DIM];
+static u16 g_hpa_buckets[HPA_BUCKETS][CHUNK_DIM * CHUNK_DIM];
+static int g_hpa_bucket_counts[HPA_BUCKETS];
+
+static inline void hpa_bucket_relax(u32 index, u32 d, int *queued)
+{
+    if (d >= g_hpa_dist[index]) return;
+    g_hpa_dist[index] = (u16)d;
+    int bucket = (int)(d / 2) & (HPA_BUCKETS - 1);
+    g_hpa_buckets[bucket][g_hpa_bucket_counts[bucket]++] = (u16)index;
+    (*queued)++;
+}
+
+// Fills g_hpa_dist with the cost from (x, y) to every tile of the chunk, moving only inside it.
+// Stops once every tile set in targets is settled, clearing them as it goes.
+//
+// Step costs are 5 and 7 in units of 2, so a ring of 8 buckets covers every cost still open
+// (Dial's algorithm). A tile sits at most once in a bucket, stale copies are skipped on pop.
+static void hpa_chunk_dijkstra(const Chunk_Tiles *data, int x, int y, u64 targets[CHUNK_DIM])
+{
+    memset(g_hpa_dist, 0xFF, sizeof(g_hpa_dist));
+    memset(g_hpa_bucket_counts, 0, sizeof(g_hpa_bucket_counts));
+    int targets_left = 0;
+    for (int row = 0; row < CHUNK_DIM; row++)
+    {
+        targets_left += __builtin_popcountll(targets[row]);
+    }
+
+    // Open rows padded with a closed row above and below, so only columns need bounds checks
+    u64 open[CHUNK_DIM + 2];
+    open[0] = 0;
+    open[CHUNK_DIM + 1] = 0;
+    for (int row = 0; row < CHUNK_DIM; row++)
+    {
+        open[row + 1] = ~data->planes[TILE_PLANE_BLOCKING][row];
+    }
+
+    u16 start = (u16)(y * CHUNK_DIM + x);
+    g_hpa_dist[start] = 0;
+    g_hpa_buckets[0][g_hpa_bucket_counts[0]++] = start;
+    int queued = 1;
+    for (u32 d = 0; queued > 0 && targets_left > 0; d += 2)
+    {
+        int bucket = (int)(d / 2) & (HPA_BUCKETS - 1);
+        u16 *items = g_hpa_buckets[bucket];
+        int count = g_hpa_bucket_counts[bucket];
+        g_hpa_bucket_counts[bucket] = 0;
+        queued -= count;
+
+        for (int i = 0; i < count; i++)
+        {
+            u32 index = items[i];
+            if (g_hpa_dist[index] != d) continue;
+
+            int cx = (int)(index & CHUNK_MASK);
+            int cy = (int)(index >> CHUNK_SHIFT);
+            u64 bit = 1ull << cx;
+            if (targets[cy] & bit)
+            {
+                targets[cy] &= ~bit;
+                targets_left--;
+            }
+
+            // Columns cx - 1 .. cx + 1 of the rows around the tile on bits 0..2, off the chunk reads as closed
+            u64 above, here, below;
+            if (cx > 0)
+            {
+                above = (open[cy] >> (cx - 1)) & 7;
+                here = (open[cy + 1] >> (cx - 1)) & 7;
+                below = (open[cy + 2] >> (cx - 1)) & 7;
+            }
+            else
+            {
+                above = (open[cy] << 1) & 7;
+                here = (open[cy + 1] << 1) & 7;
+                below = (open[cy + 2] << 1) & 7;
+            }
+
+            u32 straight = d + PATH_COST_STRAIGHT;
+            u32 diagonal = d + PATH_COST_DIAGONAL;
+            bool left = here & 1;
+            bool right = (here >> 2) & 1;
+            bool up = (above >> 1) & 1;
+            bool down = (below >> 1) & 1;
+            if (left) hpa_bucket_relax(index - 1, straight, &queued);
+            if (right) hpa_bucket_relax(index + 1, straight, &queued);
+            if (up) hpa_bucket_relax(index - CHUNK_DIM, straight, &queued);
+            if (down) hpa_bucket_relax(index + CHUNK_DIM, straight, &queued);
+            // No cutting wall corners
+            if (up && left && (above & 1)) hpa_bucket_relax(index - CHUNK_DIM - 1, diagonal, &queued);
+            if (up && right && (above & 4)) hpa_bucket_relax(index - CHUNK_DIM + 1, diagonal, &queued);
+            if (down && left && (below & 1)) hpa_bucket_relax(index + CHUNK_DIM - 1, diagonal, &queued);
+            if (down && right && (below & 4)) hpa_bucket_relax(index + CHUNK_DIM + 1, diagonal, &queued);
+        }
+    }
+}
+
+// Blocking bits along one edge of the chunk, bit k is the k-th tile along it
+static inline u64 hpa_border_bits(const Chunk_Tiles *data, int side)
+{
+    switch (side)
+    {
+        case HPA_SIDE_LEFT: return data->blocking_columns[0];
+        case HPA_SIDE_RIGHT: return data->blocking_columns[CHUNK_MASK];
+        case HPA_SIDE_UP: return data->planes[TILE_PLANE_BLOCKING][0];
+        default: return data->planes[TILE_PLANE_BLOCKING][CHUNK_MASK];
+    }
+}
+
+static inline void hpa_side_pos(int side, int along, int *x, int *y)
+{
+    switch (side)
+    {
+        case HPA_SIDE_LEFT: *x = 0; *y = along; break;
+        case HPA_SIDE_RIGHT: *x = CHUNK_MASK; *y = along; break;
+        case HPA_SIDE_UP: *x = along; *y = 0; break;
+        default: *x = along; *y = CHUNK_MASK; break;
+    }
+}
+
+static void hpa_chunk_free(Hpa_Chunk *hc)
+{
+    free(hc->nodes);
+    free(hc->costs);
+    free(hc);
+}
+
+static inline v2i hpa_node_world_pos(Hpa_Chunk *hc, int index)
+{
+    Hpa_Node *node = &hc->nodes[index];
+    return (v2i){{{(hc->coord.x << CHUNK_SHIFT) + node->x, (hc->coord.y << CHUNK_SHIFT) + node->y}}};
+}
+
+struct Hpa_Graph
+{
+    Level *level;
+    Coord_Map<Hpa_Chunk> chunks;
+    u32 generation;
+    int build_count;
+
+    std::vector<Hpa_Heap_Entry> heap;
+    std::vector<v2i> route;
+
+    // Current query
+    v2i goal;
+    Hpa_Chunk *goal_chunk;
+    u16 goal_costs[HPA_CHUNK_NODES_MAX];
+    u32 goal_g;
+    Hpa_Chunk *goal_parent_chunk;
+    u32 goal_parent_index;
+
+    void init(Level *level)
+    {
+        this->level = level;
+    }
+
+    bool is_current(Hpa_Chunk *hc, Chunk *chunk)
+    {
+        if (!hc->is_built || hc->blocking_version != chunk->blocking_version) return false;
+        for (int side = 0; side < HPA_SIDE_COUNT; side++)
+        {
+            Chunk *neighbor = level->chunks.find(hc->coord.x + hpa_side_dx[side], hc->coord.y + hpa_side_dy[side]);
+            if (hc->facing_versions[side] == HPA_VERSION_UNKNOWN)
+            {
+                // Built while the neighbor was paged out, redo it once it's back
+                if (neighbor && neighbor->data) return false;
+                continue;
+            }
+            if (hc->facing_versions[side] != (neighbor ? neighbor->edge_versions[side ^ 1] : 0)) return false;
+        }
+        return true;
+    }
+
+    void build(Hpa_Chunk *hc, Chunk *chunk)
+    {
+        const Chunk_Tiles *data = chunk->data;
+        Hpa_Node nodes[HPA_CHUNK_NODES_MAX];
+        int node_count = 0;
+
+        for (int side = 0; side < HPA_SIDE_COUNT; side++)
+        {
+            Chunk *neighbor = level->chunks.find(hc->coord.x + hpa_side_dx[side], hc->coord.y + hpa_side_dy[side]);
+            u64 open = 0;
+            if (!neighbor)
+            {
+                hc->facing_versions[side] = 0;
+            }
+            else if (!neighbor->data)
+            {
+                level->pager->request_load(neighbor);
+                hc->facing_versions[side] = HPA_VERSION_UNKNOWN;
+            }
+            else
+            {
+                open = ~hpa_border_bits(data, side) & ~hpa_border_bits(neighbor->data, side ^ 1);
+                hc->facing_versions[side] = neighbor->edge_versions[side ^ 1];
+            }
+
+            // Both chunks see the same runs, so nodes always come in facing pairs
+            while (open)
+            {
+                int first = __builtin_ctzll(open);
+                u64 rest = ~(open >> first);
+                int length = rest ? __builtin_ctzll(rest) : CHUNK_DIM - first;
+                int last = first + length - 1;
+                open &= length + first >= 64 ? 0 : ~0ull << (first + length);
+
+                int alongs[2] = {(first + last) / 2, last};
+                int along_count = 1;
+                if (length >= HPA_ENTRANCE_SPLIT)
+                {
+                    alongs[0] = first;
+                    along_count = 2;
+                }
+                for (int i = 0; i < along_count; i++)
+                {
+                    int x, y;
+                    hpa_side_pos(side, alongs[i], &x, &y);
+                    nodes[node_count++] = Hpa_Node{(u8)x, (u8)y, (u8)side};
+                }
+            }
+        }
+
+        hc->node_count = node_count;
+        hc->nodes = (Hpa_Node *)realloc(hc->nodes, (size_t)(node_count ? node_count : 1) * sizeof(Hpa_Node));
+        hc->costs = (u16 *)realloc(hc->costs, (size_t)(node_count ? node_count * node_count : 1) * sizeof(u16));
+        memcpy(hc->nodes, nodes, (size_t)node_count * sizeof(Hpa_Node));
+
+        // Costs are symmetric, each search only needs the nodes after its own
+        for (int i = 0; i < node_count; i++)
+        {
+            hc->costs[i * node_count + i] = 0;
+            if (i + 1 == node_count) break;
+
+            u64 targets[CHUNK_DIM] = {};
+            for (int j = i + 1; j < node_count; j++)
+            {
+                targets[nodes[j].y] |= 1ull << nodes[j].x;
+            }
+            hpa_chunk_dijkstra(data, nodes[i].x, nodes[i].y, targets);
+            for (int j = i + 1; j < node_count; j++)
+            {
+                u16 cost = g_hpa_dist[nodes[j].y * CHUNK_DIM + nodes[j].x];
+                hc->costs[i * node_count + j] = cost;
+                hc->costs[j * node_count + i] = cost;
+            }
+        }
+
+        hc->blocking_version = chunk->blocking_version;
+        hc->is_built = true;
+        build_count++;
+    }
+
+    // Builds or rebuilds the chunk's cache when it's stale, null if the chunk can't be crossed
+    Hpa_Chunk *get_chunk(int chunk_x, int chunk_y)
+    {
+        Chunk *chunk = level->chunks.find(chunk_x, chunk_y);
+        if (!chunk) return nullptr;
+
+        Hpa_Chunk *hc = chunks.find(chunk_x, chunk_y);
+        if (hc && hc->checked_generation == generation) return hc;
+        if (hc && is_current(hc, chunk))
+        {
+            hc->checked_generation = generation;
+            return hc;
+        }
+        if (!chunk->data)
+        {
+            level->pager->request_load(chunk);
+            // Tiles can't change while paged out, only the facing borders might have
+            if (!hc || !hc->is_built || hc->blocking_version != chunk->blocking_version) return nullptr;
+            hc->checked_generation = generation;
+            return hc;
+        }
+
+        if (!hc)
+        {
+            hc = (Hpa_Chunk *)calloc(1, sizeof(Hpa_Chunk));
+            hc->coord = (v2i){{{chunk_x, chunk_y}}};
+            chunks.insert(chunk_x, chunk_y, hc);
+        }
+        build(hc, chunk);
+        hc->checked_generation = generation;
+        return hc;
+    }
+
+    // Distances from a tile to each node of its chunk, written to costs
+    void get_tile_costs(Hpa_Chunk *hc, v2i tile, u16 *costs)
+    {
+        Chunk *chunk = level->chunks.find(hc->coord.x, hc->coord.y);
+        u64 targets[CHUNK_DIM] = {};
+        for (int i = 0; i < hc->node_count; i++)
+        {
+            targets[hc->nodes[i].y] |= 1ull << hc->nodes[i].x;
+        }
+        hpa_chunk_dijkstra(chunk->data, tile_to_local(tile.x), tile_to_local(tile.y), targets);
+        for (int i = 0; i < hc->node_count; i++)
+        {
+            costs[i] = g_hpa_dist[hc->nodes[i].y * CHUNK_DIM + hc->nodes[i].x];
+        }
+    }
+
+    void heap_push(u64 key, Hpa_Chunk *hc, u32 index)
+    {
+        heap.push_back(Hpa_Heap_Entry{key, hc, index});
+        size_t i = heap.size() - 1;
+        while (i > 0)
+        {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent].key <= heap[i].key) break;
+            Hpa_Heap_Entry tmp = heap[parent];
+            heap[parent] = heap[i];
+            heap[i] = tmp;
+            i = parent;
+        }
+    }
+
+    Hpa_Heap_Entry heap_pop()
+    {
+        Hpa_Heap_Entry top = heap[0];
+        heap[0] = heap.back();
+        heap.pop_back();
+        size_t i = 0;
+        for (;;)
+        {
+            size_t smallest = i;
+            size_t left = 2 * i + 1;
+            size_t right = left + 1;
+            if (left < heap.size() && heap[left].key < heap[smallest].key) smallest = left;
+            if (right < heap.size() && heap[right].key < heap[smallest].key) smallest = right;
+            if (smallest == i) break;
+            Hpa_Heap_Entry tmp = heap[smallest];
+            heap[smallest] = heap[i];
+            heap[i] = tmp;
+            i = smallest;
+        }
+        return top;
+    }
+
+    // No decrease key: a cheaper path pushes the node again, the stale entry is skipped once it's closed
+    void relax(Hpa_Chunk *hc, u32 index, u32 g, Hpa_Chunk *parent_chunk, u32 parent_index)
+    {
+        Hpa_Node *node = &hc->nodes[index];
+        if (node->generation != generation)
+        {
+            node->generation = generation;
+            node->g = PATH_COST_UNSEEN;
+            node->is_closed = false;
+        }
+        if (node->is_closed || g >= node->g) return;
+
+        node->g = g;
+        node->parent_chunk = parent_chunk;
+        node->parent_index = parent_index;
+        v2i p = hpa_node_world_pos(hc, (int)index);
+        u32 h = path_octile(p.x, p.y, goal.x, goal.y);
+        h += h * HPA_HEURISTIC_WEIGHT / 100;
+        heap_push(((u64)(g + h) << 32) | h, hc, index);
+    }
+
+    void relax_goal(u32 g, Hpa_Chunk *parent_chunk, u32 parent_index)
+    {
+        if (g >= goal_g) return;
+        goal_g = g;
+        goal_parent_chunk = parent_chunk;
+        goal_parent_index = parent_index;
+        heap_push((u64)g << 32, nullptr, 0);
+    }
+
+    void expand(Hpa_Chunk *hc, u32 index)
+    {
+        Hpa_Node *node = &hc->nodes[index];
+        u32 g = node->g;
+
+        const u16 *row = &hc->costs[index * hc->node_count];
+        for (int j = 0; j < hc->node_count; j++)
+        {
+            if ((u32)j != index && row[j] != HPA_COST_UNREACHABLE) relax(hc, (u32)j, g + row[j], hc, index);
+        }
+
+        if (hc == goal_chunk && goal_costs[index] != HPA_COST_UNREACHABLE)
+        {
+            relax_goal(g + goal_costs[index], hc, index);
+        }
+
+        // Across the border to the facing node, it's there if the neighbor could be built
+        int side = node->side;
+        Hpa_Chunk *neighbor = get_chunk(hc->coord.x + hpa_side_dx[side], hc->coord.y + hpa_side_dy[side]);
+        if (!neighbor) return;
+        int facing_x = (node->x + hpa_side_dx[side]) & CHUNK_MASK;
+        int facing_y = (node->y + hpa_side_dy[side]) & CHUNK_MASK;
+        for (int j = 0; j < neighbor->node_count; j++)
+        {
+            Hpa_Node *other = &neighbor->nodes[j];
+            if (other->x == facing_x && other->y == facing_y && other->side == (side ^ 1))
+            {
+                relax(neighbor, (u32)j, g + PATH_COST_STRAIGHT, hc, index);
+                break;
+            }
+        }
+    }
+
+    void write_points(Hpa_Request *req)
+    {
+        route.clear();
+        route.push_back(req->goal);
+        Hpa_Chunk *hc = goal_parent_chunk;
+        u32 index = goal_parent_index;
+        while (hc)
+        {
+            v2i p = hpa_node_world_pos(hc, (int)index);
+            // Corner tiles can hold a node for each of their two sides
+            if (p.x != route.back().x || p.y != route.back().y) route.push_back(p);
+            Hpa_Node *node = &hc->nodes[index];
+            hc = node->parent_chunk;
+            index = node->parent_index;
+        }
+        if (req->start.x != route.back().x || req->start.y != route.back().y) route.push_back(req->start);
+
+        int count = (int)route.size();
+        req->point_count = count < req->point_capacity ? count : req->point_capacity;
+        for (int i = 0; i < req->point_count; i++)
+        {
+            req->points[i] = route[count - 1 - i];
+        }
+    }
+
+    void find(Hpa_Request *req)
+    {
+        req->status = PATH_NOT_FOUND;
+        req->point_count = 0;
+        req->cost = 0;
+        req->expanded_count = 0;
+        int builds_before = build_count;
+
+        generation++;
+        if (generation == 0)
+        {
+            // Wrapped, reset every stamp
+            for (u32 i = 0; i < chunks.capacity; i++)
+            {
+                Hpa_Chunk *hc = chunks.slots[i].value;
+                if (hc) hc->checked_generation = 0;
+                for (int j = 0; hc && j < hc->node_count; j++)
+                {
+                    hc->nodes[j].generation = 0;
+                }
+            }
+            generation = 1;
+        }
+
+        Hpa_Chunk *start_chunk = get_chunk(tile_to_chunk(req->start.x), tile_to_chunk(req->start.y));
+        goal_chunk = get_chunk(tile_to_chunk(req->goal.x), tile_to_chunk(req->goal.y));
+        req->chunks_built = build_count - builds_before;
+        if (!start_chunk || !goal_chunk) return;
+        // Paged out tiles read as blocked, so past here both chunks have their tiles
+        if (level->get_tile_bit(TILE_PLANE_BLOCKING, req->start.x, req->start.y) || level->get_tile_bit(TILE_PLANE_BLOCKING, req->goal.x, req->goal.y)) return;
+
+        heap.clear();
+        goal = req->goal;
+        goal_g = PATH_COST_UNSEEN;
+        goal_parent_chunk = nullptr;
+
+        get_tile_costs(goal_chunk, req->goal, goal_costs);
+
+        u16 start_costs[HPA_CHUNK_NODES_MAX];
+        get_tile_costs(start_chunk, req->start, start_costs);
+        if (start_chunk == goal_chunk)
+        {
+            // The search from the start only ran until it settled the nodes, look for the goal separately
+            u64 targets[CHUNK_DIM] = {};
+            targets[tile_to_local(req->goal.y)] = 1ull << tile_to_local(req->goal.x);
+            hpa_chunk_dijkstra(level->chunks.find(start_chunk->coord.x, start_chunk->coord.y)->data,
+                tile_to_local(req->start.x), tile_to_local(req->start.y), targets);
+            u16 direct = g_hpa_dist[tile_to_local(req->goal.y) * CHUNK_DIM + tile_to_local(req->goal.x)];
+            if (direct != HPA_COST_UNREACHABLE) relax_goal(direct, nullptr, 0);
+        }
+        for (int i = 0; i < start_chunk->node_count; i++)
+        {
+            if (start_costs[i] != HPA_COST_UNREACHABLE) relax(start_chunk, (u32)i, start_costs[i], nullptr, 0);
+        }
+
+        while (!heap.empty())
+        {
+            Hpa_Heap_Entry entry = heap_pop();
+            if (!entry.chunk)
+            {
+                req->status = PATH_FOUND;
+                req->cost = goal_g;
+                write_points(req);
+                break;
+            }
+
+            Hpa_Node *node = &entry.chunk->nodes[entry.index];
+            if (node->is_closed) continue;
+            node->is_closed = true;
+            req->expanded_count++;
+            expand(entry.chunk, entry.index);
+        }
+        req->chunks_built = build_count - builds_before;
+    }
+
+    // Drops every cache, for when the level is regenerated and chunk versions start over
+    void clear()
+    {
+        chunks.free_all(hpa_chunk_free);
+        heap.clear();
+    }
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util.hpp"
+
+/*
+ * Fixed set of worker threads pulling plain function + data jobs off one queue.
+ * Jobs don't return anything, they hand results back through whatever queue
+ * their data points to.
+ */
+
+struct Job
+{
+    void (*fn)(void *data);
+    void *data;
+};
+
+struct Job_Pool
+{
+    std::vector<std::thread> workers;
+    std::deque<Job> queue;
+    std::mutex mutex;
+    std::condition_variable has_work;
+    std::condition_variable is_idle;
+    int busy_count = 0;
+    bool stopping = false;
+
+    // worker_count <= 0 picks one less than the hardware threads, the main thread is busy too
+    void start(int worker_count)
+    {
+        if (worker_count <= 0)
+        {
+            worker_count = (int)std::thread::hardware_concurrency() - 1;
+            if (worker_count < 1) worker_count = 1;
+        }
+        stopping = false;
+        for (int i = 0; i < worker_count; i++)
+        {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    // Finishes the queued jobs first
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        has_work.notify_all();
+        for (std::thread &t : workers)
+        {
+            t.join();
+        }
+        workers.clear();
+    }
+
+    void push(void (*fn)(void *data), void *data)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(Job{fn, data});
+        }
+        has_work.notify_one();
+    }
+
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        is_idle.wait(lock, [this]() { return queue.empty() && busy_count == 0; });
+    }
+
+    int get_worker_count()
+    {
+        return (int)workers.size();
+    }
+
+    void work()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                has_work.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = queue.front();
+                queue.pop_front();
+                busy_count++;
+            }
+
+            job.fn(job.data);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy_count--;
+                if (queue.empty() && busy_count == 0) is_idle.notify_all();
+            }
+        }
+    }
+};
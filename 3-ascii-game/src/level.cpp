@@ -0,0 +1,997 @@
+#pragma once
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "types.hpp"
+#include "util.hpp"
+
+#include "gl_tiles.cpp"
+#include "job_pool.cpp"
+
+#define GAME_COLOR_BLACK (v4){{{0.0f, 0.0f, 0.0f, 1.0f}}}
+#define GAME_COLOR_RED   (v4){{{1.0f, 0.0f, 0.0f, 1.0f}}}
+#define GAME_COLOR_GRAY1 (v4){{{0.1f, 0.1f, 0.1f, 1.0f}}}
+#define GAME_COLOR_GRAY3 (v4){{{0.5f, 0.5f, 0.5f, 1.0f}}}
+#define GAME_COLOR_GRAY4 (v4){{{0.7f, 0.7f, 0.7f, 1.0f}}}
+#define GAME_COLOR_GRAY5 (v4){{{0.85f, 0.85f, 0.85f, 1.0f}}}
+#define GAME_COLOR_ENTITY_BG (v4){{{0.3f, 0.3f, 0.3f, 0.8f}}}
+#define GAME_COLOR_DEEP_WATER (v4){{{0.05f, 0.1f, 0.3f, 1.0f}}}
+#define GAME_COLOR_WATER (v4){{{0.2f, 0.4f, 0.8f, 1.0f}}}
+#define GAME_COLOR_SAND (v4){{{0.8f, 0.75f, 0.45f, 1.0f}}}
+#define GAME_COLOR_GRASS (v4){{{0.35f, 0.65f, 0.25f, 1.0f}}}
+#define GAME_COLOR_FOREST (v4){{{0.1f, 0.45f, 0.15f, 1.0f}}}
+#define GAME_COLOR_HILLS (v4){{{0.55f, 0.45f, 0.3f, 1.0f}}}
+#define GAME_COLOR_SNOW (v4){{{0.95f, 0.95f, 1.0f, 1.0f}}}
+
+struct Glyph
+{
+    int col, row;
+    v4 fg_color, bg_color;
+};
+
+enum MapTileKind : u8
+{
+    MAP_TILE_NONE,
+    MAP_TILE_LOADING,
+    MAP_TILE_GROUND,
+    MAP_TILE_WALL,
+    MAP_TILE_DEEP_WATER,
+    MAP_TILE_WATER,
+    MAP_TILE_SAND,
+    MAP_TILE_GRASS,
+    MAP_TILE_FOREST,
+    MAP_TILE_HILLS,
+    MAP_TILE_MOUNTAIN,
+    MAP_TILE_SNOW,
+    MAP_TILE_COUNT
+};
+
+struct MapTile
+{
+    MapTileKind kind;
+    bool is_blocking;
+    bool is_opaque;
+
+    Glyph get_glyph()
+    {
+        switch(kind)
+        {
+            case MAP_TILE_GROUND: return (Glyph){14, 2, GAME_COLOR_GRAY3, GAME_COLOR_GRAY1};
+            case MAP_TILE_WALL:   return (Glyph){3, 2,  GAME_COLOR_GRAY4, GAME_COLOR_GRAY1};
+            case MAP_TILE_LOADING: return (Glyph){0, 0, GAME_COLOR_GRAY1, GAME_COLOR_BLACK};
+            // Code page 437 cells: double tilde, tilde, period, quote, club, arch, triangle
+            case MAP_TILE_DEEP_WATER: return (Glyph){7, 15, GAME_COLOR_WATER, GAME_COLOR_DEEP_WATER};
+            case MAP_TILE_WATER:  return (Glyph){14, 7, GAME_COLOR_WATER, GAME_COLOR_GRAY1};
+            case MAP_TILE_SAND:   return (Glyph){14, 2, GAME_COLOR_SAND,  GAME_COLOR_GRAY1};
+            case MAP_TILE_GRASS:  return (Glyph){2, 2,  GAME_COLOR_GRASS, GAME_COLOR_GRAY1};
+            case MAP_TILE_FOREST: return (Glyph){5, 0,  GAME_COLOR_FOREST, GAME_COLOR_GRAY1};
+            case MAP_TILE_HILLS:  return (Glyph){15, 14, GAME_COLOR_HILLS, GAME_COLOR_GRAY1};
+            case MAP_TILE_MOUNTAIN: return (Glyph){14, 1, GAME_COLOR_GRAY4, GAME_COLOR_GRAY1};
+            case MAP_TILE_SNOW:   return (Glyph){14, 1, GAME_COLOR_SNOW,  GAME_COLOR_GRAY1};
+            default:              return (Glyph){0, 0,  GAME_COLOR_RED,   GAME_COLOR_RED};
+        }
+    }
+
+    const char *get_name()
+    {
+        switch (kind)
+        {
+            case MAP_TILE_GROUND: return "Ground";
+            case MAP_TILE_WALL: return "Wall";
+            case MAP_TILE_LOADING: return "Loading";
+            case MAP_TILE_DEEP_WATER: return "Deep water";
+            case MAP_TILE_WATER: return "Water";
+            case MAP_TILE_SAND: return "Sand";
+            case MAP_TILE_GRASS: return "Grass";
+            case MAP_TILE_FOREST: return "Forest";
+            case MAP_TILE_HILLS: return "Hills";
+            case MAP_TILE_MOUNTAIN: return "Mountain";
+            case MAP_TILE_SNOW: return "Snow";
+
+            case MAP_TILE_NONE:
+            case MAP_TILE_COUNT:
+                return "Unknown";
+        }
+    }
+};
+
+// Anything that was never set is solid rock: blocks movement and sight, isn't drawn
+static inline MapTile get_void_tile()
+{
+    return (MapTile){MAP_TILE_NONE, true, true};
+}
+
+// Stands in for tiles of a chunk that is still on disk, blocking so nothing walks or sees into it
+static inline MapTile get_loading_tile()
+{
+    return (MapTile){MAP_TILE_LOADING, true, true};
+}
+
+f32 get_glyph_dim();
+
+/*
+ * The world is a sparse set of CHUNK_DIM x CHUNK_DIM chunks in an open addressing
+ * hash keyed by chunk coordinate, so it can be any size and only costs memory
+ * where tiles were set. Tile coordinates can be negative, chunk coordinates are
+ * tile coordinates shifted down (floor division).
+ */
+#define CHUNK_SHIFT 6
+#define CHUNK_DIM (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_DIM - 1)
+
+// Each chunk is cached on the GPU in render sections, rebuilt when set_tile touches them
+#define CHUNK_SECTION_DIM 16
+#define CHUNK_SECTIONS (CHUNK_DIM / CHUNK_SECTION_DIM)
+
+/*
+ * Tile attributes are also kept as bitplanes, one u64 per chunk row (CHUNK_DIM
+ * is 64), bit n is column n. Collision, sight and area queries test 64 tiles
+ * per word instead of loading a MapTile each. set_tile keeps them in sync.
+ */
+enum Tile_Plane
+{
+    TILE_PLANE_BLOCKING,
+    TILE_PLANE_OPAQUE,
+    TILE_PLANE_COUNT
+};
+
+static_assert(CHUNK_DIM == 64, "Bitplane rows are one u64");
+
+struct Chunk_Tiles
+{
+    MapTile tiles[CHUNK_DIM][CHUNK_DIM];
+    u64 planes[TILE_PLANE_COUNT][CHUNK_DIM];
+
+    // Blocking plane transposed, bit n of column c is row n, for word-wide vertical scans
+    u64 blocking_columns[CHUNK_DIM];
+
+    // Tiles the player has ever seen, pages with the tiles
+    u64 explored[CHUNK_DIM];
+};
+
+static inline bool get_tile_plane_bit(MapTile tile, Tile_Plane plane)
+{
+    switch (plane)
+    {
+        case TILE_PLANE_BLOCKING: return tile.is_blocking;
+        case TILE_PLANE_OPAQUE: return tile.is_opaque;
+        case TILE_PLANE_COUNT: break;
+    }
+    return false;
+}
+
+enum Chunk_Residency
+{
+    CHUNK_RESIDENT,
+    CHUNK_LOADING,
+    CHUNK_PAGED_OUT,
+};
+
+struct Chunk
+{
+    v2i coord;
+
+    // Null unless resident, the chunk header itself always stays in memory
+    Chunk_Tiles *data;
+    Chunk_Residency residency;
+    bool is_dirty; // changed since it was last written to the swap file
+    i32 swap_slot; // -1 until first written
+    u64 last_used;
+
+    // Bumped whenever what the opaque plane reads as changes, FOV uses it to know when to recompute
+    u32 opaque_version;
+
+    // Bumped when a tile's blocking bit changes, edge_versions (left, right, top, bottom) only when
+    // the tile is on that edge. Paging leaves them alone, the tiles that come back are the ones that went out.
+    u32 blocking_version;
+    u32 edge_versions[4];
+
+    // Tiles the player sees right now
+    u64 visible[CHUNK_DIM];
+
+    // Render cache, only touched on the main thread
+    bool section_dirty[CHUNK_SECTIONS][CHUNK_SECTIONS];
+    GLTiles::Mesh section_meshes[CHUNK_SECTIONS][CHUNK_SECTIONS];
+    f32 built_glyph_dim;
+};
+
+static inline int tile_to_chunk(int tile)
+{
+    return tile >> CHUNK_SHIFT;
+}
+
+static inline int tile_to_local(int tile)
+{
+    return tile & CHUNK_MASK;
+}
+
+// In place, bit c of word r ends up as bit r of word c
+static void bits_transpose_64(u64 words[64])
+{
+    u64 mask = 0x00000000FFFFFFFFull;
+    for (int j = 32; j != 0; j >>= 1, mask ^= mask << j)
+    {
+        for (int k = 0; k < 64; k = ((k | j) + 1) & ~j)
+        {
+            u64 t = ((words[k] >> j) ^ words[k | j]) & mask;
+            words[k] ^= t << j;
+            words[k | j] ^= t;
+        }
+    }
+}
+
+static Chunk_Tiles *chunk_tiles_make_void()
+{
+    Chunk_Tiles *data = (Chunk_Tiles *)malloc(sizeof(Chunk_Tiles));
+    MapTile void_tile = get_void_tile();
+    for (int row = 0; row < CHUNK_DIM; row++)
+    {
+        for (int col = 0; col < CHUNK_DIM; col++)
+        {
+            data->tiles[row][col] = void_tile;
+        }
+    }
+    // Void is blocking and opaque
+    memset(data->planes, 0xFF, sizeof(data->planes));
+    memset(data->blocking_columns, 0xFF, sizeof(data->blocking_columns));
+    memset(data->explored, 0, sizeof(data->explored));
+    return data;
+}
+
+static Chunk *chunk_make(v2i coord)
+{
+    Chunk *chunk = (Chunk *)calloc(1, sizeof(Chunk));
+    chunk->coord = coord;
+    chunk->data = chunk_tiles_make_void();
+    chunk->residency = CHUNK_RESIDENT;
+    chunk->is_dirty = true;
+    chunk->swap_slot = -1;
+    chunk->opaque_version = 1;
+    chunk->blocking_version = 1;
+    for (int edge = 0; edge < 4; edge++) chunk->edge_versions[edge] = 1;
+    memset(chunk->section_dirty, 1, sizeof(chunk->section_dirty));
+    return chunk;
+}
+
+static void chunk_free_meshes(Chunk *chunk)
+{
+    for (int row = 0; row < CHUNK_SECTIONS; row++)
+    {
+        for (int col = 0; col < CHUNK_SECTIONS; col++)
+        {
+            if (chunk->section_meshes[row][col].vao) GLTiles::mesh_free(&chunk->section_meshes[row][col]);
+            chunk->section_meshes[row][col] = {};
+            chunk->section_dirty[row][col] = true;
+        }
+    }
+}
+
+static void chunk_free(Chunk *chunk)
+{
+    chunk_free_meshes(chunk);
+    free(chunk->data);
+    free(chunk);
+}
+
+// Chunk coordinate to T, linear probing with backward shift deletion, so there are no tombstones to clean up
+template <typename T>
+struct Coord_Map
+{
+    struct Slot
+    {
+        i32 x, y;
+        T *value;
+    };
+
+    Slot *slots;
+    u32 capacity;
+    u32 count;
+
+    static u32 hash(i32 x, i32 y)
+    {
+        u32 h = (u32)x * 0x9E3779B1u ^ (u32)y * 0x85EBCA77u;
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 13;
+        return h;
+    }
+
+    T *find(i32 x, i32 y)
+    {
+        if (count == 0) return nullptr;
+        u32 mask = capacity - 1;
+        for (u32 i = hash(x, y) & mask; slots[i].value; i = (i + 1) & mask)
+        {
+            if (slots[i].x == x && slots[i].y == y) return slots[i].value;
+        }
+        return nullptr;
+    }
+
+    void grow()
+    {
+        Slot *old_slots = slots;
+        u32 old_capacity = capacity;
+
+        capacity = capacity ? capacity * 2 : 64;
+        slots = (Slot *)calloc(capacity, sizeof(Slot));
+        count = 0;
+        for (u32 i = 0; i < old_capacity; i++)
+        {
+            if (old_slots[i].value) insert(old_slots[i].x, old_slots[i].y, old_slots[i].value);
+        }
+        free(old_slots);
+    }
+
+    // Expects the coordinate not to be in the map yet
+    void insert(i32 x, i32 y, T *value)
+    {
+        // Keep the load under 70%, probe runs stay short
+        if ((count + 1) * 10 > capacity * 7) grow();
+
+        u32 mask = capacity - 1;
+        u32 i = hash(x, y) & mask;
+        while (slots[i].value) i = (i + 1) & mask;
+        slots[i] = Slot{x, y, value};
+        count++;
+    }
+
+    T *remove(i32 x, i32 y)
+    {
+        if (count == 0) return nullptr;
+        u32 mask = capacity - 1;
+        u32 i = hash(x, y) & mask;
+        while (slots[i].value && !(slots[i].x == x && slots[i].y == y)) i = (i + 1) & mask;
+        T *removed = slots[i].value;
+        if (!removed) return nullptr;
+
+        // Shift later members of the probe run back into the hole
+        u32 hole = i;
+        for (u32 j = (i + 1) & mask; slots[j].value; j = (j + 1) & mask)
+        {
+            u32 home = hash(slots[j].x, slots[j].y) & mask;
+            bool home_in_range = hole <= j ? (home > hole && home <= j) : (home > hole || home <= j);
+            if (!home_in_range)
+            {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole] = Slot{};
+        count--;
+        return removed;
+    }
+
+    void free_all(void (*free_value)(T *))
+    {
+        for (u32 i = 0; i < capacity; i++)
+        {
+            if (slots[i].value) free_value(slots[i].value);
+        }
+        free(slots);
+        slots = nullptr;
+        capacity = 0;
+        count = 0;
+    }
+};
+
+typedef Coord_Map<Chunk> Chunk_Map;
+
+/*
+ * Pages chunk tiles out to a swap file and back in on a single I/O thread, so
+ * reads and writes of a slot happen in the order they were queued.
+ *
+ * Chunks within a radius of the player and camera are read ahead every frame.
+ * When more than budget_bytes of tiles are resident the least recently used
+ * chunks are evicted: dirty ones are handed to the I/O thread to write, clean
+ * ones are just dropped. Chunk state is only changed on the main thread, the
+ * I/O thread only sees the tile blocks.
+ */
+#define CHUNK_SWAP_PATH "cache/world.swap"
+#define CHUNK_PAGE_BUDGET_DEFAULT (64ull * 1024 * 1024)
+#define CHUNK_READ_AHEAD 2
+#define CHUNK_RESIDENT_MIN 32
+
+struct Chunk_Pager;
+
+struct Chunk_Page_Job
+{
+    Chunk_Pager *pager;
+    Chunk *chunk;
+    Chunk_Tiles *data;
+    i32 slot;
+};
+
+struct Chunk_Pager
+{
+    Job_Pool *io;
+    int fd = -1;
+    i32 next_slot = 0;
+    size_t budget_bytes = CHUNK_PAGE_BUDGET_DEFAULT;
+
+    std::vector<Chunk *> resident;
+    int loads_in_flight = 0;
+
+    std::mutex loaded_mutex;
+    std::vector<Chunk_Page_Job *> loaded;
+
+    int load_count = 0;
+    int evict_count = 0;
+    int write_count = 0;
+
+    bool init(Job_Pool *io, const char *swap_path)
+    {
+        this->io = io;
+        mkdir("cache", 0755);
+        fd = open(swap_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            warning("Can't open chunk swap file %s: %s, paging disabled", swap_path, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    bool is_enabled()
+    {
+        return fd >= 0;
+    }
+
+    int get_budget_chunks()
+    {
+        int chunks = (int)(budget_bytes / sizeof(Chunk_Tiles));
+        return chunks > CHUNK_RESIDENT_MIN ? chunks : CHUNK_RESIDENT_MIN;
+    }
+
+    void add_resident(Chunk *chunk)
+    {
+        resident.push_back(chunk);
+    }
+
+    // Non blocking, the tiles show up in a later update()
+    void request_load(Chunk *chunk)
+    {
+        if (chunk->residency != CHUNK_PAGED_OUT) return;
+        chunk->residency = CHUNK_LOADING;
+        loads_in_flight++;
+
+        Chunk_Page_Job *job = (Chunk_Page_Job *)malloc(sizeof(Chunk_Page_Job));
+        *job = Chunk_Page_Job{this, chunk, nullptr, chunk->swap_slot};
+        io->push(read_job, job);
+    }
+
+    // Blocking, for code that has to write to a chunk right now
+    void page_in_now(Chunk *chunk)
+    {
+        if (chunk->residency == CHUNK_PAGED_OUT) request_load(chunk);
+        io->wait_idle();
+        update();
+    }
+
+    void evict(Chunk *chunk)
+    {
+        chunk_free_meshes(chunk);
+        if (chunk->is_dirty)
+        {
+            if (chunk->swap_slot < 0) chunk->swap_slot = next_slot++;
+            Chunk_Page_Job *job = (Chunk_Page_Job *)malloc(sizeof(Chunk_Page_Job));
+            *job = Chunk_Page_Job{this, chunk, chunk->data, chunk->swap_slot};
+            io->push(write_job, job);
+            chunk->is_dirty = false;
+            write_count++;
+        }
+        else
+        {
+            free(chunk->data);
+        }
+        chunk->data = nullptr;
+        chunk->residency = CHUNK_PAGED_OUT;
+        chunk->opaque_version++;
+        evict_count++;
+    }
+
+    // Evicts least recently used chunks until under budget, never the one passed in
+    void enforce_budget(Chunk *keep)
+    {
+        if (!is_enabled()) return;
+        int budget = get_budget_chunks();
+        while ((int)resident.size() > budget)
+        {
+            int oldest = -1;
+            for (int i = 0; i < (int)resident.size(); i++)
+            {
+                if (resident[i] == keep) continue;
+                if (oldest < 0 || resident[i]->last_used < resident[oldest]->last_used) oldest = i;
+            }
+            if (oldest < 0) return;
+
+            Chunk *victim = resident[oldest];
+            resident[oldest] = resident.back();
+            resident.pop_back();
+            evict(victim);
+        }
+    }
+
+    // Main thread, once per frame: takes in finished loads
+    void update()
+    {
+        std::vector<Chunk_Page_Job *> done;
+        {
+            std::lock_guard<std::mutex> lock(loaded_mutex);
+            done.swap(loaded);
+        }
+
+        for (Chunk_Page_Job *job : done)
+        {
+            Chunk *chunk = job->chunk;
+            chunk->data = job->data;
+            chunk->residency = CHUNK_RESIDENT;
+            chunk->opaque_version++;
+            memset(chunk->section_dirty, 1, sizeof(chunk->section_dirty));
+            add_resident(chunk);
+            loads_in_flight--;
+            load_count++;
+            free(job);
+        }
+    }
+
+    // Drops everything in flight and empties the swap file, chunks are about to be freed
+    void reset()
+    {
+        if (!is_enabled()) return;
+        io->wait_idle();
+        update();
+        resident.clear();
+        next_slot = 0;
+        if (ftruncate(fd, 0) != 0) warning("Can't truncate chunk swap file: %s", strerror(errno));
+    }
+
+    void shutdown()
+    {
+        if (!is_enabled()) return;
+        reset();
+        close(fd);
+        fd = -1;
+    }
+
+    static off_t get_slot_offset(i32 slot)
+    {
+        return (off_t)slot * (off_t)sizeof(Chunk_Tiles);
+    }
+
+    static void read_job(void *data)
+    {
+        Chunk_Page_Job *job = (Chunk_Page_Job *)data;
+        job->data = (Chunk_Tiles *)malloc(sizeof(Chunk_Tiles));
+        ssize_t n = pread(job->pager->fd, job->data, sizeof(Chunk_Tiles), get_slot_offset(job->slot));
+        if (n != (ssize_t)sizeof(Chunk_Tiles))
+        {
+            // Losing a chunk beats stalling the game, it comes back as rock
+            warning("Can't read chunk %d, %d from swap slot %d", job->chunk->coord.x, job->chunk->coord.y, job->slot);
+            free(job->data);
+            job->data = chunk_tiles_make_void();
+        }
+
+        std::lock_guard<std::mutex> lock(job->pager->loaded_mutex);
+        job->pager->loaded.push_back(job);
+    }
+
+    static void write_job(void *data)
+    {
+        Chunk_Page_Job *job = (Chunk_Page_Job *)data;
+        ssize_t n = pwrite(job->pager->fd, job->data, sizeof(Chunk_Tiles), get_slot_offset(job->slot));
+        if (n != (ssize_t)sizeof(Chunk_Tiles))
+        {
+            warning("Can't write swap slot %d: %s", job->slot, strerror(errno));
+        }
+        free(job->data);
+        free(job);
+    }
+};
+
+struct Level
+{
+    Chunk_Map chunks;
+
+    // Optional, without it every chunk stays resident
+    Chunk_Pager *pager;
+
+    // One entry chunk cache: neighboring lookups almost always hit the same chunk
+    Chunk *cached_chunk;
+    u64 use_tick;
+
+    // Chunks with visible bits set, so the next FOV can clear them
+    std::vector<Chunk *> visible_chunks;
+
+    // Bounding box of every tile set so far, max is exclusive
+    bool has_tiles;
+    v2i tile_min;
+    v2i tile_max;
+
+    Chunk *find_chunk(int chunk_x, int chunk_y)
+    {
+        if (cached_chunk && cached_chunk->coord.x == chunk_x && cached_chunk->coord.y == chunk_y)
+        {
+            return cached_chunk;
+        }
+        Chunk *chunk = chunks.find(chunk_x, chunk_y);
+        if (chunk)
+        {
+            cached_chunk = chunk;
+            chunk->last_used = ++use_tick;
+        }
+        return chunk;
+    }
+
+    // May block on the pager, for writers only
+    Chunk *get_resident_chunk(int chunk_x, int chunk_y)
+    {
+        Chunk *chunk = find_chunk(chunk_x, chunk_y);
+        if (!chunk)
+        {
+            chunk = chunk_make((v2i){{{chunk_x, chunk_y}}});
+            chunks.insert(chunk_x, chunk_y, chunk);
+            cached_chunk = chunk;
+            chunk->last_used = ++use_tick;
+            if (pager)
+            {
+                pager->add_resident(chunk);
+                pager->enforce_budget(chunk);
+            }
+        }
+        else if (!chunk->data)
+        {
+            pager->page_in_now(chunk);
+            pager->enforce_budget(chunk);
+        }
+        return chunk;
+    }
+
+    void set_tile(int col, int row, MapTile tile)
+    {
+        Chunk *chunk = get_resident_chunk(tile_to_chunk(col), tile_to_chunk(row));
+        int local_col = tile_to_local(col);
+        int local_row = tile_to_local(row);
+        chunk->data->tiles[local_row][local_col] = tile;
+        for (int plane = 0; plane < TILE_PLANE_COUNT; plane++)
+        {
+            u64 bit = 1ull << local_col;
+            u64 *word = &chunk->data->planes[plane][local_row];
+            u64 old_word = *word;
+            *word = get_tile_plane_bit(tile, (Tile_Plane)plane) ? (*word | bit) : (*word & ~bit);
+            if (plane == TILE_PLANE_OPAQUE && *word != old_word) chunk->opaque_version++;
+        }
+        u64 row_bit = 1ull << local_row;
+        u64 *column = &chunk->data->blocking_columns[local_col];
+        u64 old_column = *column;
+        *column = tile.is_blocking ? (*column | row_bit) : (*column & ~row_bit);
+        if (*column != old_column)
+        {
+            chunk->blocking_version++;
+            if (local_col == 0) chunk->edge_versions[0]++;
+            if (local_col == CHUNK_MASK) chunk->edge_versions[1]++;
+            if (local_row == 0) chunk->edge_versions[2]++;
+            if (local_row == CHUNK_MASK) chunk->edge_versions[3]++;
+        }
+        chunk->is_dirty = true;
+        chunk->section_dirty[local_row / CHUNK_SECTION_DIM][local_col / CHUNK_SECTION_DIM] = true;
+
+        if (!has_tiles)
+        {
+            has_tiles = true;
+            tile_min = (v2i){{{col, row}}};
+            tile_max = (v2i){{{col + 1, row + 1}}};
+        }
+        if (col < tile_min.x) tile_min.x = col;
+        if (row < tile_min.y) tile_min.y = row;
+        if (col >= tile_max.x) tile_max.x = col + 1;
+        if (row >= tile_max.y) tile_max.y = row + 1;
+    }
+
+    // A whole chunk at once: bit n of rows[r] picks set_tile over clear_tile for local (n, r).
+    // Generators use it instead of 4096 set_tile calls.
+    void fill_chunk(int chunk_x, int chunk_y, const u64 rows[CHUNK_DIM], MapTile set_tile, MapTile clear_tile)
+    {
+        Chunk *chunk = get_resident_chunk(chunk_x, chunk_y);
+        Chunk_Tiles *data = chunk->data;
+        for (int row = 0; row < CHUNK_DIM; row++)
+        {
+            u64 bits = rows[row];
+            for (int col = 0; col < CHUNK_DIM; col++)
+            {
+                data->tiles[row][col] = (bits >> col) & 1 ? set_tile : clear_tile;
+            }
+        }
+        for (int plane = 0; plane < TILE_PLANE_COUNT; plane++)
+        {
+            u64 set_mask = get_tile_plane_bit(set_tile, (Tile_Plane)plane) ? ~0ull : 0;
+            u64 clear_mask = get_tile_plane_bit(clear_tile, (Tile_Plane)plane) ? ~0ull : 0;
+            for (int row = 0; row < CHUNK_DIM; row++)
+            {
+                data->planes[plane][row] = (rows[row] & set_mask) | (~rows[row] & clear_mask);
+            }
+        }
+        memcpy(data->blocking_columns, data->planes[TILE_PLANE_BLOCKING], sizeof(data->blocking_columns));
+        bits_transpose_64(data->blocking_columns);
+        mark_chunk_replaced(chunk);
+    }
+
+    // Swaps in tiles built off the main thread, planes and blocking_columns included. Takes ownership of data.
+    void put_chunk_tiles(int chunk_x, int chunk_y, Chunk_Tiles *data)
+    {
+        Chunk *chunk = get_resident_chunk(chunk_x, chunk_y);
+        free(chunk->data);
+        chunk->data = data;
+        mark_chunk_replaced(chunk);
+    }
+
+    // Every tile of the chunk may have changed
+    void mark_chunk_replaced(Chunk *chunk)
+    {
+        int chunk_x = chunk->coord.x;
+        int chunk_y = chunk->coord.y;
+        chunk->opaque_version++;
+        chunk->blocking_version++;
+        for (int edge = 0; edge < 4; edge++) chunk->edge_versions[edge]++;
+        chunk->is_dirty = true;
+        memset(chunk->section_dirty, 1, sizeof(chunk->section_dirty));
+
+        v2i min = {{{chunk_x << CHUNK_SHIFT, chunk_y << CHUNK_SHIFT}}};
+        v2i max = {{{min.x + CHUNK_DIM, min.y + CHUNK_DIM}}};
+        if (!has_tiles)
+        {
+            has_tiles = true;
+            tile_min = min;
+            tile_max = max;
+        }
+        if (min.x < tile_min.x) tile_min.x = min.x;
+        if (min.y < tile_min.y) tile_min.y = min.y;
+        if (max.x > tile_max.x) tile_max.x = max.x;
+        if (max.y > tile_max.y) tile_max.y = max.y;
+    }
+
+    // Never blocks: tiles of a paged out chunk read as loading until the pager brings it back
+    MapTile get_tile(int col, int row)
+    {
+        Chunk *chunk = find_chunk(tile_to_chunk(col), tile_to_chunk(row));
+        if (!chunk) return get_void_tile();
+        if (!chunk->data)
+        {
+            pager->request_load(chunk);
+            return get_loading_tile();
+        }
+        return chunk->data->tiles[tile_to_local(row)][tile_to_local(col)];
+    }
+
+    MapTile get_tile(v2i p)
+    {
+        return get_tile(p.x, p.y);
+    }
+
+    // Player FOV results, see fov_apply_to_level
+    bool is_tile_visible(int col, int row)
+    {
+        Chunk *chunk = find_chunk(tile_to_chunk(col), tile_to_chunk(row));
+        return chunk && ((chunk->visible[tile_to_local(row)] >> tile_to_local(col)) & 1);
+    }
+
+    bool is_tile_explored(int col, int row)
+    {
+        Chunk *chunk = find_chunk(tile_to_chunk(col), tile_to_chunk(row));
+        return chunk && chunk->data && ((chunk->data->explored[tile_to_local(row)] >> tile_to_local(col)) & 1);
+    }
+
+    // Same rules as get_tile: missing and paged out chunks read as all set
+    const u64 *get_plane_rows(Tile_Plane plane, int chunk_x, int chunk_y)
+    {
+        static const u64 all_set[CHUNK_DIM] = {
+            ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull,
+            ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull,
+            ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull,
+            ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull, ~0ull,
+        };
+        Chunk *chunk = find_chunk(chunk_x, chunk_y);
+        if (!chunk) return all_set;
+        if (!chunk->data)
+        {
+            pager->request_load(chunk);
+            return all_set;
+        }
+        return chunk->data->planes[plane];
+    }
+
+    bool get_tile_bit(Tile_Plane plane, int col, int row)
+    {
+        const u64 *rows = get_plane_rows(plane, tile_to_chunk(col), tile_to_chunk(row));
+        return (rows[tile_to_local(row)] >> tile_to_local(col)) & 1;
+    }
+
+    // 64 tiles of one row starting at col, bit n is col + n
+    u64 get_row_bits(Tile_Plane plane, int col, int row)
+    {
+        int chunk_y = tile_to_chunk(row);
+        int local_row = tile_to_local(row);
+        int local_col = tile_to_local(col);
+        u64 lo = get_plane_rows(plane, tile_to_chunk(col), chunk_y)[local_row];
+        if (local_col == 0) return lo;
+        u64 hi = get_plane_rows(plane, tile_to_chunk(col) + 1, chunk_y)[local_row];
+        return (lo >> local_col) | (hi << (CHUNK_DIM - local_col));
+    }
+
+    // Counts set bits in [min, max), a word at a time
+    int count_in_area(Tile_Plane plane, v2i min, v2i max)
+    {
+        int count = 0;
+        for (int row = min.y; row < max.y; row++)
+        {
+            for (int col = min.x; col < max.x; col += 64)
+            {
+                int width = max.x - col;
+                u64 mask = width >= 64 ? ~0ull : (1ull << width) - 1;
+                count += __builtin_popcountll(get_row_bits(plane, col, row) & mask);
+            }
+        }
+        return count;
+    }
+
+    bool is_area_clear(Tile_Plane plane, v2i min, v2i max)
+    {
+        for (int row = min.y; row < max.y; row++)
+        {
+            for (int col = min.x; col < max.x; col += 64)
+            {
+                int width = max.x - col;
+                u64 mask = width >= 64 ? ~0ull : (1ull << width) - 1;
+                if (get_row_bits(plane, col, row) & mask) return false;
+            }
+        }
+        return true;
+    }
+
+    // Bresenham over the opaque plane, the end tiles themselves don't block
+    bool has_line_of_sight(v2i from, v2i to)
+    {
+        int dx = abs(to.x - from.x);
+        int dy = -abs(to.y - from.y);
+        int step_x = from.x < to.x ? 1 : -1;
+        int step_y = from.y < to.y ? 1 : -1;
+        int err = dx + dy;
+        int x = from.x;
+        int y = from.y;
+        if (x == to.x && y == to.y) return true;
+        for (;;)
+        {
+            int e2 = 2 * err;
+            if (e2 >= dy) { err += dy; x += step_x; }
+            if (e2 <= dx) { err += dx; y += step_y; }
+            if (x == to.x && y == to.y) return true;
+            if (get_tile_bit(TILE_PLANE_OPAQUE, x, y)) return false;
+        }
+    }
+
+    // Main thread, once per frame: takes in loads, reads ahead around the focus tiles, trims to budget
+    void update_paging(const v2i *focus_tiles, int focus_count)
+    {
+        if (!pager) return;
+        pager->update();
+        for (int i = 0; i < focus_count; i++)
+        {
+            int focus_x = tile_to_chunk(focus_tiles[i].x);
+            int focus_y = tile_to_chunk(focus_tiles[i].y);
+            for (int chunk_y = focus_y - CHUNK_READ_AHEAD; chunk_y <= focus_y + CHUNK_READ_AHEAD; chunk_y++)
+            {
+                for (int chunk_x = focus_x - CHUNK_READ_AHEAD; chunk_x <= focus_x + CHUNK_READ_AHEAD; chunk_x++)
+                {
+                    Chunk *chunk = chunks.find(chunk_x, chunk_y);
+                    if (!chunk) continue;
+                    chunk->last_used = ++use_tick;
+                    pager->request_load(chunk);
+                }
+            }
+        }
+        pager->enforce_budget(nullptr);
+    }
+
+    v2i get_tile_size()
+    {
+        return (v2i){{{tile_max.x - tile_min.x, tile_max.y - tile_min.y}}};
+    }
+
+    u64 get_tile_count()
+    {
+        return (u64)chunks.count * CHUNK_DIM * CHUNK_DIM;
+    }
+
+    v2i px_pos_to_tile_pos(v2 px_pos)
+    {
+        v2i tile_pos = {{{
+            (int)floorf(px_pos.x / get_glyph_dim()),
+            (int)floorf(px_pos.y / get_glyph_dim())
+        }}};
+        return tile_pos;
+    }
+
+    v2i world_pos_to_tile_pos(v2 world_pos)
+    {
+        v2i tile_pos = {{{
+            (int)floorf(world_pos.x),
+            (int)floorf(world_pos.y)
+        }}};
+        return tile_pos;
+    }
+
+    bool can_move_over_tile(v2i tile_p)
+    {
+        return !get_tile_bit(TILE_PLANE_BLOCKING, tile_p.x, tile_p.y);
+    }
+
+    bool can_move_over_tile(v2 world_pos)
+    {
+        v2i tile_p = world_pos_to_tile_pos(world_pos);
+        return can_move_over_tile(tile_p);
+    }
+
+    void clear()
+    {
+        if (pager) pager->reset();
+        chunks.free_all(chunk_free);
+        cached_chunk = nullptr;
+        visible_chunks.clear();
+        has_tiles = false;
+        tile_min = {};
+        tile_max = {};
+    }
+};
+
+void generate_level(Level *level)
+{
+    const int cols = 32;
+    const int rows = 32;
+    level->clear();
+    for (int row = 0; row < rows; row++)
+    {
+        for (int col = 0; col < cols; col++)
+        {
+            if (row == 0 || row == rows - 1 || col == 0 || col == cols - 1)
+            {
+                level->set_tile(col, row, (MapTile){MAP_TILE_WALL, true, true});
+            }
+            else
+            {
+                level->set_tile(col, row, (MapTile){MAP_TILE_GROUND, false, false});
+            }
+        }
+    }
+}
+
+// Stress world: a walled field with scattered pillars, for checking that cost follows the view, not the map
+void generate_big_level(Level *level, int cols, int rows)
+{
+    level->clear();
+    for (int row = 0; row < rows; row++)
+    {
+        for (int col = 0; col < cols; col++)
+        {
+            bool is_border = row == 0 || row == rows - 1 || col == 0 || col == cols - 1;
+            bool is_spawn = row < 16 && col < 16;
+            bool is_pillar = !is_spawn && (Chunk_Map::hash(col, row) & 63) == 0;
+            bool is_wall = is_border || is_pillar;
+            if (is_wall)
+            {
+                level->set_tile(col, row, (MapTile){MAP_TILE_WALL, true, true});
+            }
+            else
+            {
+                level->set_tile(col, row, (MapTile){MAP_TILE_GROUND, false, false});
+            }
+        }
+    }
+}
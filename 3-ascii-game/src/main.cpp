@@ -9,6 +9,8 @@
 #include "util.hpp"
 
 #include "gl_tiles.cpp"
+#include "job_pool.cpp"
+#include "texture_loader.cpp"
 #include "game.cpp"
 
 void on_mouse_button(GLFWwindow* window, int button, int action, int mods)
@@ -73,13 +75,26 @@ int main()
 
     bool show_demo_window = true;
 
-    GLTiles::Vert_Buf *vb = GLTiles::vb_make();
-    game_init(vb);
-
     GLuint tiles_shader = GLTiles::gl_create_tiles_shader();
+    GLuint tiles_instanced_shader = GLTiles::gl_create_tiles_instanced_shader();
+
+    Job_Pool jobs;
+    jobs.start(0);
+
+    // One thread, chunk reads and writes must stay in queue order
+    Job_Pool io_jobs;
+    io_jobs.start(1);
+
+    Chunk_Pager pager;
+    pager.init(&io_jobs, CHUNK_SWAP_PATH);
 
-    GLTiles::Texture tex = GLTiles::gl_load_texture("res/tileset.png", GL_NEAREST, true);
-    trace("tex: %d; ch: %d", tex.texture_id, tex.ch);
+    GLTiles::Vert_Buf *vb = GLTiles::vb_make(GLTiles::VERT_LAYOUT_PACKED);
+    GLTiles::Inst_Buf *ib = GLTiles::ib_make(tiles_instanced_shader);
+    game_init(vb, ib, tiles_shader, &pager, &jobs);
+
+    GLTiles::Texture_Loader textures;
+    textures.init(&jobs);
+    int tileset = textures.request("res/tileset.png", GL_NEAREST, true);
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -108,17 +123,28 @@ int main()
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
+        GLTiles::gl_state_begin_frame();
+        textures.pump(4);
+
         glClearColor(0.86f, 0.18f, 0.26f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(tiles_shader);
-        glBindTexture(GL_TEXTURE_2D, tex.texture_id);
+        GLTiles::gl_bind_texture(0, textures.get(tileset)->texture_id);
         m4 proj = m4_proj_ortho(0, w, h, 0, -1, 1);
-        glUniformMatrix4fv(glGetUniformLocation(tiles_shader, "uMvp"), 1, GL_FALSE, proj.d);
+
+        // Full instance batches are drawn while the level is still being added, so set these up front
+        GLTiles::gl_use_program(tiles_instanced_shader);
+        glUniformMatrix4fv(GLTiles::gl_uniform_location(tiles_instanced_shader, "uMvp"), 1, GL_FALSE, proj.d);
+        glUniform1f(GLTiles::gl_uniform_location(tiles_instanced_shader, "uTileDim"), get_glyph_dim());
+
+        GLTiles::gl_use_program(tiles_shader);
+        glUniformMatrix4fv(GLTiles::gl_uniform_location(tiles_shader, "uMvp"), 1, GL_FALSE, proj.d);
 
         GLTiles::vb_clear(vb);
+        GLTiles::ib_clear(ib);
 
         GameState *gs = get_game_state();
+        gs->view_size = (v2){{{(f32)w, (f32)h}}};
         gs->player_move_input = (v2){};
 
         if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
@@ -146,24 +172,39 @@ int main()
 
         process_input(delta);
 
-        int vert_count = gs->vb->vert_count;
         draw_level();
-        int level_verts = gs->vb->vert_count - vert_count;
+        draw_fog();
+        draw_player_path();
 
-        vert_count = gs->vb->vert_count;
+        int vert_count = gs->vb->frame_vert_count;
         draw_player();
-        int player_verts = gs->vb->vert_count - vert_count;
-        vert_count = gs->vb->vert_count;
+        int player_verts = gs->vb->frame_vert_count - vert_count;
+        vert_count = gs->vb->frame_vert_count;
 
         GLTiles::vb_draw_call(vb);
+        GLTiles::ib_draw_call(ib);
 
         if (show_demo_window)
             ImGui::ShowDemoWindow(&show_demo_window);
 
         ImGui::Begin("Render Debug");
-        ImGui::BulletText("Level verts: %d", level_verts);
-        ImGui::BulletText("Player verts: %d", player_verts);
-        ImGui::BulletText("Total verts: %d", vert_count);
+        ImGui::Checkbox("Instanced tiles", &gs->use_instancing);
+        ImGui::BulletText("Textures: %d cache hits, %d decoded", textures.cache_hits.load(), textures.cache_misses.load());
+        ImGui::BulletText("GL binds: %d, skipped: %d", GLTiles::g_gl_state.binds_last_frame, GLTiles::g_gl_state.skipped_last_frame);
+        ImGui::BulletText("Stream stalls: %d", vb->vert_stream.stall_count + ib->stream.stall_count);
+        if (gs->use_instancing)
+        {
+            ImGui::BulletText("Tile instances: %d (%zu bytes)", ib->frame_inst_count, ib->frame_inst_count * sizeof(GLTiles::Tile_Instance));
+            ImGui::BulletText("Batches: %d", ib->frame_batch_count);
+        }
+        else
+        {
+            ImGui::BulletText("Level chunks: %d visible of %u", gs->level_stats.chunks_visible, gs->level.chunks.count);
+            ImGui::BulletText("Level sections: %d drawn, %d rebuilt", gs->level_stats.sections_drawn, gs->level_stats.sections_rebuilt);
+            ImGui::BulletText("Player verts: %d", player_verts);
+            ImGui::BulletText("Total verts: %d (%zu bytes)", vert_count, vert_count * vb->vert_stride);
+            ImGui::BulletText("Batches: %d", vb->frame_batch_count);
+        }
         ImGui::End();
 
         window_game_debug();
@@ -174,6 +215,10 @@ int main()
         glfwSwapBuffers(window);
     }
 
+    pager.shutdown();
+    io_jobs.stop();
+    jobs.stop();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstring>
+
+#include "types.hpp"
+
+/*
+ * 2D gradient noise (Perlin's, with hashed gradients instead of a permutation
+ * table) and fractal sums of it, 8 samples at a time.
+ *
+ * The lanes are the compiler's vector types, so the same code is AVX2 on x86
+ * with -mavx2, two SSE2 or NEON halves otherwise, and whatever scalar code the
+ * compiler falls back to on anything else. Vectors only go through pointers,
+ * passed by value they'd depend on the target's vector ABI.
+ *
+ * Lattice hashes are pure integer math on the cell and seed, so a sample only
+ * depends on its position and seed: chunks can be generated in any order on
+ * any thread and come out the same.
+ */
+
+#define NOISE_LANES 8
+
+typedef f32 Noise_F32s __attribute__((vector_size(NOISE_LANES * sizeof(f32))));
+typedef i32 Noise_I32s __attribute__((vector_size(NOISE_LANES * sizeof(i32))));
+typedef u32 Noise_U32s __attribute__((vector_size(NOISE_LANES * sizeof(u32))));
+
+struct Noise_Fractal
+{
+    u32 seed;
+    int octaves;
+    f32 frequency; // of the first octave, per tile
+    f32 lacunarity; // frequency multiplier per octave
+    f32 gain; // amplitude multiplier per octave
+};
+
+static inline void noise_hash(Noise_U32s *h, const Noise_I32s *x, const Noise_I32s *y, u32 seed)
+{
+    Noise_U32s v = ((Noise_U32s)*x * 0x8DA6B343u) ^ ((Noise_U32s)*y * 0xD8163841u) ^ seed;
+    v ^= v >> 16;
+    v *= 0x7FEB352Du;
+    v ^= v >> 15;
+    v *= 0x846CA68Bu;
+    v ^= v >> 16;
+    *h = v;
+}
+
+// One of 8 gradients, (+-1, +-0.5) or (+-0.5, +-1), dotted with the offset from the corner
+static inline void noise_gradient_dot(Noise_F32s *out, const Noise_U32s *h, const Noise_F32s *dx, const Noise_F32s *dy)
+{
+    Noise_F32s x = (Noise_F32s)((Noise_U32s)*dx ^ (*h << 31));
+    Noise_F32s y = (Noise_F32s)((Noise_U32s)*dy ^ ((*h >> 1) << 31));
+    Noise_F32s swap = __builtin_convertvector((*h >> 2) & 1, Noise_F32s);
+    Noise_F32s weight_x = 0.5f + 0.5f * swap;
+    Noise_F32s weight_y = 1.0f - 0.5f * swap;
+    *out = x * weight_x + y * weight_y;
+}
+
+// Roughly in [-1, 1]
+static void noise_gradient_8(Noise_F32s *out, const Noise_F32s *x, const Noise_F32s *y, u32 seed)
+{
+    // Floor: truncation is one too high for negative non-integers
+    Noise_I32s x0 = __builtin_convertvector(*x, Noise_I32s);
+    Noise_I32s y0 = __builtin_convertvector(*y, Noise_I32s);
+    x0 += (Noise_I32s)(__builtin_convertvector(x0, Noise_F32s) > *x);
+    y0 += (Noise_I32s)(__builtin_convertvector(y0, Noise_F32s) > *y);
+    Noise_I32s x1 = x0 + 1;
+    Noise_I32s y1 = y0 + 1;
+
+    Noise_F32s fx = *x - __builtin_convertvector(x0, Noise_F32s);
+    Noise_F32s fy = *y - __builtin_convertvector(y0, Noise_F32s);
+    Noise_F32s fx1 = fx - 1.0f;
+    Noise_F32s fy1 = fy - 1.0f;
+
+    Noise_U32s h00, h10, h01, h11;
+    noise_hash(&h00, &x0, &y0, seed);
+    noise_hash(&h10, &x1, &y0, seed);
+    noise_hash(&h01, &x0, &y1, seed);
+    noise_hash(&h11, &x1, &y1, seed);
+
+    Noise_F32s g00, g10, g01, g11;
+    noise_gradient_dot(&g00, &h00, &fx, &fy);
+    noise_gradient_dot(&g10, &h10, &fx1, &fy);
+    noise_gradient_dot(&g01, &h01, &fx, &fy1);
+    noise_gradient_dot(&g11, &h11, &fx1, &fy1);
+
+    // Quintic fade, flat at both ends so cell edges don't show
+    Noise_F32s u = fx * fx * fx * (fx * (fx * 6.0f - 15.0f) + 10.0f);
+    Noise_F32s v = fy * fy * fy * (fy * (fy * 6.0f - 15.0f) + 10.0f);
+    Noise_F32s top = g00 + (g10 - g00) * u;
+    Noise_F32s bottom = g01 + (g11 - g01) * u;
+    *out = top + (bottom - top) * v;
+}
+
+// count samples of the fractal sum along a row, starting at (col, row) one tile apart. count is a multiple of NOISE_LANES.
+static void noise_fractal_row(const Noise_Fractal *fractal, int col, int row, int count, f32 *out)
+{
+    f32 amplitude_sum = 0.0f;
+    f32 amplitude = 1.0f;
+    for (int octave = 0; octave < fractal->octaves; octave++)
+    {
+        amplitude_sum += amplitude;
+        amplitude *= fractal->gain;
+    }
+
+    Noise_F32s lane_offsets;
+    for (int lane = 0; lane < NOISE_LANES; lane++) lane_offsets[lane] = (f32)lane;
+
+    for (int i = 0; i < count; i += NOISE_LANES)
+    {
+        Noise_F32s sum = {};
+        f32 frequency = fractal->frequency;
+        amplitude = 1.0f / amplitude_sum;
+        for (int octave = 0; octave < fractal->octaves; octave++)
+        {
+            // Octaves get their own lattice so their features don't line up at the origin
+            u32 seed = fractal->seed + (u32)octave * 0x9E3779B9u;
+            Noise_F32s x = ((f32)(col + i) + lane_offsets) * frequency;
+            Noise_F32s y = {};
+            y += (f32)row * frequency;
+            Noise_F32s n;
+            noise_gradient_8(&n, &x, &y, seed);
+            sum += n * amplitude;
+            frequency *= fractal->lacunarity;
+            amplitude *= fractal->gain;
+        }
+        memcpy(out + i, &sum, sizeof(sum));
+    }
+}
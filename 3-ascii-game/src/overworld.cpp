@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#include "types.hpp"
+
+#include "job_pool.cpp"
+#include "level.cpp"
+#include "noise.cpp"
+#include "rng.cpp"
+
+/*
+ * Endless overworld: elevation and moisture from fractal gradient noise, mapped
+ * to water, beach, grass, forest, hills and mountains.
+ *
+ * Chunks are generated on demand around the view. Each one is a job that builds
+ * a whole Chunk_Tiles block on a worker, then update() swaps finished blocks
+ * into the level on the main thread, so the frame only pays for a pointer swap
+ * per chunk. Until its block arrives a chunk just isn't there and draws as void.
+ *
+ * A tile only depends on its position and the seed, so the same seed gives the
+ * same world whatever order chunks were generated in.
+ */
+
+#define OVERWORLD_VIEW_MARGIN 1 // chunks generated past the edge of the view
+#define OVERWORLD_PENDING_MAX 256
+#define OVERWORLD_SPAWN_RADIUS 2 // chunks around the origin generated up front
+
+struct Overworld_Params
+{
+    Noise_Fractal elevation;
+    Noise_Fractal moisture;
+};
+
+static Overworld_Params overworld_params_make(u64 seed)
+{
+    Rng rng = rng_make(seed);
+    Overworld_Params params;
+    params.elevation = Noise_Fractal{rng_next(&rng), 6, 1.0f / 384.0f, 2.0f, 0.5f};
+    params.moisture = Noise_Fractal{rng_next(&rng), 4, 1.0f / 512.0f, 2.0f, 0.5f};
+    return params;
+}
+
+// Thresholds from the spread of the sums: about 15% deep water, 15% shallows and beach, 60% lowland, 10% high ground
+static MapTile overworld_tile(f32 elevation, f32 moisture)
+{
+    if (elevation < -0.15f) return (MapTile){MAP_TILE_DEEP_WATER, true, false};
+    if (elevation < -0.08f) return (MapTile){MAP_TILE_WATER, false, false};
+    if (elevation < -0.06f) return (MapTile){MAP_TILE_SAND, false, false};
+    if (elevation < 0.15f)
+    {
+        if (moisture < -0.1f) return (MapTile){MAP_TILE_SAND, false, false};
+        if (moisture < 0.1f) return (MapTile){MAP_TILE_GRASS, false, false};
+        return (MapTile){MAP_TILE_FOREST, false, true};
+    }
+    if (elevation < 0.21f) return (MapTile){MAP_TILE_HILLS, false, false};
+    if (elevation < 0.27f) return (MapTile){MAP_TILE_MOUNTAIN, true, true};
+    return (MapTile){MAP_TILE_SNOW, true, true};
+}
+
+// Worker side, touches nothing but its own block
+static Chunk_Tiles *overworld_make_chunk_tiles(const Overworld_Params *params, int chunk_x, int chunk_y)
+{
+    Chunk_Tiles *data = (Chunk_Tiles *)malloc(sizeof(Chunk_Tiles));
+    int col_min = chunk_x << CHUNK_SHIFT;
+    int row_min = chunk_y << CHUNK_SHIFT;
+    f32 elevation[CHUNK_DIM];
+    f32 moisture[CHUNK_DIM];
+    for (int row = 0; row < CHUNK_DIM; row++)
+    {
+        noise_fractal_row(&params->elevation, col_min, row_min + row, CHUNK_DIM, elevation);
+        noise_fractal_row(&params->moisture, col_min, row_min + row, CHUNK_DIM, moisture);
+        u64 blocking = 0;
+        u64 opaque = 0;
+        for (int col = 0; col < CHUNK_DIM; col++)
+        {
+            MapTile tile = overworld_tile(elevation[col], moisture[col]);
+            data->tiles[row][col] = tile;
+            blocking |= (u64)tile.is_blocking << col;
+            opaque |= (u64)tile.is_opaque << col;
+        }
+        data->planes[TILE_PLANE_BLOCKING][row] = blocking;
+        data->planes[TILE_PLANE_OPAQUE][row] = opaque;
+    }
+    memcpy(data->blocking_columns, data->planes[TILE_PLANE_BLOCKING], sizeof(data->blocking_columns));
+    bits_transpose_64(data->blocking_columns);
+    memset(data->explored, 0, sizeof(data->explored));
+    return data;
+}
+
+struct Overworld;
+
+struct Overworld_Job
+{
+    Overworld *overworld;
+    v2i coord;
+    Chunk_Tiles *data;
+};
+
+struct Overworld
+{
+    Level *level;
+    Job_Pool *pool;
+    Overworld_Params params;
+    bool is_active;
+
+    // Queued, running or finished but not in the level yet
+    Coord_Map<Overworld_Job> pending;
+
+    std::mutex done_mutex;
+    std::vector<Overworld_Job *> done;
+
+    int generated_count;
+
+    // Clears the level and generates the chunks around the origin before returning. Returns a walkable tile near the origin.
+    v2i start(Level *level, Job_Pool *pool, u64 seed)
+    {
+        stop();
+        this->level = level;
+        this->pool = pool;
+        params = overworld_params_make(seed);
+        is_active = true;
+        generated_count = 0;
+        level->clear();
+
+        int spawn_dim = (2 * OVERWORLD_SPAWN_RADIUS + 1) * CHUNK_DIM;
+        v2i spawn_min = {{{-OVERWORLD_SPAWN_RADIUS * CHUNK_DIM, -OVERWORLD_SPAWN_RADIUS * CHUNK_DIM}}};
+        v2i spawn_max = {{{spawn_min.x + spawn_dim, spawn_min.y + spawn_dim}}};
+        request_area(spawn_min, spawn_max);
+        pool->wait_idle();
+        take_finished();
+
+        // Walkable tile closest to the origin, in growing squares
+        for (int radius = 0; radius < spawn_dim / 2; radius++)
+        {
+            for (int row = -radius; row <= radius; row++)
+            {
+                for (int col = -radius; col <= radius; col++)
+                {
+                    if (abs(row) != radius && abs(col) != radius) continue;
+                    if (level->can_move_over_tile((v2i){{{col, row}}})) return (v2i){{{col, row}}};
+                }
+            }
+        }
+        return (v2i){};
+    }
+
+    // Waits for jobs in flight and drops everything not in the level yet
+    void stop()
+    {
+        if (!is_active) return;
+        is_active = false;
+        pool->wait_idle();
+        for (Overworld_Job *job : done)
+        {
+            free(job->data);
+            free(job);
+        }
+        done.clear();
+        pending.free_all([](Overworld_Job *job) {});
+    }
+
+    void request_chunk(int chunk_x, int chunk_y)
+    {
+        if ((int)pending.count >= OVERWORLD_PENDING_MAX) return;
+        if (level->chunks.find(chunk_x, chunk_y) || pending.find(chunk_x, chunk_y)) return;
+
+        Overworld_Job *job = (Overworld_Job *)malloc(sizeof(Overworld_Job));
+        *job = Overworld_Job{this, (v2i){{{chunk_x, chunk_y}}}, nullptr};
+        pending.insert(chunk_x, chunk_y, job);
+        pool->push(generate_job, job);
+    }
+
+    // Tiles in [tile_min, tile_max)
+    void request_area(v2i tile_min, v2i tile_max)
+    {
+        for (int chunk_y = tile_to_chunk(tile_min.y); chunk_y <= tile_to_chunk(tile_max.y - 1); chunk_y++)
+        {
+            for (int chunk_x = tile_to_chunk(tile_min.x); chunk_x <= tile_to_chunk(tile_max.x - 1); chunk_x++)
+            {
+                request_chunk(chunk_x, chunk_y);
+            }
+        }
+    }
+
+    void take_finished()
+    {
+        std::vector<Overworld_Job *> finished;
+        {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            finished.swap(done);
+        }
+        for (Overworld_Job *job : finished)
+        {
+            pending.remove(job->coord.x, job->coord.y);
+            level->put_chunk_tiles(job->coord.x, job->coord.y, job->data);
+            generated_count++;
+            free(job);
+        }
+    }
+
+    // Main thread, once per frame: takes in finished chunks and queues the ones the view is about to need
+    void update(v2i view_min, v2i view_max)
+    {
+        if (!is_active) return;
+        take_finished();
+        int margin = OVERWORLD_VIEW_MARGIN * CHUNK_DIM;
+        request_area((v2i){{{view_min.x - margin, view_min.y - margin}}}, (v2i){{{view_max.x + margin, view_max.y + margin}}});
+    }
+
+    static void generate_job(void *data)
+    {
+        Overworld_Job *job = (Overworld_Job *)data;
+        job->data = overworld_make_chunk_tiles(&job->overworld->params, job->coord.x, job->coord.y);
+
+        std::lock_guard<std::mutex> lock(job->overworld->done_mutex);
+        job->overworld->done.push_back(job);
+    }
+};
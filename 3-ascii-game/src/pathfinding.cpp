@@ -0,0 +1,624 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "types.hpp"
+#include "util.hpp"
+
+#include "job_pool.cpp"
+#include "level.cpp"
+
+/*
+ * Grid pathfinding over the blocking plane: jump point search by default, plain
+ * A* when asked for. 8 directions, diagonal steps can't cut wall corners.
+ *
+ * A search runs inside a window around start and goal (clamped to the level's
+ * tile bounds) so node memory is a flat array indexed by tile. Each context
+ * preallocates a window's worth of nodes and a heap once; nodes are stamped
+ * with the search generation, anything with an old stamp reads as unseen, so
+ * nothing gets cleared between queries and nothing is allocated per query.
+ *
+ * Searches only read the level (chunk map lookups and tile blocks, no cache or
+ * pager updates), so a batch can run on the job pool as long as the main thread
+ * doesn't touch the level until find_batch returns. Paged out chunks read as
+ * blocked.
+ */
+
+#define PATH_WINDOW_DIM_MAX 1024
+#define PATH_WINDOW_MARGIN 32
+#define PATH_CONTEXTS_MAX 16
+#define PATH_COST_STRAIGHT 10
+#define PATH_COST_DIAGONAL 14
+#define PATH_COST_UNSEEN 0xFFFFFFFFu
+
+#define PATH_HEAP_NONE -2
+#define PATH_HEAP_CLOSED -1
+
+enum Path_Algorithm
+{
+    PATH_JPS,
+    PATH_ASTAR,
+};
+
+enum Path_Status
+{
+    PATH_PENDING,
+    PATH_FOUND,
+    PATH_NOT_FOUND,
+    PATH_TOO_FAR,
+};
+
+struct Path_Request
+{
+    v2i start;
+    v2i goal;
+    Path_Algorithm algorithm;
+
+    // Caller owned. JPS writes jump points, consecutive points are joined by a
+    // straight or diagonal line. Only the first point_capacity points are written.
+    v2i *points;
+    int point_capacity;
+
+    Path_Status status;
+    int point_count;
+    u32 cost;
+    int expanded_count;
+};
+
+struct Path_Node
+{
+    u32 g;
+    u32 parent;
+    u32 generation;
+    i32 heap_index;
+};
+
+struct Path_Heap_Entry
+{
+    u64 key; // f in the high half, h in the low half, so ties go to the node closer to the goal
+    u32 node;
+};
+
+struct Path_Context
+{
+    Level *level;
+    Path_Node *nodes;
+    Path_Heap_Entry *heap;
+    int heap_count;
+    u32 generation;
+
+    // Read only chunk lookups, one entry cache like Level::find_chunk
+    Chunk *cached_chunk;
+
+    v2i window_min;
+    int window_w, window_h;
+    v2i goal;
+};
+
+static void path_context_init(Path_Context *ctx, Level *level)
+{
+    *ctx = {};
+    ctx->level = level;
+}
+
+static void path_context_free(Path_Context *ctx)
+{
+    free(ctx->nodes);
+    free(ctx->heap);
+    ctx->nodes = nullptr;
+    ctx->heap = nullptr;
+}
+
+static Chunk *path_find_chunk(Path_Context *ctx, int chunk_x, int chunk_y)
+{
+    Chunk *chunk = ctx->cached_chunk;
+    if (!chunk || chunk->coord.x != chunk_x || chunk->coord.y != chunk_y)
+    {
+        chunk = ctx->level->chunks.find(chunk_x, chunk_y);
+        if (!chunk) return nullptr;
+        ctx->cached_chunk = chunk;
+    }
+    return chunk->data ? chunk : nullptr;
+}
+
+static bool path_is_walkable(Path_Context *ctx, int x, int y)
+{
+    if (x < ctx->window_min.x || y < ctx->window_min.y || x >= ctx->window_min.x + ctx->window_w || y >= ctx->window_min.y + ctx->window_h)
+    {
+        return false;
+    }
+
+    Chunk *chunk = path_find_chunk(ctx, tile_to_chunk(x), tile_to_chunk(y));
+    if (!chunk) return false;
+    return !((chunk->data->planes[TILE_PLANE_BLOCKING][tile_to_local(y)] >> tile_to_local(x)) & 1);
+}
+
+// 64 blocking bits along a row (or a column when is_vertical), bit k is tile base + k along it.
+// Anything outside the window reads as blocked.
+static u64 path_line_bits(Path_Context *ctx, bool is_vertical, int base, int line)
+{
+    int line_min = is_vertical ? ctx->window_min.x : ctx->window_min.y;
+    int line_max = line_min + (is_vertical ? ctx->window_w : ctx->window_h);
+    if (line < line_min || line >= line_max) return ~0ull;
+
+    int local_line = tile_to_local(line);
+    int local_base = tile_to_local(base);
+    u64 words[2];
+    for (int i = 0; i < 2; i++)
+    {
+        int along_chunk = tile_to_chunk(base) + i;
+        Chunk *chunk = is_vertical ? path_find_chunk(ctx, tile_to_chunk(line), along_chunk) : path_find_chunk(ctx, along_chunk, tile_to_chunk(line));
+        if (!chunk) words[i] = ~0ull;
+        else words[i] = is_vertical ? chunk->data->blocking_columns[local_line] : chunk->data->planes[TILE_PLANE_BLOCKING][local_line];
+    }
+    u64 bits = local_base == 0 ? words[0] : (words[0] >> local_base) | (words[1] << (CHUNK_DIM - local_base));
+
+    int along_min = is_vertical ? ctx->window_min.y : ctx->window_min.x;
+    int along_max = along_min + (is_vertical ? ctx->window_h : ctx->window_w);
+    if (base < along_min) bits |= along_min - base >= 64 ? ~0ull : (1ull << (along_min - base)) - 1;
+    if (base + 64 > along_max) bits |= along_max - base <= 0 ? ~0ull : ~0ull << (along_max - base);
+    return bits;
+}
+
+static inline u32 path_octile(int x0, int y0, int x1, int y1)
+{
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    int diagonal = dx < dy ? dx : dy;
+    int straight = dx + dy - 2 * diagonal;
+    return (u32)(diagonal * PATH_COST_DIAGONAL + straight * PATH_COST_STRAIGHT);
+}
+
+static inline u32 path_node_index(Path_Context *ctx, int x, int y)
+{
+    return (u32)((y - ctx->window_min.y) * ctx->window_w + (x - ctx->window_min.x));
+}
+
+static inline v2i path_node_pos(Path_Context *ctx, u32 index)
+{
+    return (v2i){{{ctx->window_min.x + (int)(index % ctx->window_w), ctx->window_min.y + (int)(index / ctx->window_w)}}};
+}
+
+static inline Path_Node *path_touch_node(Path_Context *ctx, u32 index)
+{
+    Path_Node *node = &ctx->nodes[index];
+    if (node->generation != ctx->generation)
+    {
+        node->generation = ctx->generation;
+        node->g = PATH_COST_UNSEEN;
+        node->heap_index = PATH_HEAP_NONE;
+    }
+    return node;
+}
+
+static void path_heap_swap(Path_Context *ctx, int a, int b)
+{
+    Path_Heap_Entry tmp = ctx->heap[a];
+    ctx->heap[a] = ctx->heap[b];
+    ctx->heap[b] = tmp;
+    ctx->nodes[ctx->heap[a].node].heap_index = a;
+    ctx->nodes[ctx->heap[b].node].heap_index = b;
+}
+
+static void path_heap_sift_up(Path_Context *ctx, int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (ctx->heap[parent].key <= ctx->heap[i].key) break;
+        path_heap_swap(ctx, i, parent);
+        i = parent;
+    }
+}
+
+static void path_heap_sift_down(Path_Context *ctx, int i)
+{
+    for (;;)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < ctx->heap_count && ctx->heap[left].key < ctx->heap[smallest].key) smallest = left;
+        if (right < ctx->heap_count && ctx->heap[right].key < ctx->heap[smallest].key) smallest = right;
+        if (smallest == i) break;
+        path_heap_swap(ctx, i, smallest);
+        i = smallest;
+    }
+}
+
+static u32 path_heap_pop(Path_Context *ctx)
+{
+    u32 node = ctx->heap[0].node;
+    ctx->heap_count--;
+    if (ctx->heap_count > 0)
+    {
+        ctx->heap[0] = ctx->heap[ctx->heap_count];
+        ctx->nodes[ctx->heap[0].node].heap_index = 0;
+        path_heap_sift_down(ctx, 0);
+    }
+    ctx->nodes[node].heap_index = PATH_HEAP_CLOSED;
+    return node;
+}
+
+// Opens the node or lowers its cost, indexed heap so an open node is moved in place
+static void path_relax(Path_Context *ctx, int x, int y, u32 g, u32 parent)
+{
+    u32 index = path_node_index(ctx, x, y);
+    Path_Node *node = path_touch_node(ctx, index);
+    if (node->heap_index == PATH_HEAP_CLOSED || g >= node->g) return;
+
+    node->g = g;
+    node->parent = parent;
+    u32 h = path_octile(x, y, ctx->goal.x, ctx->goal.y);
+    u64 key = ((u64)(g + h) << 32) | h;
+    if (node->heap_index == PATH_HEAP_NONE)
+    {
+        node->heap_index = ctx->heap_count;
+        ctx->heap[ctx->heap_count++] = Path_Heap_Entry{key, index};
+    }
+    else
+    {
+        ctx->heap[node->heap_index].key = key;
+    }
+    path_heap_sift_up(ctx, node->heap_index);
+}
+
+// Straight jumps test 63 tiles per step: walls on the line, forced neighbors from the two side lines
+static bool path_jump_straight(Path_Context *ctx, int x, int y, int dx, int dy, v2i *out)
+{
+    bool is_vertical = dx == 0;
+    int dir = is_vertical ? dy : dx;
+    int pos = is_vertical ? y : x;
+    int line = is_vertical ? x : y;
+    int goal_pos = is_vertical ? ctx->goal.y : ctx->goal.x;
+    int goal_line = is_vertical ? ctx->goal.x : ctx->goal.y;
+
+    for (;;)
+    {
+        // Bit 0 (moving forward) or bit 63 (moving back) is the current tile, the other 63 are ahead
+        int base = dir > 0 ? pos : pos - 63;
+        u64 candidates = dir > 0 ? ~1ull : ~0ull >> 1;
+        u64 walls = path_line_bits(ctx, is_vertical, base, line) & candidates;
+        u64 side_a = path_line_bits(ctx, is_vertical, base, line - 1);
+        u64 side_b = path_line_bits(ctx, is_vertical, base, line + 1);
+
+        // Forced: the side tile is open but the one behind it is blocked
+        u64 stops = dir > 0 ? (~side_a & (side_a << 1)) | (~side_b & (side_b << 1))
+                            : (~side_a & (side_a >> 1)) | (~side_b & (side_b >> 1));
+        if (goal_line == line && goal_pos - base >= 0 && goal_pos - base < 64) stops |= 1ull << (goal_pos - base);
+        stops &= candidates;
+
+        int hit;
+        if (dir > 0)
+        {
+            int wall_k = walls ? __builtin_ctzll(walls) : 64;
+            int stop_k = stops ? __builtin_ctzll(stops) : 64;
+            if (stop_k < wall_k) hit = stop_k;
+            else if (wall_k < 64) return false;
+            else
+            {
+                pos += 63;
+                continue;
+            }
+        }
+        else
+        {
+            int wall_k = walls ? 63 - __builtin_clzll(walls) : -1;
+            int stop_k = stops ? 63 - __builtin_clzll(stops) : -1;
+            if (stop_k > wall_k) hit = stop_k;
+            else if (wall_k >= 0) return false;
+            else
+            {
+                pos -= 63;
+                continue;
+            }
+        }
+
+        *out = is_vertical ? (v2i){{{line, base + hit}}} : (v2i){{{base + hit, line}}};
+        return true;
+    }
+}
+
+// Walks from (x, y) in (dx, dy) until a jump point, the goal or a wall
+static bool path_jump(Path_Context *ctx, int x, int y, int dx, int dy, v2i *out)
+{
+    if (dx == 0 || dy == 0) return path_jump_straight(ctx, x, y, dx, dy, out);
+
+    for (;;)
+    {
+        x += dx;
+        y += dy;
+        if (!path_is_walkable(ctx, x, y)) return false;
+        if (x == ctx->goal.x && y == ctx->goal.y) break;
+
+        v2i unused;
+        if (path_jump_straight(ctx, x, y, dx, 0, &unused) || path_jump_straight(ctx, x, y, 0, dy, &unused)) break;
+
+        // No corner cutting, a diagonal step needs both sides open
+        if (!path_is_walkable(ctx, x + dx, y) || !path_is_walkable(ctx, x, y + dy)) return false;
+    }
+    *out = (v2i){{{x, y}}};
+    return true;
+}
+
+static inline int path_sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+// Directions worth searching from a node, pruned by the direction it was reached from
+static int path_get_directions(Path_Context *ctx, int x, int y, int dx, int dy, v2i dirs[8])
+{
+    int count = 0;
+    if (dx == 0 && dy == 0)
+    {
+        for (int ny = -1; ny <= 1; ny++)
+        {
+            for (int nx = -1; nx <= 1; nx++)
+            {
+                if (nx == 0 && ny == 0) continue;
+                if (!path_is_walkable(ctx, x + nx, y + ny)) continue;
+                if (nx != 0 && ny != 0 && (!path_is_walkable(ctx, x + nx, y) || !path_is_walkable(ctx, x, y + ny))) continue;
+                dirs[count++] = (v2i){{{nx, ny}}};
+            }
+        }
+        return count;
+    }
+
+    if (dx != 0 && dy != 0)
+    {
+        bool is_vertical_open = path_is_walkable(ctx, x, y + dy);
+        bool is_horizontal_open = path_is_walkable(ctx, x + dx, y);
+        if (is_vertical_open) dirs[count++] = (v2i){{{0, dy}}};
+        if (is_horizontal_open) dirs[count++] = (v2i){{{dx, 0}}};
+        if (is_vertical_open && is_horizontal_open) dirs[count++] = (v2i){{{dx, dy}}};
+    }
+    else if (dx != 0)
+    {
+        bool is_next_open = path_is_walkable(ctx, x + dx, y);
+        bool is_up_open = path_is_walkable(ctx, x, y - 1);
+        bool is_down_open = path_is_walkable(ctx, x, y + 1);
+        if (is_next_open)
+        {
+            dirs[count++] = (v2i){{{dx, 0}}};
+            if (is_up_open) dirs[count++] = (v2i){{{dx, -1}}};
+            if (is_down_open) dirs[count++] = (v2i){{{dx, 1}}};
+        }
+        if (is_up_open) dirs[count++] = (v2i){{{0, -1}}};
+        if (is_down_open) dirs[count++] = (v2i){{{0, 1}}};
+    }
+    else
+    {
+        bool is_next_open = path_is_walkable(ctx, x, y + dy);
+        bool is_left_open = path_is_walkable(ctx, x - 1, y);
+        bool is_right_open = path_is_walkable(ctx, x + 1, y);
+        if (is_next_open)
+        {
+            dirs[count++] = (v2i){{{0, dy}}};
+            if (is_left_open) dirs[count++] = (v2i){{{-1, dy}}};
+            if (is_right_open) dirs[count++] = (v2i){{{1, dy}}};
+        }
+        if (is_left_open) dirs[count++] = (v2i){{{-1, 0}}};
+        if (is_right_open) dirs[count++] = (v2i){{{1, 0}}};
+    }
+    return count;
+}
+
+static void path_expand_jps(Path_Context *ctx, u32 index, v2i p)
+{
+    Path_Node *node = &ctx->nodes[index];
+    int dx = 0, dy = 0;
+    if (node->parent != index)
+    {
+        v2i parent = path_node_pos(ctx, node->parent);
+        dx = path_sign(p.x - parent.x);
+        dy = path_sign(p.y - parent.y);
+    }
+
+    v2i dirs[8];
+    int dir_count = path_get_directions(ctx, p.x, p.y, dx, dy, dirs);
+    for (int i = 0; i < dir_count; i++)
+    {
+        v2i jump_point;
+        if (path_jump(ctx, p.x, p.y, dirs[i].x, dirs[i].y, &jump_point))
+        {
+            u32 g = node->g + path_octile(p.x, p.y, jump_point.x, jump_point.y);
+            path_relax(ctx, jump_point.x, jump_point.y, g, index);
+        }
+    }
+}
+
+static void path_expand_astar(Path_Context *ctx, u32 index, v2i p)
+{
+    Path_Node *node = &ctx->nodes[index];
+    v2i dirs[8];
+    int dir_count = path_get_directions(ctx, p.x, p.y, 0, 0, dirs);
+    for (int i = 0; i < dir_count; i++)
+    {
+        u32 step = dirs[i].x != 0 && dirs[i].y != 0 ? PATH_COST_DIAGONAL : PATH_COST_STRAIGHT;
+        path_relax(ctx, p.x + dirs[i].x, p.y + dirs[i].y, node->g + step, index);
+    }
+}
+
+static void path_write_points(Path_Context *ctx, Path_Request *req, u32 goal_index)
+{
+    int count = 1;
+    for (u32 i = goal_index; ctx->nodes[i].parent != i; i = ctx->nodes[i].parent)
+    {
+        count++;
+    }
+
+    req->point_count = count < req->point_capacity ? count : req->point_capacity;
+    int slot = count - 1;
+    for (u32 i = goal_index; ; i = ctx->nodes[i].parent, slot--)
+    {
+        if (slot < req->point_capacity) req->points[slot] = path_node_pos(ctx, i);
+        if (ctx->nodes[i].parent == i) break;
+    }
+}
+
+static void path_find(Path_Context *ctx, Path_Request *req)
+{
+    req->status = PATH_NOT_FOUND;
+    req->point_count = 0;
+    req->cost = 0;
+    req->expanded_count = 0;
+
+    Level *level = ctx->level;
+    v2i min = {{{req->start.x < req->goal.x ? req->start.x : req->goal.x, req->start.y < req->goal.y ? req->start.y : req->goal.y}}};
+    v2i max = {{{req->start.x > req->goal.x ? req->start.x : req->goal.x, req->start.y > req->goal.y ? req->start.y : req->goal.y}}};
+    min.x -= PATH_WINDOW_MARGIN;
+    min.y -= PATH_WINDOW_MARGIN;
+    max.x += PATH_WINDOW_MARGIN + 1;
+    max.y += PATH_WINDOW_MARGIN + 1;
+    // Nothing walkable outside the level bounds anyway
+    if (min.x < level->tile_min.x) min.x = level->tile_min.x;
+    if (min.y < level->tile_min.y) min.y = level->tile_min.y;
+    if (max.x > level->tile_max.x) max.x = level->tile_max.x;
+    if (max.y > level->tile_max.y) max.y = level->tile_max.y;
+
+    if (max.x - min.x > PATH_WINDOW_DIM_MAX || max.y - min.y > PATH_WINDOW_DIM_MAX)
+    {
+        req->status = PATH_TOO_FAR;
+        return;
+    }
+
+    ctx->window_min = min;
+    ctx->window_w = max.x - min.x;
+    ctx->window_h = max.y - min.y;
+    ctx->goal = req->goal;
+    ctx->cached_chunk = nullptr;
+    if (!path_is_walkable(ctx, req->start.x, req->start.y) || !path_is_walkable(ctx, req->goal.x, req->goal.y)) return;
+
+    if (!ctx->nodes)
+    {
+        ctx->nodes = (Path_Node *)calloc((size_t)PATH_WINDOW_DIM_MAX * PATH_WINDOW_DIM_MAX, sizeof(Path_Node));
+        ctx->heap = (Path_Heap_Entry *)malloc((size_t)PATH_WINDOW_DIM_MAX * PATH_WINDOW_DIM_MAX * sizeof(Path_Heap_Entry));
+    }
+
+    ctx->generation++;
+    if (ctx->generation == 0)
+    {
+        // Wrapped, stamps from 4 billion searches ago would read as current
+        memset(ctx->nodes, 0, (size_t)PATH_WINDOW_DIM_MAX * PATH_WINDOW_DIM_MAX * sizeof(Path_Node));
+        ctx->generation = 1;
+    }
+    ctx->heap_count = 0;
+
+    u32 start_index = path_node_index(ctx, req->start.x, req->start.y);
+    path_relax(ctx, req->start.x, req->start.y, 0, start_index);
+
+    u32 goal_index = path_node_index(ctx, req->goal.x, req->goal.y);
+    while (ctx->heap_count > 0)
+    {
+        u32 index = path_heap_pop(ctx);
+        req->expanded_count++;
+        if (index == goal_index)
+        {
+            req->status = PATH_FOUND;
+            req->cost = ctx->nodes[index].g;
+            path_write_points(ctx, req, index);
+            return;
+        }
+
+        v2i p = path_node_pos(ctx, index);
+        if (req->algorithm == PATH_JPS) path_expand_jps(ctx, index, p);
+        else path_expand_astar(ctx, index, p);
+    }
+}
+
+struct Path_Service;
+
+struct Path_Slice
+{
+    Path_Service *service;
+    Path_Context *ctx;
+    Path_Request *requests;
+    int count;
+};
+
+struct Path_Service
+{
+    Job_Pool *pool;
+    Level *level;
+    Path_Context contexts[PATH_CONTEXTS_MAX];
+    int context_count;
+
+    Path_Slice slices[PATH_CONTEXTS_MAX];
+    std::mutex mutex;
+    std::condition_variable slices_done;
+    int slices_left;
+
+    void init(Job_Pool *pool, Level *level)
+    {
+        this->pool = pool;
+        this->level = level;
+        // One context per worker plus the main thread
+        context_count = pool->get_worker_count() + 1;
+        if (context_count > PATH_CONTEXTS_MAX) context_count = PATH_CONTEXTS_MAX;
+        for (int i = 0; i < context_count; i++)
+        {
+            path_context_init(&contexts[i], level);
+        }
+    }
+
+    // Main thread
+    void find(Path_Request *request)
+    {
+        path_find(&contexts[0], request);
+    }
+
+    // Splits the requests across the workers, the main thread takes a share too. Blocks until all are done.
+    void find_batch(Path_Request *requests, int count)
+    {
+        if (count <= 0) return;
+        int slice_count = count < context_count ? count : context_count;
+        int per_slice = (count + slice_count - 1) / slice_count;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slices_left = slice_count - 1;
+        }
+        for (int i = 0; i < slice_count; i++)
+        {
+            int first = i * per_slice;
+            int slice_size = count - first < per_slice ? count - first : per_slice;
+            slices[i] = Path_Slice{this, &contexts[i], requests + first, slice_size > 0 ? slice_size : 0};
+            if (i > 0) pool->push(slice_job, &slices[i]);
+        }
+
+        run_slice(&slices[0]);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        slices_done.wait(lock, [this]() { return slices_left == 0; });
+    }
+
+    static void run_slice(Path_Slice *slice)
+    {
+        for (int i = 0; i < slice->count; i++)
+        {
+            path_find(slice->ctx, &slice->requests[i]);
+        }
+    }
+
+    static void slice_job(void *data)
+    {
+        Path_Slice *slice = (Path_Slice *)data;
+        run_slice(slice);
+
+        Path_Service *service = slice->service;
+        std::lock_guard<std::mutex> lock(service->mutex);
+        if (--service->slices_left == 0) service->slices_done.notify_all();
+    }
+
+    void free_all()
+    {
+        for (int i = 0; i < context_count; i++)
+        {
+            path_context_free(&contexts[i]);
+        }
+    }
+};
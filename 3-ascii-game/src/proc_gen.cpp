@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+
+#include "types.hpp"
+
+#include "level.cpp"
+#include "rng.cpp"
+
+/*
+ * Shared pieces of the level generators. Generators work on a Bit_Grid, one
+ * bit per tile, and write it into the level a chunk at a time at the end, so
+ * carving a room row is a couple of word operations and the level only sees
+ * fill_chunk calls. Grids are sized in whole chunks, so a chunk row is exactly
+ * one grid word.
+ */
+
+struct Bit_Grid
+{
+    int cols, rows; // the requested size, the words cover whole chunks past it
+    int words_per_row;
+    int word_rows;
+    u64 *words;
+};
+
+static void bit_grid_init(Bit_Grid *grid, int cols, int rows, bool value)
+{
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->words_per_row = (cols + CHUNK_DIM - 1) / CHUNK_DIM;
+    grid->word_rows = (rows + CHUNK_DIM - 1) / CHUNK_DIM * CHUNK_DIM;
+    size_t size = (size_t)grid->words_per_row * grid->word_rows * sizeof(u64);
+    grid->words = (u64 *)malloc(size);
+    memset(grid->words, value ? 0xFF : 0, size);
+}
+
+static void bit_grid_free(Bit_Grid *grid)
+{
+    free(grid->words);
+    grid->words = nullptr;
+}
+
+static inline u64 *bit_grid_row(Bit_Grid *grid, int row)
+{
+    return grid->words + (size_t)row * grid->words_per_row;
+}
+
+static inline bool bit_grid_get(Bit_Grid *grid, int col, int row)
+{
+    return (bit_grid_row(grid, row)[col >> 6] >> (col & 63)) & 1;
+}
+
+static inline void bit_grid_set(Bit_Grid *grid, int col, int row, bool value)
+{
+    u64 *word = &bit_grid_row(grid, row)[col >> 6];
+    u64 bit = 1ull << (col & 63);
+    *word = value ? (*word | bit) : (*word & ~bit);
+}
+
+// Cols [col_min, col_max] inclusive, a word at a time
+static void bit_grid_set_span(Bit_Grid *grid, int row, int col_min, int col_max, bool value)
+{
+    u64 *words = bit_grid_row(grid, row);
+    for (int col = col_min; col <= col_max; )
+    {
+        int bit = col & 63;
+        int count = col_max - col + 1 < 64 - bit ? col_max - col + 1 : 64 - bit;
+        u64 mask = (count == 64 ? ~0ull : ((1ull << count) - 1)) << bit;
+        words[col >> 6] = value ? (words[col >> 6] | mask) : (words[col >> 6] & ~mask);
+        col += count;
+    }
+}
+
+static bool bit_grid_any_in_span(Bit_Grid *grid, int row, int col_min, int col_max)
+{
+    u64 *words = bit_grid_row(grid, row);
+    for (int col = col_min; col <= col_max; )
+    {
+        int bit = col & 63;
+        int count = col_max - col + 1 < 64 - bit ? col_max - col + 1 : 64 - bit;
+        u64 mask = (count == 64 ? ~0ull : ((1ull << count) - 1)) << bit;
+        if (words[col >> 6] & mask) return true;
+        col += count;
+    }
+    return false;
+}
+
+// The outer ring of the requested size
+static void bit_grid_set_border(Bit_Grid *grid, bool value)
+{
+    bit_grid_set_span(grid, 0, 0, grid->cols - 1, value);
+    bit_grid_set_span(grid, grid->rows - 1, 0, grid->cols - 1, value);
+    for (int row = 0; row < grid->rows; row++)
+    {
+        bit_grid_set(grid, 0, row, value);
+        bit_grid_set(grid, grid->cols - 1, row, value);
+    }
+}
+
+// Clear tile nearest to the middle row, scanning out from the middle column. Returns the middle itself if there is none.
+static v2i bit_grid_find_clear_near_center(Bit_Grid *grid)
+{
+    int cols = grid->cols;
+    int rows = grid->rows;
+    for (int row_offset = 0; row_offset < rows; row_offset++)
+    {
+        int row = rows / 2 + (row_offset & 1 ? -(row_offset + 1) / 2 : row_offset / 2);
+        if (row < 0 || row >= rows) continue;
+        for (int col_offset = 0; col_offset < cols; col_offset++)
+        {
+            int col = cols / 2 + (col_offset & 1 ? -(col_offset + 1) / 2 : col_offset / 2);
+            if (col >= 0 && col < cols && !bit_grid_get(grid, col, row)) return (v2i){{{col, row}}};
+        }
+    }
+    return (v2i){{{cols / 2, rows / 2}}};
+}
+
+static int bit_grid_count(Bit_Grid *grid)
+{
+    int count = 0;
+    size_t total = (size_t)grid->words_per_row * grid->word_rows;
+    for (size_t i = 0; i < total; i++)
+    {
+        count += __builtin_popcountll(grid->words[i]);
+    }
+    return count;
+}
+
+// Clears the level and writes the grid at the origin: set bits become set_tile, clear ones clear_tile
+static void level_write_bit_grid(Level *level, Bit_Grid *grid, MapTile set_tile, MapTile clear_tile)
+{
+    level->clear();
+    u64 rows[CHUNK_DIM];
+    for (int chunk_y = 0; chunk_y < grid->word_rows / CHUNK_DIM; chunk_y++)
+    {
+        for (int chunk_x = 0; chunk_x < grid->words_per_row; chunk_x++)
+        {
+            for (int row = 0; row < CHUNK_DIM; row++)
+            {
+                rows[row] = bit_grid_row(grid, chunk_y * CHUNK_DIM + row)[chunk_x];
+            }
+            level->fill_chunk(chunk_x, chunk_y, rows, set_tile, clear_tile);
+        }
+    }
+}
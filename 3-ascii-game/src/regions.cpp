@@ -0,0 +1,576 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "types.hpp"
+
+#include "job_pool.cpp"
+#include "level.cpp"
+
+/*
+ * Connected regions of walkable tiles, so "can X reach Y" is comparing two
+ * region ids instead of a search. Tiles connect through their 4 sides, which
+ * is also what 8 way moves without corner cutting can reach.
+ *
+ * Each chunk is labeled on its own from its blocking plane: a row's open tiles
+ * are runs, kept as a bitmask of where runs start, and runs that overlap the
+ * row above are joined with a small union find. A tile's run is then a popcount
+ * of the run starts up to it, so looking up a tile's label needs no per tile
+ * storage. Chunks are labeled in slices across the job pool.
+ *
+ * Chunk labels are joined into regions with a second union find, using the
+ * pairs of labels that touch across each chunk's right and bottom border, and
+ * each label gets the id of its region. 0 is blocking or outside the level.
+ *
+ * update() relabels only the chunks whose blocking_version moved since they
+ * were labeled, after set_tile or a generator, and recomputes the border pairs
+ * around them. Only the regions those chunks were part of or now touch are
+ * joined again, every other region keeps its labels and its id, so an edit
+ * costs as much as the regions around it: little in a dungeon, the whole level
+ * in a cave where one region reaches everywhere. The ids of the
+ * regions an edit touched are recycled, so one of them can come back as a
+ * different region: compare ids from the same update, don't keep them.
+ *
+ * Paged out chunks keep their labels, paging leaves blocking_version alone.
+ * One that isn't labeled, or was edited before it was paged out, is loaded in
+ * the background a few at a time, and until it's back its tiles are unknown.
+ * So are regions that might still join through it, see get_reachability.
+ */
+
+#define REGION_NONE 0
+#define REGION_UNKNOWN 0xFFFFFFFFu
+#define REGION_RUNS_MAX (CHUNK_DIM * CHUNK_DIM / 2)
+#define REGION_SLICES_MAX 16
+#define REGION_LOADS_MAX 16 // chunks loaded for labeling at once
+
+enum Reachability
+{
+    REACHABILITY_NO,
+    REACHABILITY_YES,
+    REACHABILITY_UNKNOWN, // a chunk that could matter isn't labeled yet
+};
+
+struct Region_Chunk
+{
+    v2i coord;
+    bool is_labeled;
+    u32 blocking_version; // of the chunk when it was labeled
+
+    u64 open[CHUNK_DIM]; // walkable tiles as labeled
+    u64 run_starts[CHUNK_DIM];
+    u16 row_first_run[CHUNK_DIM];
+    u16 label_count;
+    u16 *run_labels;
+
+    // Label pairs (this chunk's << 16 | neighbor's) touching across the right and bottom border
+    std::vector<u32> right_pairs;
+    std::vector<u32> down_pairs;
+
+    // First union find node of this chunk's labels in the last join it was part of, and the region id of each label
+    u32 node_base;
+    std::vector<u32> label_regions;
+
+    // Regions::generation when the chunk was last relabeled or dropped, and when it was last joined
+    u32 change_generation;
+    u32 join_generation;
+
+    // Label of an open local tile
+    u16 get_label(int col, int row)
+    {
+        int run = row_first_run[row] + __builtin_popcountll(run_starts[row] & ((2ull << col) - 1)) - 1;
+        return run_labels[run];
+    }
+};
+
+static u32 region_find(u32 *parents, u32 node)
+{
+    while (parents[node] != node)
+    {
+        parents[node] = parents[parents[node]];
+        node = parents[node];
+    }
+    return node;
+}
+
+static void region_union(u32 *parents, u32 a, u32 b)
+{
+    a = region_find(parents, a);
+    b = region_find(parents, b);
+    // Lower root wins, keeps trees shallow enough without ranks with path halving
+    if (a < b) parents[b] = a;
+    else if (b < a) parents[a] = b;
+}
+
+// Worker side: labels one chunk from its blocking plane, touches nothing else
+static void region_label_chunk(Region_Chunk *region_chunk, const u64 blocking[CHUNK_DIM])
+{
+    u32 parents[REGION_RUNS_MAX];
+    int run_count = 0;
+    for (int row = 0; row < CHUNK_DIM; row++)
+    {
+        u64 open = ~blocking[row];
+        region_chunk->open[row] = open;
+        region_chunk->run_starts[row] = open & ~(open << 1);
+        region_chunk->row_first_run[row] = (u16)run_count;
+        int row_runs = __builtin_popcountll(region_chunk->run_starts[row]);
+        for (int i = 0; i < row_runs; i++)
+        {
+            parents[run_count + i] = (u32)(run_count + i);
+        }
+
+        // Each stretch where this row and the one above are both open lies in one run of each
+        if (row > 0)
+        {
+            u64 overlap = open & region_chunk->open[row - 1];
+            for (u64 starts = overlap & ~(overlap << 1); starts; starts &= starts - 1)
+            {
+                u64 upto = ((starts & -starts) << 1) - 1;
+                u32 here = (u32)(run_count + __builtin_popcountll(region_chunk->run_starts[row] & upto) - 1);
+                u32 above = (u32)(region_chunk->row_first_run[row - 1] + __builtin_popcountll(region_chunk->run_starts[row - 1] & upto) - 1);
+                region_union(parents, here, above);
+            }
+        }
+        run_count += row_runs;
+    }
+
+    // Roots get labels in run order, every other run takes its root's
+    free(region_chunk->run_labels);
+    region_chunk->run_labels = (u16 *)malloc((run_count > 0 ? run_count : 1) * sizeof(u16));
+    int label_count = 0;
+    for (int run = 0; run < run_count; run++)
+    {
+        u32 root = region_find(parents, (u32)run);
+        region_chunk->run_labels[run] = root == (u32)run ? (u16)label_count++ : region_chunk->run_labels[root];
+    }
+    region_chunk->label_count = (u16)label_count;
+    region_chunk->is_labeled = true;
+}
+
+static void region_find_right_pairs(Region_Chunk *left, Region_Chunk *right)
+{
+    left->right_pairs.clear();
+    for (int row = 0; row < CHUNK_DIM; row++)
+    {
+        if (!((left->open[row] >> (CHUNK_DIM - 1)) & right->open[row] & 1)) continue;
+        u32 pair = ((u32)left->get_label(CHUNK_DIM - 1, row) << 16) | right->get_label(0, row);
+        // Rows next to each other usually carry the same pair
+        if (left->right_pairs.empty() || left->right_pairs.back() != pair) left->right_pairs.push_back(pair);
+    }
+}
+
+static void region_find_down_pairs(Region_Chunk *top, Region_Chunk *bottom)
+{
+    top->down_pairs.clear();
+    u64 overlap = top->open[CHUNK_DIM - 1] & bottom->open[0];
+    for (u64 starts = overlap & ~(overlap << 1); starts; starts &= starts - 1)
+    {
+        int col = __builtin_ctzll(starts);
+        top->down_pairs.push_back(((u32)top->get_label(col, CHUNK_DIM - 1) << 16) | bottom->get_label(col, 0));
+    }
+}
+
+struct Regions;
+
+struct Region_Slice
+{
+    Regions *regions;
+    int first, last; // into regions->relabel
+};
+
+struct Regions
+{
+    Level *level;
+    Job_Pool *pool;
+    Coord_Map<Region_Chunk> chunks;
+
+    // Relabel pass, filled on the main thread, labeled by the slices
+    std::vector<Region_Chunk *> relabel;
+    std::vector<const u64 *> relabel_planes;
+    Region_Slice slices[REGION_SLICES_MAX];
+    std::mutex mutex;
+    std::condition_variable slices_done;
+    int slices_left;
+
+    // Relabeled or dropped this update
+    std::vector<Region_Chunk *> changed;
+    u32 generation;
+
+    // Regions whose labels are joined again this update, and the chunks holding them
+    std::vector<u32> touched;
+    std::vector<u8> is_touched; // by region id
+    std::vector<Region_Chunk *> joined;
+    std::vector<u32> parents;
+    std::vector<u32> node_regions;
+
+    // Chunks holding each region, a chunk is listed once per region. Unused ids are empty and in free_regions.
+    std::vector<std::vector<Region_Chunk *>> region_chunks;
+    std::vector<u32> free_regions;
+    u32 region_count;
+
+    // Level chunks that aren't labeled as they are now
+    int pending_count;
+
+    int update_count;
+    int relabel_count;
+    int joined_chunk_count;
+    double last_update_us;
+
+    void init(Level *level, Job_Pool *pool)
+    {
+        this->level = level;
+        this->pool = pool;
+    }
+
+    // REGION_NONE for blocking tiles and tiles outside the level, REGION_UNKNOWN until the tile's chunk is labeled.
+    // Valid as of the last update().
+    u32 get_region(int col, int row)
+    {
+        int chunk_x = tile_to_chunk(col);
+        int chunk_y = tile_to_chunk(row);
+        Region_Chunk *region_chunk = chunks.find(chunk_x, chunk_y);
+        if (!region_chunk || !region_chunk->is_labeled)
+        {
+            return level->chunks.find(chunk_x, chunk_y) ? REGION_UNKNOWN : REGION_NONE;
+        }
+        int local_col = tile_to_local(col);
+        int local_row = tile_to_local(row);
+        if (!((region_chunk->open[local_row] >> local_col) & 1)) return REGION_NONE;
+        return region_chunk->label_regions[region_chunk->get_label(local_col, local_row)];
+    }
+
+    u32 get_region(v2i tile)
+    {
+        return get_region(tile.x, tile.y);
+    }
+
+    Reachability get_reachability(v2i from, v2i to)
+    {
+        u32 from_region = get_region(from);
+        u32 to_region = get_region(to);
+        if (from_region == REGION_UNKNOWN || to_region == REGION_UNKNOWN) return REACHABILITY_UNKNOWN;
+        if (from_region == REGION_NONE || to_region == REGION_NONE) return REACHABILITY_NO;
+        if (from_region == to_region) return REACHABILITY_YES;
+        // Two regions can still meet in a chunk that isn't labeled
+        return pending_count > 0 ? REACHABILITY_UNKNOWN : REACHABILITY_NO;
+    }
+
+    static void label_slice(Region_Slice *slice)
+    {
+        Regions *regions = slice->regions;
+        for (int i = slice->first; i < slice->last; i++)
+        {
+            region_label_chunk(regions->relabel[i], regions->relabel_planes[i]);
+        }
+    }
+
+    static void slice_job(void *data)
+    {
+        Region_Slice *slice = (Region_Slice *)data;
+        label_slice(slice);
+
+        Regions *regions = slice->regions;
+        std::lock_guard<std::mutex> lock(regions->mutex);
+        if (--regions->slices_left == 0) regions->slices_done.notify_all();
+    }
+
+    // Main thread takes the first slice, blocks until all are done
+    void label_relabel_list()
+    {
+        int count = (int)relabel.size();
+        int slice_count = pool ? pool->get_worker_count() + 1 : 1;
+        if (slice_count > REGION_SLICES_MAX) slice_count = REGION_SLICES_MAX;
+        if (slice_count > count) slice_count = count;
+        for (int i = 0; i < slice_count; i++)
+        {
+            slices[i] = Region_Slice{this, count * i / slice_count, count * (i + 1) / slice_count};
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slices_left = slice_count - 1;
+        }
+        for (int i = 1; i < slice_count; i++)
+        {
+            pool->push(slice_job, &slices[i]);
+        }
+        label_slice(&slices[0]);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        slices_done.wait(lock, [this]() { return slices_left == 0; });
+    }
+
+    void touch_region(u32 region)
+    {
+        if (is_touched[region]) return;
+        is_touched[region] = 1;
+        touched.push_back(region);
+    }
+
+    // The chunk's current regions, before its labels go
+    void touch_chunk_regions(Region_Chunk *region_chunk)
+    {
+        if (!region_chunk->is_labeled) return;
+        for (u32 region : region_chunk->label_regions) touch_region(region);
+    }
+
+    void refresh_pairs_around(Region_Chunk *region_chunk)
+    {
+        int x = region_chunk->coord.x;
+        int y = region_chunk->coord.y;
+        Region_Chunk *right = chunks.find(x + 1, y);
+        Region_Chunk *down = chunks.find(x, y + 1);
+        Region_Chunk *left = chunks.find(x - 1, y);
+        Region_Chunk *up = chunks.find(x, y - 1);
+        region_chunk->right_pairs.clear();
+        region_chunk->down_pairs.clear();
+        if (!region_chunk->is_labeled)
+        {
+            if (left) left->right_pairs.clear();
+            if (up) up->down_pairs.clear();
+            return;
+        }
+        if (right && right->is_labeled) region_find_right_pairs(region_chunk, right);
+        if (down && down->is_labeled) region_find_down_pairs(region_chunk, down);
+        if (left && left->is_labeled) region_find_right_pairs(left, region_chunk);
+        if (up && up->is_labeled) region_find_down_pairs(up, region_chunk);
+    }
+
+    // Regions of unchanged neighbors that a changed chunk's labels now touch
+    void touch_neighbor_regions(Region_Chunk *region_chunk)
+    {
+        int x = region_chunk->coord.x;
+        int y = region_chunk->coord.y;
+        Region_Chunk *right = chunks.find(x + 1, y);
+        Region_Chunk *down = chunks.find(x, y + 1);
+        Region_Chunk *left = chunks.find(x - 1, y);
+        Region_Chunk *up = chunks.find(x, y - 1);
+        if (right && right->change_generation != generation)
+        {
+            for (u32 pair : region_chunk->right_pairs) touch_region(right->label_regions[pair & 0xFFFF]);
+        }
+        if (down && down->change_generation != generation)
+        {
+            for (u32 pair : region_chunk->down_pairs) touch_region(down->label_regions[pair & 0xFFFF]);
+        }
+        if (left && left->change_generation != generation)
+        {
+            for (u32 pair : left->right_pairs) touch_region(left->label_regions[pair >> 16]);
+        }
+        if (up && up->change_generation != generation)
+        {
+            for (u32 pair : up->down_pairs) touch_region(up->label_regions[pair >> 16]);
+        }
+    }
+
+    u32 take_region_id()
+    {
+        if (!free_regions.empty())
+        {
+            u32 region = free_regions.back();
+            free_regions.pop_back();
+            return region;
+        }
+        // Id 0 is REGION_NONE, so there's one more slot than ids handed out
+        if (region_chunks.empty())
+        {
+            region_chunks.emplace_back();
+            is_touched.push_back(0);
+        }
+        region_chunks.emplace_back();
+        is_touched.push_back(0);
+        return (u32)region_chunks.size() - 1;
+    }
+
+    bool is_label_joined(Region_Chunk *region_chunk, int label)
+    {
+        return region_chunk->change_generation == generation || is_touched[region_chunk->label_regions[label]];
+    }
+
+    // Main thread, once per frame or after edits: relabels changed chunks and joins the regions they touch again
+    void update()
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        generation++;
+        relabel.clear();
+        relabel_planes.clear();
+        changed.clear();
+        pending_count = 0;
+        int loads_left = level->pager ? REGION_LOADS_MAX - level->pager->loads_in_flight : 0;
+        Chunk_Map *level_chunks = &level->chunks;
+        for (u32 i = 0; i < level_chunks->capacity; i++)
+        {
+            Chunk *chunk = level_chunks->slots[i].value;
+            if (!chunk) continue;
+            Region_Chunk *region_chunk = chunks.find(chunk->coord.x, chunk->coord.y);
+            if (region_chunk && region_chunk->is_labeled && region_chunk->blocking_version == chunk->blocking_version) continue;
+
+            if (!chunk->data)
+            {
+                // Edited and paged out before it was relabeled: its labels are wrong until it's back
+                if (region_chunk && region_chunk->is_labeled)
+                {
+                    touch_chunk_regions(region_chunk);
+                    region_chunk->is_labeled = false;
+                    region_chunk->label_count = 0;
+                    region_chunk->change_generation = generation;
+                    changed.push_back(region_chunk);
+                }
+                pending_count++;
+                if (chunk->residency == CHUNK_PAGED_OUT && loads_left > 0)
+                {
+                    // Counts as used now, or update_paging evicts it again before it's labeled
+                    chunk->last_used = ++level->use_tick;
+                    level->pager->request_load(chunk);
+                    loads_left--;
+                }
+                continue;
+            }
+
+            if (!region_chunk)
+            {
+                region_chunk = new Region_Chunk();
+                region_chunk->coord = chunk->coord;
+                chunks.insert(chunk->coord.x, chunk->coord.y, region_chunk);
+            }
+            touch_chunk_regions(region_chunk);
+            region_chunk->blocking_version = chunk->blocking_version;
+            region_chunk->change_generation = generation;
+            relabel.push_back(region_chunk);
+            relabel_planes.push_back(chunk->data->planes[TILE_PLANE_BLOCKING]);
+            changed.push_back(region_chunk);
+        }
+        if (changed.empty()) return;
+
+        label_relabel_list();
+        for (Region_Chunk *region_chunk : changed)
+        {
+            refresh_pairs_around(region_chunk);
+        }
+        for (Region_Chunk *region_chunk : changed)
+        {
+            touch_neighbor_regions(region_chunk);
+        }
+        relabel_count += (int)relabel.size();
+        join();
+
+        update_count++;
+        last_update_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Union find over the labels of the changed chunks and of the touched regions, every other label keeps its id
+    void join()
+    {
+        joined.clear();
+        for (Region_Chunk *region_chunk : changed)
+        {
+            region_chunk->join_generation = generation;
+            joined.push_back(region_chunk);
+        }
+        for (u32 region : touched)
+        {
+            for (Region_Chunk *region_chunk : region_chunks[region])
+            {
+                if (region_chunk->join_generation == generation) continue;
+                region_chunk->join_generation = generation;
+                joined.push_back(region_chunk);
+            }
+        }
+
+        u32 node_count = 0;
+        for (Region_Chunk *region_chunk : joined)
+        {
+            region_chunk->node_base = node_count;
+            node_count += region_chunk->label_count;
+        }
+        parents.resize(node_count);
+        for (u32 node = 0; node < node_count; node++) parents[node] = node;
+
+        // A joined label only pairs with joined labels: before the change both sides were in a touched
+        // region, or one side is a changed chunk and the other side's region was touched for it
+        for (Region_Chunk *region_chunk : joined)
+        {
+            Region_Chunk *right = chunks.find(region_chunk->coord.x + 1, region_chunk->coord.y);
+            Region_Chunk *down = chunks.find(region_chunk->coord.x, region_chunk->coord.y + 1);
+            if (right && right->join_generation == generation)
+            {
+                for (u32 pair : region_chunk->right_pairs)
+                {
+                    if (!is_label_joined(region_chunk, pair >> 16)) continue;
+                    region_union(parents.data(), region_chunk->node_base + (pair >> 16), right->node_base + (pair & 0xFFFF));
+                }
+            }
+            if (down && down->join_generation == generation)
+            {
+                for (u32 pair : region_chunk->down_pairs)
+                {
+                    if (!is_label_joined(region_chunk, pair >> 16)) continue;
+                    region_union(parents.data(), region_chunk->node_base + (pair >> 16), down->node_base + (pair & 0xFFFF));
+                }
+            }
+        }
+
+        // Touched ids are handed out again, in the order they were touched
+        for (int i = (int)touched.size() - 1; i >= 0; i--)
+        {
+            region_chunks[touched[i]].clear();
+            free_regions.push_back(touched[i]);
+        }
+
+        // Roots come first in node order, so one pass numbers them before anything points at them
+        node_regions.assign(node_count, REGION_NONE);
+        std::vector<u32> chunk_regions;
+        for (Region_Chunk *region_chunk : joined)
+        {
+            bool is_changed = region_chunk->change_generation == generation;
+            if (is_changed) region_chunk->label_regions.resize(region_chunk->label_count);
+            chunk_regions.clear();
+            for (int label = 0; label < region_chunk->label_count; label++)
+            {
+                if (!is_changed && !is_touched[region_chunk->label_regions[label]]) continue;
+                u32 node = region_chunk->node_base + label;
+                u32 root = region_find(parents.data(), node);
+                if (root == node) node_regions[node] = take_region_id();
+                else node_regions[node] = node_regions[root];
+                chunk_regions.push_back(node_regions[node]);
+            }
+            // label_regions is read through is_touched above, so it's written after the whole chunk
+            for (int label = 0; label < region_chunk->label_count; label++)
+            {
+                u32 region = node_regions[region_chunk->node_base + label];
+                if (region != REGION_NONE) region_chunk->label_regions[label] = region;
+            }
+            std::sort(chunk_regions.begin(), chunk_regions.end());
+            chunk_regions.erase(std::unique(chunk_regions.begin(), chunk_regions.end()), chunk_regions.end());
+            for (u32 region : chunk_regions) region_chunks[region].push_back(region_chunk);
+        }
+
+        for (u32 region : touched) is_touched[region] = 0;
+        touched.clear();
+        joined_chunk_count = (int)joined.size();
+        region_count = region_chunks.empty() ? 0 : (u32)(region_chunks.size() - 1 - free_regions.size());
+    }
+
+    static void free_chunk(Region_Chunk *region_chunk)
+    {
+        free(region_chunk->run_labels);
+        delete region_chunk;
+    }
+
+    // The level was regenerated, coordinates can match new chunks by accident
+    void clear()
+    {
+        chunks.free_all(free_chunk);
+        region_chunks.clear();
+        free_regions.clear();
+        is_touched.clear();
+        parents.clear();
+        region_count = 0;
+        pending_count = 0;
+    }
+};
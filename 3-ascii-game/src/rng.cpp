@@ -0,0 +1,46 @@
+#pragma once
+
+#include "types.hpp"
+
+/*
+ * PCG32: small, fast and the same sequence for the same seed on every platform,
+ * so a generated level can be rebuilt from its seed alone.
+ */
+
+struct Rng
+{
+    u64 state;
+    u64 inc;
+};
+
+static inline u32 rng_next(Rng *rng)
+{
+    u64 old = rng->state;
+    rng->state = old * 6364136223846793005ull + rng->inc;
+    u32 xorshifted = (u32)(((old >> 18u) ^ old) >> 27u);
+    u32 rot = (u32)(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Different streams give unrelated sequences for the same seed, e.g. one per worker
+static inline Rng rng_make(u64 seed, u64 stream = 0)
+{
+    Rng rng = {0, (stream << 1u) | 1u};
+    rng_next(&rng);
+    rng.state += seed;
+    rng_next(&rng);
+    return rng;
+}
+
+// In [min, max], both inclusive like Python's randint. Multiply and shift, the bias is negligible for small spans.
+static inline int rng_range(Rng *rng, int min, int max)
+{
+    u32 span = (u32)(max - min) + 1;
+    return min + (int)(((u64)rng_next(rng) * span) >> 32);
+}
+
+// In [0, 1)
+static inline f32 rng_f32(Rng *rng)
+{
+    return (f32)(rng_next(rng) >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stb_image.h>
+
+#include "types.hpp"
+#include "util.hpp"
+
+#include "gl_tiles.cpp"
+#include "job_pool.cpp"
+
+/*
+ * Textures are decoded on the job pool and uploaded on the main thread by pump().
+ *
+ * Decoded pixels are cached on disk under TEX_CACHE_DIR, keyed by a hash of the
+ * source file's bytes and the flip flag. A later launch hashes the PNG, finds the
+ * cache file and maps it, so the only work left is reading and hashing the source.
+ * Editing the PNG changes the hash, stale cache files are just never hit again.
+ */
+
+namespace GLTiles
+{
+    #define TEX_CACHE_DIR "cache"
+    #define TEX_CACHE_MAGIC 0x31584554u // "TEX1"
+    #define TEX_LOADS_MAX 64
+
+    struct Tex_Cache_Header
+    {
+        u32 magic;
+        u32 w, h, ch;
+        u64 content_hash;
+    };
+
+    enum Tex_Load_State
+    {
+        TEX_LOAD_PENDING,
+        TEX_LOAD_DECODED,
+        TEX_LOAD_READY,
+        TEX_LOAD_FAILED,
+    };
+
+    struct Texture_Loader;
+
+    struct Tex_Load
+    {
+        Texture_Loader *loader;
+        int handle;
+
+        char path[STR_BUF_MED];
+        GLint sampling_type;
+        bool flip_vertically;
+
+        std::atomic<int> state;
+        Texture tex;
+
+        // Written by the worker, consumed by the upload on the main thread
+        u8 *pixels;
+        void *cache_map;
+        size_t cache_map_size;
+        bool from_cache;
+        double load_ms;
+    };
+
+    struct Texture_Loader
+    {
+        Job_Pool *pool = nullptr;
+        Tex_Load loads[TEX_LOADS_MAX];
+        int load_count = 0;
+
+        std::mutex ready_mutex;
+        std::vector<int> ready;
+
+        std::atomic<int> cache_hits{0};
+        std::atomic<int> cache_misses{0};
+
+        void init(Job_Pool *pool)
+        {
+            this->pool = pool;
+            mkdir(TEX_CACHE_DIR, 0755);
+        }
+
+        // Returns a handle, the texture reads as id 0 until pump() uploads it
+        int request(const char *path, GLint sampling_type, bool flip_vertically)
+        {
+            if (load_count >= TEX_LOADS_MAX)
+            {
+                warning("Out of texture loads, %s not loaded", path);
+                return -1;
+            }
+
+            int handle = load_count++;
+            Tex_Load *load = &loads[handle];
+            load->loader = this;
+            load->handle = handle;
+            snprintf(load->path, sizeof(load->path), "%s", path);
+            load->sampling_type = sampling_type;
+            load->flip_vertically = flip_vertically;
+            load->state.store(TEX_LOAD_PENDING);
+            load->tex = {};
+            load->pixels = nullptr;
+            load->cache_map = nullptr;
+            load->from_cache = false;
+
+            pool->push(load_job, load);
+            return handle;
+        }
+
+        Texture *get(int handle)
+        {
+            static Texture missing = {};
+            if (handle < 0 || handle >= load_count) return &missing;
+            return &loads[handle].tex;
+        }
+
+        bool is_ready(int handle)
+        {
+            return handle >= 0 && handle < load_count && loads[handle].state.load() == TEX_LOAD_READY;
+        }
+
+        // Main thread: uploads up to max_uploads decoded textures, returns how many are still in flight
+        int pump(int max_uploads)
+        {
+            std::vector<int> to_upload;
+            {
+                std::lock_guard<std::mutex> lock(ready_mutex);
+                int n = (int)ready.size() < max_uploads ? (int)ready.size() : max_uploads;
+                to_upload.assign(ready.begin(), ready.begin() + n);
+                ready.erase(ready.begin(), ready.begin() + n);
+            }
+
+            for (int handle : to_upload)
+            {
+                upload(&loads[handle]);
+            }
+
+            int in_flight = 0;
+            for (int i = 0; i < load_count; i++)
+            {
+                int state = loads[i].state.load();
+                if (state == TEX_LOAD_PENDING || state == TEX_LOAD_DECODED) in_flight++;
+            }
+            return in_flight;
+        }
+
+        // Blocks until every requested texture is decoded and uploaded
+        void finish_all()
+        {
+            pool->wait_idle();
+            pump(TEX_LOADS_MAX);
+        }
+
+        void upload(Tex_Load *load)
+        {
+            gl_upload_texture(&load->tex, load->pixels, load->sampling_type);
+
+            if (load->cache_map) munmap(load->cache_map, load->cache_map_size);
+            else stbi_image_free(load->pixels);
+            load->pixels = nullptr;
+            load->cache_map = nullptr;
+
+            load->state.store(TEX_LOAD_READY);
+            trace("Texture %s: %dx%d, %d ch, %s in %.2f ms", load->path, load->tex.w, load->tex.h, load->tex.ch,
+                load->from_cache ? "cache hit" : "decoded", load->load_ms);
+        }
+
+        void push_ready(int handle)
+        {
+            std::lock_guard<std::mutex> lock(ready_mutex);
+            ready.push_back(handle);
+        }
+
+        static u64 hash_bytes(const u8 *data, size_t size, u64 seed)
+        {
+            // FNV-1a over 8 byte words, the tail byte by byte
+            u64 hash = 14695981039346656037ull ^ seed;
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                u64 word;
+                memcpy(&word, data + i, 8);
+                hash = (hash ^ word) * 1099511628211ull;
+            }
+            for (; i < size; i++)
+            {
+                hash = (hash ^ data[i]) * 1099511628211ull;
+            }
+            return hash;
+        }
+
+        static void get_cache_path(u64 hash, char *buf, size_t buf_size)
+        {
+            snprintf(buf, buf_size, TEX_CACHE_DIR "/tex_%016llx.bin", (unsigned long long)hash);
+        }
+
+        static bool try_map_cache(Tex_Load *load, u64 hash)
+        {
+            char cache_path[STR_BUF_MED];
+            get_cache_path(hash, cache_path, sizeof(cache_path));
+
+            int fd = open(cache_path, O_RDONLY);
+            if (fd < 0) return false;
+
+            struct stat st;
+            if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Tex_Cache_Header))
+            {
+                close(fd);
+                return false;
+            }
+
+            size_t size = (size_t)st.st_size;
+            void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED) return false;
+
+            Tex_Cache_Header *header = (Tex_Cache_Header *)mapped;
+            size_t pixel_size = (size_t)header->w * header->h * header->ch;
+            if (header->magic != TEX_CACHE_MAGIC || header->content_hash != hash || size != sizeof(Tex_Cache_Header) + pixel_size)
+            {
+                warning("Ignoring bad texture cache file %s", cache_path);
+                munmap(mapped, size);
+                return false;
+            }
+
+            load->tex.w = (int)header->w;
+            load->tex.h = (int)header->h;
+            load->tex.ch = (int)header->ch;
+            load->pixels = (u8 *)mapped + sizeof(Tex_Cache_Header);
+            load->cache_map = mapped;
+            load->cache_map_size = size;
+            load->from_cache = true;
+            return true;
+        }
+
+        static void write_cache(Tex_Load *load, u64 hash)
+        {
+            char cache_path[STR_BUF_MED];
+            char tmp_path[STR_BUF_MED];
+            get_cache_path(hash, cache_path, sizeof(cache_path));
+            snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache_path, load->handle);
+
+            FILE *f = fopen(tmp_path, "wb");
+            if (!f)
+            {
+                warning("Can't write texture cache %s: %s", tmp_path, strerror(errno));
+                return;
+            }
+
+            Tex_Cache_Header header = {TEX_CACHE_MAGIC, (u32)load->tex.w, (u32)load->tex.h, (u32)load->tex.ch, hash};
+            size_t pixel_size = (size_t)load->tex.w * load->tex.h * load->tex.ch;
+            bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(load->pixels, 1, pixel_size, f) == pixel_size;
+            ok = fclose(f) == 0 && ok;
+
+            // Rename last, so a reader never maps a half written file
+            if (!ok || rename(tmp_path, cache_path) != 0)
+            {
+                warning("Can't write texture cache %s", cache_path);
+                unlink(tmp_path);
+            }
+        }
+
+        static void load_job(void *data)
+        {
+            Tex_Load *load = (Tex_Load *)data;
+            Texture_Loader *loader = load->loader;
+            auto start = std::chrono::steady_clock::now();
+
+            int fd = open(load->path, O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
+            {
+                warning("Can't open texture %s: %s", load->path, strerror(errno));
+                if (fd >= 0) close(fd);
+                load->state.store(TEX_LOAD_FAILED);
+                return;
+            }
+
+            size_t size = (size_t)st.st_size;
+            void *src = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (src == MAP_FAILED)
+            {
+                warning("Can't mmap texture %s: %s", load->path, strerror(errno));
+                load->state.store(TEX_LOAD_FAILED);
+                return;
+            }
+            madvise(src, size, MADV_SEQUENTIAL);
+
+            u64 hash = hash_bytes((const u8 *)src, size, load->flip_vertically ? 1 : 0);
+            if (try_map_cache(load, hash))
+            {
+                munmap(src, size);
+                loader->cache_hits++;
+            }
+            else
+            {
+                load->pixels = stbi_load_from_memory((const u8 *)src, (int)size, &load->tex.w, &load->tex.h, &load->tex.ch, 0);
+                munmap(src, size);
+                if (!load->pixels)
+                {
+                    warning("Can't decode texture %s: %s", load->path, stbi_failure_reason());
+                    load->state.store(TEX_LOAD_FAILED);
+                    return;
+                }
+                if (load->flip_vertically) flip_rows(load->pixels, load->tex.w, load->tex.h, load->tex.ch);
+                write_cache(load, hash);
+                loader->cache_misses++;
+            }
+
+            load->load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            load->state.store(TEX_LOAD_DECODED);
+            loader->push_ready(load->handle);
+        }
+    };
+}
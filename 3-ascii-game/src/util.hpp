@@ -14,6 +14,12 @@
 
 #define noop() do {} while (0)
 
+#define array_size(ARR) (sizeof((ARR))/sizeof((ARR[0])))
+
+#define STR_BUF_SMALL 64
+#define STR_BUF_MED 256
+#define STR_BUF_LARGE 1024
+
 static inline int truncate_to_int(f32 v)
 {
     return (int)v;
@@ -0,0 +1,462 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "types.hpp"
+
+#include "level.cpp"
+#include "proc_gen.cpp"
+#include "rng.cpp"
+
+/*
+ * Wave function collapse, overlapping model: every 3x3 window of a small hand
+ * drawn sample (wrapping, in all 8 rotations and mirrors) is a pattern, and the
+ * output is a grid of patterns where neighbors agree on their overlap. A cell's
+ * tile is its pattern's top left tile, the output wraps like the sample.
+ *
+ * - A cell's domain is a bitset of the patterns still possible there.
+ * - For each direction and pattern the set of patterns allowed next to it is
+ *   precomputed, and from those the union for every byte of a domain, so
+ *   propagating is ORing 8 table entries per domain word and ANDing that into
+ *   the neighbor, a word at a time.
+ * - Changed cells go on an explicit stack, no recursion.
+ * - Entropy is the number of patterns left. Undecided cells sit in one bucket
+ *   per count, so the next cell to collapse is a random one from the lowest
+ *   non empty bucket instead of a scan over the whole grid.
+ *
+ * A contradiction (a cell with nothing left) restarts from scratch with the
+ * next RNG stream, up to attempts_max times.
+ */
+
+#define WFC_N 3
+#define WFC_PATTERN_KEYS (1 << (WFC_N * WFC_N))
+
+// '#' is wall. Wraps both ways: the first row and column are the walls past the last.
+static const char *wfc_sample[] = {
+    "###.#######.###",
+    "#.....#........",
+    "#.....#........",
+    "...............",
+    "#.....#........",
+    "###.#####.#####",
+    "#.......#......",
+    "#.......#......",
+    "#..............",
+    "#.......#......",
+    "#.......#......",
+};
+
+enum Wfc_Dir
+{
+    WFC_LEFT,
+    WFC_RIGHT,
+    WFC_UP,
+    WFC_DOWN,
+    WFC_DIR_COUNT
+};
+
+static const int wfc_dir_dx[WFC_DIR_COUNT] = {-1, 1, 0, 0};
+static const int wfc_dir_dy[WFC_DIR_COUNT] = {0, 0, -1, 1};
+
+// A pattern is its 9 tiles as bits, bit row * WFC_N + col set for wall
+static inline bool wfc_key_get(u32 key, int col, int row)
+{
+    return (key >> (row * WFC_N + col)) & 1;
+}
+
+struct Wfc_Model
+{
+    int pattern_count;
+    int words; // per domain
+    std::vector<u32> keys;
+    std::vector<u32> weights; // times seen in the sample
+    std::vector<u64> allowed; // [dir][pattern][words]: patterns that can sit in that direction of pattern
+
+    // [dir][byte of a domain][byte value][words]: union of allowed over the patterns set in that byte,
+    // so the union over a whole domain is at most 8 lookups per word whatever is left in it.
+    // Bytes rather than nibbles: the table misses L1, but half the lookups still came out faster.
+    std::vector<u64> allowed_by_byte;
+
+    const u64 *get_allowed(int dir, int pattern)
+    {
+        return &allowed[((size_t)dir * pattern_count + pattern) * words];
+    }
+
+    void build()
+    {
+        int sample_rows = (int)array_size(wfc_sample);
+        int sample_cols = (int)strlen(wfc_sample[0]);
+
+        // Key to pattern index, -1 until seen
+        std::vector<int> index_of_key(WFC_PATTERN_KEYS, -1);
+        keys.clear();
+        weights.clear();
+        for (int y = 0; y < sample_rows; y++)
+        {
+            for (int x = 0; x < sample_cols; x++)
+            {
+                for (int symmetry = 0; symmetry < 8; symmetry++)
+                {
+                    u32 key = 0;
+                    for (int row = 0; row < WFC_N; row++)
+                    {
+                        for (int col = 0; col < WFC_N; col++)
+                        {
+                            // Rotate by a quarter turn per symmetry step, mirror for the second four
+                            int u = col;
+                            int v = row;
+                            for (int turn = 0; turn < (symmetry & 3); turn++)
+                            {
+                                int t = u;
+                                u = WFC_N - 1 - v;
+                                v = t;
+                            }
+                            if (symmetry & 4) u = WFC_N - 1 - u;
+                            char c = wfc_sample[(y + v) % sample_rows][(x + u) % sample_cols];
+                            if (c == '#') key |= 1u << (row * WFC_N + col);
+                        }
+                    }
+                    if (index_of_key[key] < 0)
+                    {
+                        index_of_key[key] = (int)keys.size();
+                        keys.push_back(key);
+                        weights.push_back(0);
+                    }
+                    weights[index_of_key[key]]++;
+                }
+            }
+        }
+
+        pattern_count = (int)keys.size();
+        words = (pattern_count + 63) / 64;
+        allowed.assign((size_t)WFC_DIR_COUNT * pattern_count * words, 0);
+        for (int dir = 0; dir < WFC_DIR_COUNT; dir++)
+        {
+            int dx = wfc_dir_dx[dir];
+            int dy = wfc_dir_dy[dir];
+            for (int p = 0; p < pattern_count; p++)
+            {
+                u64 *mask = &allowed[((size_t)dir * pattern_count + p) * words];
+                for (int q = 0; q < pattern_count; q++)
+                {
+                    // q sits at (dx, dy) from p, they have to agree where they overlap
+                    bool agrees = true;
+                    for (int row = 0; row < WFC_N && agrees; row++)
+                    {
+                        for (int col = 0; col < WFC_N && agrees; col++)
+                        {
+                            int q_col = col - dx;
+                            int q_row = row - dy;
+                            if (q_col < 0 || q_row < 0 || q_col >= WFC_N || q_row >= WFC_N) continue;
+                            agrees = wfc_key_get(keys[p], col, row) == wfc_key_get(keys[q], q_col, q_row);
+                        }
+                    }
+                    if (agrees) mask[q >> 6] |= 1ull << (q & 63);
+                }
+            }
+        }
+
+        int byte_count = words * 8;
+        allowed_by_byte.assign((size_t)WFC_DIR_COUNT * byte_count * 256 * words, 0);
+        for (int dir = 0; dir < WFC_DIR_COUNT; dir++)
+        {
+            for (int byte = 0; byte < byte_count; byte++)
+            {
+                for (int value = 1; value < 256; value++)
+                {
+                    // Lowest bit's pattern plus the entry without it, already filled in
+                    int pattern = byte * 8 + __builtin_ctz(value);
+                    u64 *out = get_allowed_by_byte(dir, byte, value);
+                    const u64 *rest = get_allowed_by_byte(dir, byte, value & (value - 1));
+                    for (int i = 0; i < words; i++)
+                    {
+                        out[i] = rest[i] | (pattern < pattern_count ? get_allowed(dir, pattern)[i] : 0);
+                    }
+                }
+            }
+        }
+    }
+
+    u64 *get_allowed_by_byte(int dir, int byte, int value)
+    {
+        return &allowed_by_byte[(((size_t)dir * words * 8 + byte) * 256 + value) * words];
+    }
+};
+
+struct Wfc_Params
+{
+    u64 seed;
+    int cols, rows;
+    int attempts_max;
+};
+
+struct Wfc_Result
+{
+    v2i spawn;
+    int attempts;
+    bool is_complete; // false if every attempt hit a contradiction, the level is then left as it was
+    int pattern_count;
+    f32 fill_rate;
+};
+
+struct Wfc_Solver
+{
+    Wfc_Model *model;
+    int cols, rows;
+    int words;
+
+    std::vector<u64> domains; // [cell][words]
+    std::vector<u16> counts; // patterns left per cell
+
+    // Undecided cells by count, bucket_slots is each cell's index in its bucket
+    std::vector<std::vector<u32>> buckets;
+    std::vector<u32> bucket_slots;
+    int lowest_bucket; // no non empty bucket below this
+
+    std::vector<u32> stack;
+    std::vector<u8> is_on_stack;
+
+    std::vector<u64> scratch; // one domain
+
+    void init(Wfc_Model *model, int cols, int rows)
+    {
+        this->model = model;
+        this->cols = cols;
+        this->rows = rows;
+        words = model->words;
+        size_t cell_count = (size_t)cols * rows;
+        domains.resize(cell_count * words);
+        counts.resize(cell_count);
+        buckets.resize(model->pattern_count + 1);
+        bucket_slots.resize(cell_count);
+        is_on_stack.resize(cell_count);
+        scratch.resize(words);
+    }
+
+    void reset()
+    {
+        int pattern_count = model->pattern_count;
+        u32 cell_count = (u32)cols * rows;
+        for (int i = 0; i < words; i++)
+        {
+            int bits = pattern_count - i * 64;
+            scratch[i] = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+        }
+        for (u32 cell = 0; cell < cell_count; cell++)
+        {
+            memcpy(&domains[(size_t)cell * words], scratch.data(), words * sizeof(u64));
+            counts[cell] = (u16)pattern_count;
+        }
+        for (std::vector<u32> &bucket : buckets) bucket.clear();
+        std::vector<u32> &full = buckets[pattern_count];
+        full.resize(cell_count);
+        for (u32 cell = 0; cell < cell_count; cell++)
+        {
+            full[cell] = cell;
+            bucket_slots[cell] = cell;
+        }
+        lowest_bucket = 2;
+        stack.clear();
+        memset(is_on_stack.data(), 0, is_on_stack.size());
+    }
+
+    void bucket_remove(u32 cell, int count)
+    {
+        std::vector<u32> &bucket = buckets[count];
+        u32 slot = bucket_slots[cell];
+        u32 moved = bucket.back();
+        bucket[slot] = moved;
+        bucket_slots[moved] = slot;
+        bucket.pop_back();
+    }
+
+    // Only undecided cells (2 or more patterns) are in a bucket
+    void set_count(u32 cell, int count)
+    {
+        int old_count = counts[cell];
+        if (old_count >= 2) bucket_remove(cell, old_count);
+        counts[cell] = (u16)count;
+        if (count >= 2)
+        {
+            bucket_slots[cell] = (u32)buckets[count].size();
+            buckets[count].push_back(cell);
+            if (count < lowest_bucket) lowest_bucket = count;
+        }
+    }
+
+    void push(u32 cell)
+    {
+        if (is_on_stack[cell]) return;
+        is_on_stack[cell] = 1;
+        stack.push_back(cell);
+    }
+
+    // False on a contradiction
+    bool propagate()
+    {
+        while (!stack.empty())
+        {
+            u32 cell = stack.back();
+            stack.pop_back();
+            is_on_stack[cell] = 0;
+            const u64 *domain = &domains[(size_t)cell * words];
+            int x = (int)(cell % cols);
+            int y = (int)(cell / cols);
+            for (int dir = 0; dir < WFC_DIR_COUNT; dir++)
+            {
+                int nx = x + wfc_dir_dx[dir];
+                int ny = y + wfc_dir_dy[dir];
+                nx = nx < 0 ? cols - 1 : (nx >= cols ? 0 : nx);
+                ny = ny < 0 ? rows - 1 : (ny >= rows ? 0 : ny);
+                u32 neighbor = (u32)ny * cols + nx;
+                u64 *neighbor_domain = &domains[(size_t)neighbor * words];
+
+                // A decided neighbor that already propagated narrowed this cell down to patterns that allow it,
+                // adjacency is symmetric, so it can't lose anything
+                if (counts[neighbor] == 1 && !is_on_stack[neighbor]) continue;
+
+                // The neighbor keeps what some pattern left here allows
+                u64 *narrowed = scratch.data();
+                memset(narrowed, 0, words * sizeof(u64));
+                for (int i = 0; i < words; i++)
+                {
+                    for (int byte = 0; byte < 8; byte++)
+                    {
+                        int value = (int)(domain[i] >> (byte * 8)) & 0xFF;
+                        if (!value) continue;
+                        const u64 *byte_allowed = model->get_allowed_by_byte(dir, i * 8 + byte, value);
+                        for (int j = 0; j < words; j++) narrowed[j] |= byte_allowed[j];
+                    }
+                }
+                for (int i = 0; i < words; i++) narrowed[i] &= neighbor_domain[i];
+
+                int count = 0;
+                bool is_changed = false;
+                for (int i = 0; i < words; i++)
+                {
+                    is_changed |= narrowed[i] != neighbor_domain[i];
+                    neighbor_domain[i] = narrowed[i];
+                    count += __builtin_popcountll(narrowed[i]);
+                }
+                if (!is_changed) continue;
+                if (count == 0) return false;
+                set_count(neighbor, count);
+                push(neighbor);
+            }
+        }
+        return true;
+    }
+
+    // Random cell of the fewest patterns left, -1 when every cell is decided
+    i64 pick_cell(Rng *rng)
+    {
+        for (; lowest_bucket <= model->pattern_count; lowest_bucket++)
+        {
+            std::vector<u32> &bucket = buckets[lowest_bucket];
+            if (!bucket.empty()) return bucket[rng_range(rng, 0, (int)bucket.size() - 1)];
+        }
+        return -1;
+    }
+
+    // Picks one of the cell's patterns by sample frequency
+    void collapse(u32 cell, Rng *rng)
+    {
+        u64 *domain = &domains[(size_t)cell * words];
+        u32 total = 0;
+        for (int i = 0; i < words; i++)
+        {
+            for (u64 bits = domain[i]; bits; bits &= bits - 1) total += model->weights[i * 64 + __builtin_ctzll(bits)];
+        }
+        u32 pick = (u32)(((u64)rng_next(rng) * total) >> 32);
+        int chosen = -1;
+        for (int i = 0; i < words && chosen < 0; i++)
+        {
+            for (u64 bits = domain[i]; bits; bits &= bits - 1)
+            {
+                int pattern = i * 64 + __builtin_ctzll(bits);
+                if (pick < model->weights[pattern])
+                {
+                    chosen = pattern;
+                    break;
+                }
+                pick -= model->weights[pattern];
+            }
+        }
+        memset(domain, 0, words * sizeof(u64));
+        domain[chosen >> 6] = 1ull << (chosen & 63);
+        set_count(cell, 1);
+        push(cell);
+    }
+
+    bool run(Rng *rng)
+    {
+        reset();
+        for (;;)
+        {
+            i64 cell = pick_cell(rng);
+            if (cell < 0) return true;
+            collapse((u32)cell, rng);
+            if (!propagate()) return false;
+        }
+    }
+
+    int get_pattern(u32 cell)
+    {
+        const u64 *domain = &domains[(size_t)cell * words];
+        for (int i = 0; i < words; i++)
+        {
+            if (domain[i]) return i * 64 + __builtin_ctzll(domain[i]);
+        }
+        return 0;
+    }
+};
+
+// Runs the solver into grid, set bits are wall. False if every attempt ran into a contradiction.
+static bool wfc_run(Wfc_Model *model, const Wfc_Params *params, Bit_Grid *grid, int *attempts)
+{
+    Wfc_Solver solver;
+    solver.init(model, params->cols, params->rows);
+    for (*attempts = 1; *attempts <= params->attempts_max; (*attempts)++)
+    {
+        Rng rng = rng_make(params->seed, (u64)*attempts);
+        if (!solver.run(&rng)) continue;
+
+        bit_grid_init(grid, params->cols, params->rows, true);
+        for (int row = 0; row < params->rows; row++)
+        {
+            for (int col = 0; col < params->cols; col++)
+            {
+                u32 key = model->keys[solver.get_pattern((u32)row * params->cols + col)];
+                bit_grid_set(grid, col, row, wfc_key_get(key, 0, 0));
+            }
+        }
+        return true;
+    }
+    *attempts = params->attempts_max;
+    return false;
+}
+
+Wfc_Result generate_wfc(Level *level, const Wfc_Params *params)
+{
+    Wfc_Result result = {};
+    Wfc_Model model;
+    model.build();
+    result.pattern_count = model.pattern_count;
+
+    Bit_Grid grid;
+    result.is_complete = wfc_run(&model, params, &grid, &result.attempts);
+    if (!result.is_complete) return result;
+
+    // The output wraps, the level doesn't
+    bit_grid_set_border(&grid, true);
+    result.spawn = bit_grid_find_clear_near_center(&grid);
+
+    i64 grid_tiles = (i64)grid.words_per_row * CHUNK_DIM * grid.word_rows;
+    result.fill_rate = (f32)(grid_tiles - bit_grid_count(&grid)) / (f32)((i64)params->cols * params->rows);
+
+    level_write_bit_grid(level, &grid, (MapTile){MAP_TILE_WALL, true, true}, (MapTile){MAP_TILE_GROUND, false, false});
+    bit_grid_free(&grid);
+    return result;
+}
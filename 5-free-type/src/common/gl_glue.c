@@ -1,5 +1,7 @@
 #include "gl_glue.h"
 
+#include <string.h>
+
 #include <OpenGL/gl3.h>
 
 #include "types.h"
@@ -66,3 +68,290 @@ GLuint glg__create_shader_program(const char *vs_src, const char *fs_src)
 
     return prog;
 }
+
+static bool glg__has_buffer_storage()
+{
+#ifdef GL_MAP_PERSISTENT_BIT
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return major > 4 || (major == 4 && minor >= 4);
+#else
+    return false;
+#endif
+}
+
+GlgStream glg__stream_create(GLenum target, size_t partition_size)
+{
+    GlgStream s = {};
+    s.target = target;
+    s.partition_size = partition_size;
+    size_t total_size = partition_size * GLG_STREAM_PARTITIONS;
+
+    glGenBuffers(1, &s.buffer);
+    glg__bind_buffer(target, s.buffer);
+#ifdef GL_MAP_PERSISTENT_BIT
+    if (glg__has_buffer_storage())
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, total_size, NULL, flags);
+        s.persistent = glMapBufferRange(target, 0, total_size, flags);
+        if (!s.persistent) warning("Persistent map failed, falling back to glMapBufferRange per frame");
+    }
+    if (!s.persistent)
+#endif
+    {
+        glBufferData(target, total_size, NULL, GL_STREAM_DRAW);
+    }
+    return s;
+}
+
+void glg__stream_destroy(GlgStream *s)
+{
+    for (int i = 0; i < GLG_STREAM_PARTITIONS; i++)
+    {
+        if (s->fences[i]) glDeleteSync(s->fences[i]);
+    }
+    if (s->persistent || s->mapped)
+    {
+        glg__bind_buffer(s->target, s->buffer);
+        glUnmapBuffer(s->target);
+    }
+    glDeleteBuffers(1, &s->buffer);
+    glg__state_forget();
+    *s = (GlgStream){};
+}
+
+size_t glg__stream_offset(const GlgStream *s)
+{
+    return s->partition_size * s->partition;
+}
+
+static void glg__stream_wait(GlgStream *s)
+{
+    GLsync fence = s->fences[s->partition];
+    if (!fence) return;
+
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        s->stall_count++;
+        do
+        {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        } while (result == GL_TIMEOUT_EXPIRED);
+    }
+    if (result == GL_WAIT_FAILED) warning("glClientWaitSync failed");
+
+    glDeleteSync(fence);
+    s->fences[s->partition] = 0;
+}
+
+// Returns the current partition's memory, valid until glg__stream_unmap()
+void *glg__stream_map(GlgStream *s)
+{
+    if (s->mapped) return s->mapped;
+
+    glg__stream_wait(s);
+    if (s->persistent)
+    {
+        s->mapped = s->persistent + glg__stream_offset(s);
+    }
+    else
+    {
+        glg__bind_buffer(s->target, s->buffer);
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        s->mapped = glMapBufferRange(s->target, glg__stream_offset(s), s->partition_size, flags);
+        if (!s->mapped) warning("glMapBufferRange failed");
+    }
+    return s->mapped;
+}
+
+void glg__stream_unmap(GlgStream *s)
+{
+    if (!s->mapped) return;
+    if (!s->persistent)
+    {
+        glg__bind_buffer(s->target, s->buffer);
+        glUnmapBuffer(s->target);
+    }
+    s->mapped = NULL;
+}
+
+// Call after the draws that read the current partition, moves on to the next one
+void glg__stream_fence(GlgStream *s)
+{
+    s->fences[s->partition] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s->partition = (s->partition + 1) % GLG_STREAM_PARTITIONS;
+}
+
+globvar GLuint glg__quad_ebo = 0;
+
+void glg__bind_quad_indices()
+{
+    if (glg__quad_ebo)
+    {
+        glg__bind_buffer(GL_ELEMENT_ARRAY_BUFFER, glg__quad_ebo);
+        return;
+    }
+
+    size_t size = GLG_QUAD_MAX * 6 * sizeof(u16);
+    u16 *indices = xmalloc(size);
+    for (int quad = 0; quad < GLG_QUAD_MAX; quad++)
+    {
+        u16 base = (u16)(quad * 4);
+        u16 *out = indices + quad * 6;
+        out[0] = base + 0; out[1] = base + 1; out[2] = base + 2;
+        out[3] = base + 0; out[4] = base + 2; out[5] = base + 3;
+    }
+
+    glGenBuffers(1, &glg__quad_ebo);
+    glg__bind_buffer(GL_ELEMENT_ARRAY_BUFFER, glg__quad_ebo);
+#ifdef GL_MAP_PERSISTENT_BIT
+    if (glg__has_buffer_storage())
+    {
+        glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, size, indices, 0);
+    }
+    else
+#endif
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
+    }
+    free(indices);
+}
+
+#define GLG_STATE_UNKNOWN 0xFFFFFFFFu
+#define GLG_UNIFORM_CACHE_SIZE 256
+
+typedef struct GlgUniformEntry
+{
+    GLuint program;
+    const char *name;
+    GLint location;
+} GlgUniformEntry;
+
+typedef struct GlgState
+{
+    // GL starts out with everything bound to 0, which is what zero init says
+    GLuint program;
+    GLuint vao;
+    GLuint array_buffer;
+    GLuint element_buffer;
+    GLuint active_unit;
+    GLuint textures[GLG_STATE_TEXTURE_UNITS];
+
+    GlgStateStats this_frame;
+
+    GlgUniformEntry uniforms[GLG_UNIFORM_CACHE_SIZE];
+} GlgState;
+
+globvar GlgState glg__state;
+
+void glg__state_forget()
+{
+    glg__state.program = GLG_STATE_UNKNOWN;
+    glg__state.vao = GLG_STATE_UNKNOWN;
+    glg__state.array_buffer = GLG_STATE_UNKNOWN;
+    glg__state.element_buffer = GLG_STATE_UNKNOWN;
+    glg__state.active_unit = GLG_STATE_UNKNOWN;
+    for (int i = 0; i < GLG_STATE_TEXTURE_UNITS; i++)
+    {
+        glg__state.textures[i] = GLG_STATE_UNKNOWN;
+    }
+}
+
+GlgStateStats glg__state_begin_frame()
+{
+    GlgStateStats last_frame = glg__state.this_frame;
+    glg__state.this_frame = (GlgStateStats){};
+    return last_frame;
+}
+
+// Returns true if the bind has to go to GL, counts it either way
+static bool glg__state_update(GLuint *cached, GLuint value)
+{
+    if (*cached == value)
+    {
+        glg__state.this_frame.skipped++;
+        return false;
+    }
+    *cached = value;
+    glg__state.this_frame.binds++;
+    return true;
+}
+
+void glg__use_program(GLuint program)
+{
+    if (glg__state_update(&glg__state.program, program)) glUseProgram(program);
+}
+
+void glg__bind_vao(GLuint vao)
+{
+    if (glg__state_update(&glg__state.vao, vao))
+    {
+        glBindVertexArray(vao);
+        // The element buffer binding belongs to the VAO
+        glg__state.element_buffer = GLG_STATE_UNKNOWN;
+    }
+}
+
+void glg__bind_buffer(GLenum target, GLuint buffer)
+{
+    GLuint *cached = NULL;
+    if (target == GL_ARRAY_BUFFER) cached = &glg__state.array_buffer;
+    else if (target == GL_ELEMENT_ARRAY_BUFFER) cached = &glg__state.element_buffer;
+
+    if (!cached)
+    {
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (glg__state_update(cached, buffer)) glBindBuffer(target, buffer);
+}
+
+void glg__bind_texture(int unit, GLuint texture)
+{
+    if (unit < 0 || unit >= GLG_STATE_TEXTURE_UNITS)
+    {
+        warning("Texture unit %d is past GLG_STATE_TEXTURE_UNITS", unit);
+        return;
+    }
+    if (glg__state.textures[unit] == texture)
+    {
+        glg__state.this_frame.skipped++;
+        return;
+    }
+    if (glg__state_update(&glg__state.active_unit, (GLuint)unit)) glActiveTexture(GL_TEXTURE0 + unit);
+    glg__state.textures[unit] = texture;
+    glg__state.this_frame.binds++;
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+GLint glg__uniform_location(GLuint program, const char *name)
+{
+    u32 hash = 2166136261u ^ program;
+    for (const char *c = name; *c; c++)
+    {
+        hash = (hash ^ (u8)*c) * 16777619u;
+    }
+
+    for (int probe = 0; probe < GLG_UNIFORM_CACHE_SIZE; probe++)
+    {
+        GlgUniformEntry *e = &glg__state.uniforms[(hash + probe) % GLG_UNIFORM_CACHE_SIZE];
+        if (!e->name)
+        {
+            e->program = program;
+            e->name = name;
+            e->location = glGetUniformLocation(program, name);
+            if (e->location < 0) warning("Uniform %s not found in program %u", name, program);
+            return e->location;
+        }
+        if (e->program == program && strcmp(e->name, name) == 0)
+        {
+            return e->location;
+        }
+    }
+
+    warning("Uniform cache is full");
+    return glGetUniformLocation(program, name);
+}
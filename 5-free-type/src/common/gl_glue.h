@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #include <OpenGL/gl3.h>
 
 #include "types.h"
@@ -10,3 +12,63 @@ void glg__clear(v4 c);
 bool glg__check_compile_success(GLuint shader, const char *src);
 bool glg__check_link_success(GLuint prog);
 GLuint glg__create_shader_program(const char *vs_src, const char *fs_src);
+
+/*
+ * Streaming buffer: a ring of GLG_STREAM_PARTITIONS partitions written straight from the CPU.
+ * A partition is reused only after the fence placed behind its draws signals, so maps are
+ * unsynchronized. Persistently mapped when ARB_buffer_storage is available.
+ */
+#define GLG_STREAM_PARTITIONS 3
+
+typedef struct GlgStream
+{
+    GLenum target;
+    GLuint buffer;
+    size_t partition_size;
+    int partition;
+    GLsync fences[GLG_STREAM_PARTITIONS];
+    u8 *persistent;
+    u8 *mapped;
+    int stall_count;
+} GlgStream;
+
+// Leaves the buffer bound to target
+GlgStream glg__stream_create(GLenum target, size_t partition_size);
+void glg__stream_destroy(GlgStream *s);
+size_t glg__stream_offset(const GlgStream *s);
+void *glg__stream_map(GlgStream *s);
+void glg__stream_unmap(GlgStream *s);
+void glg__stream_fence(GlgStream *s);
+
+/*
+ * Shared quad indices: quads are 4 verts a-b-c-d around the edge, drawn with one immutable
+ * {0, 1, 2, 0, 2, 3} pattern built on first use. 16 bit indices, so one draw covers at most
+ * GLG_QUAD_MAX quads.
+ */
+#define GLG_QUAD_MAX 16384
+
+// Binds the quad indices as the current VAO's element buffer
+void glg__bind_quad_indices();
+
+/*
+ * GL state cache: binds are skipped when the object is already bound, uniform locations
+ * are looked up once per (program, name). Call glg__state_forget() after deleting bound
+ * objects or when other code touched GL state.
+ */
+#define GLG_STATE_TEXTURE_UNITS 32
+
+typedef struct GlgStateStats
+{
+    int binds;
+    int skipped;
+} GlgStateStats;
+
+void glg__state_forget();
+// Rolls the per-frame bind counters over, returns last frame's
+GlgStateStats glg__state_begin_frame();
+void glg__use_program(GLuint program);
+void glg__bind_vao(GLuint vao);
+void glg__bind_buffer(GLenum target, GLuint buffer);
+void glg__bind_texture(int unit, GLuint texture);
+// The name is kept, pass string literals
+GLint glg__uniform_location(GLuint program, const char *name);
@@ -4,6 +4,7 @@
 #include <OpenGL/gl3.h>
 #include <GLFW/glfw3.h>
 
+#include "common/gl_glue.h"
 #include "common/types.h"
 #include "common/util.h"
 
@@ -23,6 +24,8 @@ void init()
 
 void frame()
 {
+    GlgStateStats gl_stats = glg__state_begin_frame();
+
     const int starting_ch = 32;
     const int last_ch = 127;
 
@@ -32,6 +35,11 @@ void frame()
     const char *text = "LIA, I love you :)\n    - Andrey";
     tr_draw_string(text, &pen_x, &pen_y);
 
+    char stats[64];
+    snprintf(stats, sizeof(stats), "\n\nGL binds: %d, skipped: %d", gl_stats.binds, gl_stats.skipped);
+    pen_x = 5.0f;
+    tr_draw_string(stats, &pen_x, &pen_y);
+
     int width;
     int height;
     glfwGetWindowSize(window, &width, &height);
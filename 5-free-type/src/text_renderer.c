@@ -12,15 +12,11 @@
 #include "font_loader.h"
 
 #define ATLAS_TEXTURE_UNIT 0
-#define ATLAS_TEXTURE_UNIT_ENUM (GL_TEXTURE0 + ATLAS_TEXTURE_UNIT)
 
 #define MAX_QUADS 1024
-#define MAX_INDICES (MAX_QUADS * 6)
 #define VERT_SIZE (sizeof(struct Vert))
 #define QUAD_SIZE (sizeof(struct Quad))
 #define QUAD_BUF_SIZE (MAX_QUADS * QUAD_SIZE)
-#define IND_SIZE (sizeof(ind_buf[0]))
-#define IND_BUF_SIZE (MAX_INDICES * IND_SIZE)
 
 #define ATLAS_PATH "res/ui_atlas.png"
 #define ATLAS_DIM 1024.0f
@@ -42,14 +38,13 @@ struct Quad
 globvar GLuint shader_program;
 globvar GLint shader_loc_uMvp = 0;
 globvar GLint shader_loc_uTex = 0;
-globvar GLuint vao, vbo, ebo;
+globvar GLuint vao;
+globvar GlgStream quad_stream;
 
-globvar struct Quad quad_buf[MAX_QUADS];
+// Points into the mapped stream partition from the first tr_draw() of a frame until tr_render()
+globvar struct Quad *quad_buf = NULL;
 globvar size_t quad_count = 0;
 
-globvar u32 ind_buf[MAX_INDICES];
-globvar size_t ind_count = 0;
-
 globvar FontAtlas font_atlas;
 globvar GLuint atlas_tex;
 
@@ -80,14 +75,6 @@ static const char* fs_src =
     "    FragColor = vec4(Color.rgb, Color.a * t);\n"
     "}\n";
 
-static void _add_indices(u32 base, u32 *indices, int count)
-{
-    for (int i = 0; i < count; i++)
-    {
-        ind_buf[ind_count++] = base + indices[i];
-    }
-}
-
 static void _get_atlas_q_verts(v2i cell_p, v2 out_verts[4])
 {
     f32 min_x = cell_p.x * ATLAS_CELL_DIM;
@@ -125,24 +112,20 @@ void tr_init()
 
     shader_program = glg__create_shader_program(vs_src, fs_src);
 
-    glUseProgram(shader_program);
-    shader_loc_uMvp = glGetUniformLocation(shader_program, "uMvp");
-    shader_loc_uTex = glGetUniformLocation(shader_program, "uTex");
+    glg__use_program(shader_program);
+    shader_loc_uMvp = glg__uniform_location(shader_program, "uMvp");
+    shader_loc_uTex = glg__uniform_location(shader_program, "uTex");
     glUniformMatrix4fv(shader_loc_uMvp, 1, GL_FALSE, m4_identity().d);
     glUniform1i(shader_loc_uTex, ATLAS_TEXTURE_UNIT);
 
-    glUseProgram(0);
+    glg__use_program(0);
 
     glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-    
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, QUAD_BUF_SIZE, NULL, GL_DYNAMIC_DRAW);
+    glg__bind_vao(vao);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, QUAD_BUF_SIZE, NULL, GL_DYNAMIC_DRAW);
+    // Partitions hold whole quads, so a partition starts at base vertex offset / VERT_SIZE
+    quad_stream = glg__stream_create(GL_ARRAY_BUFFER, QUAD_BUF_SIZE);
+    glg__bind_quad_indices();
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, VERT_SIZE, (void*)0);
     glEnableVertexAttribArray(0);
@@ -153,25 +136,18 @@ void tr_init()
     glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, VERT_SIZE, (void*)offsetof(struct Vert, color));
     glEnableVertexAttribArray(2);
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glg__bind_vao(0);
+    glg__bind_buffer(GL_ARRAY_BUFFER, 0);
 }
 
 void tr_init_tex_from_px(void *pixels, int width, int height)
 {
     glGenTextures(1, &atlas_tex);
-    glActiveTexture(GL_TEXTURE31); // Do texture init on unit 31, to not mess up already setup textures
-    glBindTexture(GL_TEXTURE_2D, atlas_tex);
+    glg__bind_texture(ATLAS_TEXTURE_UNIT, atlas_tex);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glActiveTexture(ATLAS_TEXTURE_UNIT_ENUM);
-    glBindTexture(GL_TEXTURE_2D, atlas_tex);
 }
 
 void tr_init_atlas(FontAtlas atlas)
@@ -188,7 +164,11 @@ void tr_draw(v2 a, v2 b, v2 c, v2 d, v2 t_a, v2 t_b, v2 t_c, v2 t_d, v4 color)
         return;
     }
 
-    int ind_base = quad_count * 4;
+    if (!quad_buf)
+    {
+        quad_buf = glg__stream_map(&quad_stream);
+        if (!quad_buf) return;
+    }
 
     // v2 atlas_q_verts[4];
     // _get_atlas_q_verts(V2I(0, 0), atlas_q_verts);
@@ -206,8 +186,6 @@ void tr_draw(v2 a, v2 b, v2 c, v2 d, v2 t_a, v2 t_b, v2 t_c, v2 t_d, v4 color)
         (struct Vert){c, atlas_q_verts[2], color},
         (struct Vert){d, atlas_q_verts[3], color},
     };
-
-    _add_indices(ind_base, (u32[]){0, 1, 2, 0, 2, 3}, 6);
 }
 
 void tr_draw_glyph(unsigned char ch, f32 *pen_x, f32 *pen_y)
@@ -278,22 +256,22 @@ v2 tr_get_string_dim(const char *str)
 
 void tr_render(v2 window_size)
 {
-    glUseProgram(shader_program);
+    glg__use_program(shader_program);
+    glg__bind_texture(ATLAS_TEXTURE_UNIT, atlas_tex);
     m4 proj = m4_proj_ortho(0.0f, window_size.x, window_size.y, 0.0f, -1.0f, 1.0f);
 
     glUniformMatrix4fv(shader_loc_uMvp, 1, GL_FALSE, proj.d);
 
-    glBindVertexArray(vao);
+    glg__bind_vao(vao);
+
+    if (!quad_buf) return;
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, QUAD_BUF_SIZE, NULL, GL_DYNAMIC_DRAW); // orphan
-    glBufferSubData(GL_ARRAY_BUFFER, 0, quad_count * QUAD_SIZE, quad_buf);
+    glg__stream_unmap(&quad_stream);
+    quad_buf = NULL;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, IND_BUF_SIZE, NULL, GL_DYNAMIC_DRAW); // orphan
-    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, ind_count * IND_SIZE, ind_buf);
+    GLint base_vertex = (GLint)(glg__stream_offset(&quad_stream) / VERT_SIZE);
+    glDrawElementsBaseVertex(GL_TRIANGLES, quad_count * 6, GL_UNSIGNED_SHORT, 0, base_vertex);
 
-    glDrawElements(GL_TRIANGLES, ind_count, GL_UNSIGNED_INT, 0);
+    glg__stream_fence(&quad_stream);
     quad_count = 0;
-    ind_count = 0;
 }
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <vector>
+
+#include "slab_pool.cpp"
+#include "util.hpp"
+
+/*
+ * Coroutine behaviors. A Behavior_Task suspends on one thing at a time: a timer
+ * or a wait list. The scheduler only resumes coroutines whose timer expired or
+ * whose wait list was woken, so a sleeping behavior costs nothing per tick.
+ *
+ * Tasks are not RAII, whoever starts one cancels it with Behavior_Scheduler::cancel().
+ *
+ * Frames come out of one pool per size class, so a frame only takes the block
+ * its coroutine actually needs rounded up to the class.
+ */
+
+#define BEHAVIOR_FRAME_CLASS_SIZE 64
+#define BEHAVIOR_FRAME_CLASSES 8 // frames over BEHAVIOR_FRAME_CLASS_SIZE * BEHAVIOR_FRAME_CLASSES bytes go to malloc
+#define BEHAVIOR_FRAMES_PER_SLAB 1024
+#define BEHAVIOR_NO_LIST -1
+#define BEHAVIOR_READY_LIST 0
+#define BEHAVIOR_TIMER_LIST -2
+
+struct Behavior_Wait
+{
+    std::coroutine_handle<> handle;
+    Behavior_Wait *prev;
+    Behavior_Wait *next;
+    int list_id;
+    int heap_index;
+    double wake_time;
+};
+
+struct Behavior_Wait_List
+{
+    Behavior_Wait *head;
+    Behavior_Wait *tail;
+    int count;
+};
+
+// Coroutine frames by size class, the simulation runs behaviors on a single thread
+static Slab_Pool g_behavior_frame_pools[BEHAVIOR_FRAME_CLASSES];
+
+static void behavior_free_frame_pools()
+{
+    for (int i = 0; i < BEHAVIOR_FRAME_CLASSES; i++)
+    {
+        g_behavior_frame_pools[i].free_all();
+    }
+}
+
+static size_t behavior_get_frame_bytes()
+{
+    size_t bytes = 0;
+    for (int i = 0; i < BEHAVIOR_FRAME_CLASSES; i++)
+    {
+        bytes += g_behavior_frame_pools[i].get_reserved_bytes();
+    }
+    return bytes;
+}
+
+struct Behavior_Task
+{
+    struct promise_type
+    {
+        Behavior_Wait wait = {};
+
+        Behavior_Task get_return_object()
+        {
+            return Behavior_Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        // Without get_return_object_on_allocation_failure() a coroutine can't start on null, so running out is fatal
+        static void *operator new(size_t size)
+        {
+            size_t size_class = (size - 1) / BEHAVIOR_FRAME_CLASS_SIZE;
+            void *frame;
+            if (size_class >= BEHAVIOR_FRAME_CLASSES)
+            {
+                frame = malloc(size);
+            }
+            else
+            {
+                Slab_Pool *pool = &g_behavior_frame_pools[size_class];
+                if (pool->block_size == 0)
+                {
+                    pool->init((size_class + 1) * BEHAVIOR_FRAME_CLASS_SIZE, BEHAVIOR_FRAMES_PER_SLAB);
+                }
+                frame = pool->alloc();
+            }
+            if (!frame)
+            {
+                warning("Out of memory for a %zu byte behavior frame", size);
+                abort();
+            }
+            return frame;
+        }
+
+        static void operator delete(void *ptr, size_t size)
+        {
+            size_t size_class = (size - 1) / BEHAVIOR_FRAME_CLASS_SIZE;
+            if (size_class >= BEHAVIOR_FRAME_CLASSES) free(ptr);
+            else g_behavior_frame_pools[size_class].release(ptr);
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+typedef std::coroutine_handle<Behavior_Task::promise_type> Behavior_Handle;
+
+struct Behavior_Scheduler
+{
+    double now = 0.0;
+
+    // [BEHAVIOR_READY_LIST] holds woken coroutines until the next run()
+    std::vector<Behavior_Wait_List> lists;
+    std::vector<Behavior_Wait *> timers;
+
+    u64 resumed_count = 0;
+    int live_count = 0;
+
+    struct Sleep_Awaiter
+    {
+        Behavior_Scheduler *scheduler;
+        f32 duration;
+
+        bool await_ready() { return duration <= 0.0f; }
+        void await_suspend(Behavior_Handle h) { scheduler->add_timer(&h.promise().wait, scheduler->now + duration); }
+        void await_resume() {}
+    };
+
+    struct Wait_Awaiter
+    {
+        Behavior_Scheduler *scheduler;
+        int list_id;
+
+        bool await_ready() { return false; }
+        void await_suspend(Behavior_Handle h) { scheduler->push(list_id, &h.promise().wait); }
+        void await_resume() {}
+    };
+
+    void init()
+    {
+        now = 0.0;
+        lists.clear();
+        timers.clear();
+        lists.push_back(Behavior_Wait_List{});
+    }
+
+    int make_wait_list()
+    {
+        lists.push_back(Behavior_Wait_List{});
+        return (int)lists.size() - 1;
+    }
+
+    Sleep_Awaiter sleep_for(f32 duration)
+    {
+        return Sleep_Awaiter{this, duration};
+    }
+
+    Wait_Awaiter wait_on(int list_id)
+    {
+        return Wait_Awaiter{this, list_id};
+    }
+
+    void start(Behavior_Task task)
+    {
+        Behavior_Wait *wait = &task.handle.promise().wait;
+        wait->handle = task.handle;
+        wait->list_id = BEHAVIOR_NO_LIST;
+        wait->heap_index = -1;
+        live_count++;
+        push(BEHAVIOR_READY_LIST, wait);
+    }
+
+    // Unhooks the task from whatever it's waiting on and frees its frame
+    void cancel(Behavior_Handle handle)
+    {
+        if (!handle) return;
+        Behavior_Wait *wait = &handle.promise().wait;
+        if (wait->list_id == BEHAVIOR_TIMER_LIST) remove_timer(wait);
+        else if (wait->list_id != BEHAVIOR_NO_LIST) unlink(wait);
+        handle.destroy();
+        live_count--;
+    }
+
+    // Moves up to max_count waiters from the list to the ready list, oldest first
+    void wake(int list_id, int max_count)
+    {
+        Behavior_Wait_List *list = &lists[list_id];
+        while (list->head && max_count-- > 0)
+        {
+            Behavior_Wait *wait = list->head;
+            unlink(wait);
+            push(BEHAVIOR_READY_LIST, wait);
+        }
+    }
+
+    bool has_waiters(int list_id)
+    {
+        return lists[list_id].head != nullptr;
+    }
+
+    void run(f32 delta)
+    {
+        now += delta;
+
+        while (!timers.empty() && timers[0]->wake_time <= now)
+        {
+            Behavior_Wait *wait = timers[0];
+            remove_timer(wait);
+            push(BEHAVIOR_READY_LIST, wait);
+        }
+
+        // Only drain what was ready on entry, anything woken while resuming runs next tick
+        int ready_count = lists[BEHAVIOR_READY_LIST].count;
+        while (ready_count-- > 0)
+        {
+            Behavior_Wait *wait = lists[BEHAVIOR_READY_LIST].head;
+            unlink(wait);
+            wait->handle.resume();
+            resumed_count++;
+        }
+    }
+
+    void push(int list_id, Behavior_Wait *wait)
+    {
+        Behavior_Wait_List *list = &lists[list_id];
+        wait->list_id = list_id;
+        wait->next = nullptr;
+        wait->prev = list->tail;
+        if (list->tail) list->tail->next = wait;
+        else list->head = wait;
+        list->tail = wait;
+        list->count++;
+    }
+
+    void unlink(Behavior_Wait *wait)
+    {
+        Behavior_Wait_List *list = &lists[wait->list_id];
+        if (wait->prev) wait->prev->next = wait->next;
+        else list->head = wait->next;
+        if (wait->next) wait->next->prev = wait->prev;
+        else list->tail = wait->prev;
+        list->count--;
+        wait->prev = nullptr;
+        wait->next = nullptr;
+        wait->list_id = BEHAVIOR_NO_LIST;
+    }
+
+    // Timers: binary min-heap on wake_time, each wait knows its heap slot so it can be cancelled
+    void add_timer(Behavior_Wait *wait, double wake_time)
+    {
+        wait->list_id = BEHAVIOR_TIMER_LIST;
+        wait->wake_time = wake_time;
+        wait->heap_index = (int)timers.size();
+        timers.push_back(wait);
+        sift_up(wait->heap_index);
+    }
+
+    void remove_timer(Behavior_Wait *wait)
+    {
+        int i = wait->heap_index;
+        int last = (int)timers.size() - 1;
+        if (i != last)
+        {
+            swap_timers(i, last);
+        }
+        timers.pop_back();
+        if (i != last)
+        {
+            sift_down(i);
+            sift_up(i);
+        }
+        wait->heap_index = -1;
+        wait->list_id = BEHAVIOR_NO_LIST;
+    }
+
+    void swap_timers(int a, int b)
+    {
+        Behavior_Wait *tmp = timers[a];
+        timers[a] = timers[b];
+        timers[b] = tmp;
+        timers[a]->heap_index = a;
+        timers[b]->heap_index = b;
+    }
+
+    void sift_up(int i)
+    {
+        while (i > 0)
+        {
+            int parent = (i - 1) / 2;
+            if (timers[parent]->wake_time <= timers[i]->wake_time) break;
+            swap_timers(i, parent);
+            i = parent;
+        }
+    }
+
+    void sift_down(int i)
+    {
+        int count = (int)timers.size();
+        for (;;)
+        {
+            int smallest = i;
+            int l = i * 2 + 1;
+            int r = l + 1;
+            if (l < count && timers[l]->wake_time < timers[smallest]->wake_time) smallest = l;
+            if (r < count && timers[r]->wake_time < timers[smallest]->wake_time) smallest = r;
+            if (smallest == i) break;
+            swap_timers(i, smallest);
+            i = smallest;
+        }
+    }
+};
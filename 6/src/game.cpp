@@ -10,8 +10,13 @@
 
 #include "types.hpp"
 
+#include "behavior.cpp"
 #include "gl_tiles.cpp"
+#include "metrics.cpp"
+#include "slab_pool.cpp"
+#include "state_stream.cpp"
 #include "util.hpp"
+#include "world_import.cpp"
 
 struct Payload
 {
@@ -107,6 +112,132 @@ struct Payload
     }
 };
 
+#define PAYLOAD_CHUNK_CAP 13
+#define PAYLOAD_CHUNKS_PER_SLAB 256
+
+// Node buffers are chains of fixed-size chunks allocated from a pool shared by
+// the whole world. Removal swaps the last payload into the hole, so buffer order
+// is not preserved.
+struct Payload_Chunk
+{
+    Payload_Chunk *prev;
+    Payload_Chunk *next;
+    int count;
+    Payload::Kind kinds[PAYLOAD_CHUNK_CAP];
+    float progress[PAYLOAD_CHUNK_CAP];
+};
+static_assert(sizeof(Payload_Chunk) <= 128, "Payload_Chunk should stay within two cache lines");
+
+struct Payload_Queue
+{
+    Payload_Chunk *head = nullptr;
+    Payload_Chunk *tail = nullptr;
+    int count = 0;
+
+    bool push(Slab_Pool *pool, Payload payload, float progress = 0.0f)
+    {
+        if (!tail || tail->count == PAYLOAD_CHUNK_CAP)
+        {
+            Payload_Chunk *chunk = (Payload_Chunk *)pool->alloc();
+            if (!chunk)
+            {
+                return false;
+            }
+            chunk->prev = tail;
+            chunk->next = nullptr;
+            chunk->count = 0;
+            if (tail) tail->next = chunk;
+            else head = chunk;
+            tail = chunk;
+        }
+        tail->kinds[tail->count] = payload.kind;
+        tail->progress[tail->count] = progress;
+        tail->count++;
+        count++;
+        return true;
+    }
+
+    // Finds the chunk and slot holding the index-th payload
+    Payload_Chunk *locate(int index, int *out_slot)
+    {
+        for (Payload_Chunk *chunk = head; chunk; chunk = chunk->next)
+        {
+            if (index < chunk->count)
+            {
+                *out_slot = index;
+                return chunk;
+            }
+            index -= chunk->count;
+        }
+        return nullptr;
+    }
+
+    // Fills the slot with the last payload of the queue.
+    // Returns true if the chunk itself was released (it was the tail and ran empty).
+    bool remove_swap(Slab_Pool *pool, Payload_Chunk *chunk, int slot)
+    {
+        int last = tail->count - 1;
+        chunk->kinds[slot] = tail->kinds[last];
+        chunk->progress[slot] = tail->progress[last];
+        tail->count--;
+        count--;
+
+        if (tail->count == 0)
+        {
+            Payload_Chunk *released = tail;
+            tail = released->prev;
+            if (tail) tail->next = nullptr;
+            else head = nullptr;
+            pool->release(released);
+            return released == chunk;
+        }
+        return false;
+    }
+
+    void move_all_to(Slab_Pool *pool, Payload_Queue *dst)
+    {
+        for (Payload_Chunk *chunk = head; chunk; chunk = chunk->next)
+        {
+            for (int i = 0; i < chunk->count; i++)
+            {
+                dst->push(pool, Payload{chunk->kinds[i]});
+            }
+        }
+        clear(pool);
+    }
+
+    void clear(Slab_Pool *pool)
+    {
+        Payload_Chunk *chunk = head;
+        while (chunk)
+        {
+            Payload_Chunk *next = chunk->next;
+            pool->release(chunk);
+            chunk = next;
+        }
+        head = nullptr;
+        tail = nullptr;
+        count = 0;
+    }
+};
+
+// World wide payload tallies for the metrics, kept by whatever moves a payload so publishing never walks the world
+struct Payload_Census
+{
+    u64 inventory[(int)Payload::Kind::COUNT];
+    u64 input_depth;
+    u64 output_depth;
+    u64 carried_count;
+
+    void add_queue(Payload_Queue *queue)
+    {
+        for (Payload_Chunk *chunk = queue->head; chunk; chunk = chunk->next)
+        {
+            for (int i = 0; i < chunk->count; i++) inventory[(int)chunk->kinds[i]]++;
+        }
+    }
+};
+
 struct Node
 {
     enum class Kind
@@ -123,21 +254,31 @@ struct Node
 
     bool is_window_open = false;
 
-    std::vector<Payload> input_buffer;
-    std::vector<float> progress;
-    std::vector<Payload> output_buffer;
+    Slab_Pool *payload_pool;
+    Payload_Queue input_buffer;
+    Payload_Queue output_buffer;
+
+    // Set once the node is in the world, see Game::add_node
+    Payload_Census *census = nullptr;
+
+    // Behaviors waiting for this node to have output
+    int output_wait_list = BEHAVIOR_NO_LIST;
+
+    // Agents whose behavior isn't started until this node has output, see restart_behavior
+    std::vector<size_t> starting_agents;
 
     float rate = 0.6f;
 
-    Node(const char *name, Kind kind)
+    Node(const char *name, Kind kind, Slab_Pool *payload_pool)
     {
         this->kind = kind;
+        this->payload_pool = payload_pool;
         strcpy(this->name_buf, name);
     }
 
-    Node(const char *name, Kind kind, int random_payload_count) : Node(name, kind)
+    Node(const char *name, Kind kind, Slab_Pool *payload_pool, int random_payload_count) : Node(name, kind, payload_pool)
     {
-        while ((int)output_buffer.size() < random_payload_count)
+        while (output_buffer.count < random_payload_count)
         {
             add_payload_to_output_buffer(Payload::get_random_kind());
         }
@@ -176,13 +317,20 @@ struct Node
 
     void add_payload_to_output_buffer(Payload payload)
     {
-        output_buffer.push_back(payload);
+        if (output_buffer.push(payload_pool, payload) && census)
+        {
+            census->output_depth++;
+            census->inventory[(int)payload.kind]++;
+        }
     }
 
     void add_payload_to_input_buffer(Payload payload)
     {
-        input_buffer.push_back(payload);
-        progress.push_back(0.0f);
+        if (input_buffer.push(payload_pool, payload, 0.0f) && census)
+        {
+            census->input_depth++;
+            census->inventory[(int)payload.kind]++;
+        }
     }
 
     void move_payload_from_input_to_output(int index)
@@ -191,11 +339,17 @@ struct Node
 
     Payload retrieve_random_output_payload()
     {
-        if (output_buffer.size() > 0)
+        if (output_buffer.count > 0)
         {
-            int rand_index = rand() % output_buffer.size();
-            Payload returned = output_buffer[rand_index];
-            output_buffer.erase(output_buffer.begin() + rand_index);
+            int slot;
+            Payload_Chunk *chunk = output_buffer.locate(rand() % output_buffer.count, &slot);
+            Payload returned = Payload{chunk->kinds[slot]};
+            output_buffer.remove_swap(payload_pool, chunk, slot);
+            if (census)
+            {
+                census->output_depth--;
+                census->inventory[(int)returned.kind]--;
+            }
             return returned;
         }
         else
@@ -204,40 +358,69 @@ struct Node
         }
     }
 
+    // move_all_to, keeping the census right even for payloads dropped because the pool couldn't grow
+    void move_input_to_output_counted()
+    {
+        for (Payload_Chunk *chunk = input_buffer.head; chunk; chunk = chunk->next)
+        {
+            for (int i = 0; i < chunk->count; i++)
+            {
+                if (output_buffer.push(payload_pool, Payload{chunk->kinds[i]})) census->output_depth++;
+                else census->inventory[(int)chunk->kinds[i]]--;
+            }
+        }
+        census->input_depth -= input_buffer.count;
+        input_buffer.clear(payload_pool);
+    }
+
     void update_progress(float delta)
     {
         switch (kind)
         {
             case Kind::Storage:
             {
-                if (input_buffer.size() > 0)
+                if (input_buffer.count > 0)
                 {
-                    for (size_t i = 0; i < input_buffer.size(); i++)
-                    {
-                        output_buffer.push_back(input_buffer[i]);
-                    }
-                    input_buffer.clear();
-                    progress.clear();
+                    if (census) move_input_to_output_counted();
+                    else input_buffer.move_all_to(payload_pool, &output_buffer);
                 }
             } break;
 
             case Kind::Transmuter:
             {
-                for (size_t i = 0; i < input_buffer.size();)
+                Payload_Chunk *chunk = input_buffer.head;
+                while (chunk)
                 {
-                    progress[i] += delta * rate;
-                    if (progress[i] > 1.0f)
-                    {
-                        Payload payload = input_buffer[i];
-                        input_buffer.erase(input_buffer.begin() + i);
-                        progress.erase(progress.begin() + i);
-                        payload.transmute();
-                        output_buffer.push_back(payload);
-                    }
-                    else
+                    for (int i = 0; i < chunk->count;)
                     {
-                        i++;
+                        chunk->progress[i] += delta * rate;
+                        if (chunk->progress[i] > 1.0f)
+                        {
+                            Payload payload = Payload{chunk->kinds[i]};
+                            payload.transmute();
+                            bool is_pushed = output_buffer.push(payload_pool, payload);
+                            if (census)
+                            {
+                                census->inventory[(int)chunk->kinds[i]]--;
+                                census->input_depth--;
+                                if (is_pushed)
+                                {
+                                    census->inventory[(int)payload.kind]++;
+                                    census->output_depth++;
+                                }
+                            }
+                            if (input_buffer.remove_swap(payload_pool, chunk, i))
+                            {
+                                chunk = nullptr;
+                                break;
+                            }
+                        }
+                        else
+                        {
+                            i++;
+                        }
                     }
+                    chunk = chunk ? chunk->next : nullptr;
                 }
             } break;
 
@@ -250,15 +433,32 @@ struct Node
 
 struct Agent
 {
+    enum class Behavior
+    {
+        Shuttle,
+        Collector,
+        Wanderer,
+        COUNT
+    };
+
     char name_buf[STR_BUF_SMALL];
     bool is_window_open = false;
+    Behavior behavior = Behavior::Shuttle;
     size_t node_a = 0;
     size_t node_b = 0;
-    float progress = 0.0f;
     float progress_rate = 0.3f;
-    bool travelling_from_b = false;
+
+    // Written by the behavior coroutine
+    bool is_travelling = false;
+    size_t travel_from = 0;
+    size_t travel_to = 0;
+    double travel_start = 0.0;
+    float travel_duration = 0.0f;
     Payload carried_payload{Payload::Kind::NONE};
 
+    Behavior_Handle task = {};
+    bool is_start_pending = false; // queued on node_a's starting_agents, no coroutine yet
+
     Agent(const char *name)
     {
         strcpy(this->name_buf, name);
@@ -269,42 +469,27 @@ struct Agent
         return node_a > 0 && node_b > 0 && node_a != node_b;
     }
 
-    void start_delivery(std::vector<Node> &nodes)
+    bool can_run()
     {
-        size_t which_node = travelling_from_b ? node_b : node_a;
-        carried_payload = nodes[which_node].retrieve_random_output_payload();
+        if (behavior == Behavior::Wanderer) return node_a > 0;
+        return destinations_valid();
     }
 
-    void finish_delivery(std::vector<Node> &nodes)
+    float get_progress(double now)
     {
-        if (!carried_payload.is_none())
-        {
-            size_t node_index;
-            if (!travelling_from_b) node_index = node_b;
-            else node_index = node_a;
-            nodes[node_index].add_payload_to_input_buffer(carried_payload.kind);
-        }
-        travelling_from_b = !travelling_from_b;
-        progress = 0.0f;
+        if (!is_travelling || travel_duration <= 0.0f) return 0.0f;
+        float progress = (float)((now - travel_start) / travel_duration);
+        return progress < 1.0f ? progress : 1.0f;
     }
 
-    void update_progress(std::vector<Node> &nodes, float delta)
+    static const char *get_behavior_str(Behavior behavior)
     {
-        if (destinations_valid())
+        switch (behavior)
         {
-            if (progress <= 0.0f)
-            {
-                start_delivery(nodes);
-            }
-
-            if (carried_payload.kind != Payload::Kind::NONE)
-            {
-                progress += delta * progress_rate;
-                if (progress > 1.0f)
-                {
-                    finish_delivery(nodes);
-                }
-            }
+            case Behavior::Shuttle: return "Shuttle";
+            case Behavior::Collector: return "Collector";
+            case Behavior::Wanderer: return "Wanderer";
+            default: return "UNKNOWN";
         }
     }
 
@@ -323,36 +508,131 @@ struct Agent
     }
 };
 
+#define WANDER_PICK_ATTEMPTS 8
+#define WANDER_IDLE_SECONDS 1.0f
+
 struct Game
 {
     std::vector<Agent> agents;
     std::vector<Node> nodes;
 
+    Slab_Pool payload_pool;
+    Payload_Census census = {};
+    Behavior_Scheduler scheduler;
+    int behavior_pending_count = 0;
+
+    Metrics metrics;
+    Metrics_Server metrics_server;
+    bool metrics_enabled = false;
+    int metrics_port = 9464;
+
+    State_Stream_Server stream_server;
+    int stream_port = 9465;
+    State_Stream_Client viewer;
+    bool is_viewer_open = false;
+
     char agent_list_name_edit_buf[STR_BUF_SMALL];
     char node_list_name_edit_buf[STR_BUF_SMALL];
+    char import_path_buf[STR_BUF_MED] = "res/example_world.csv";
 
     bool alpha_node_exists = false;
 
     void init()
     {
         srand(0);
+        payload_pool.init(sizeof(Payload_Chunk), PAYLOAD_CHUNKS_PER_SLAB);
+        scheduler.init();
         agents.push_back(Agent("NONE"));
-        nodes.push_back(Node("NONE", Node::Kind::NONE));
+        add_node(Node("NONE", Node::Kind::NONE, &payload_pool));
         strcpy(agent_list_name_edit_buf, Agent::get_random_name());
         strcpy(node_list_name_edit_buf, Node::get_random_name());
-    }
 
-    void frame(float delta)
-    {
-        for (size_t i = 1; i < agents.size(); i++)
+        viewer.port = stream_port;
+
+        static_assert((int)Payload::Kind::COUNT <= METRICS_MAX_KINDS, "Metrics slots have no room for every payload kind");
+        metrics.kind_count = (int)Payload::Kind::COUNT;
+        for (int i = 0; i < metrics.kind_count; i++)
         {
-            agents[i].update_progress(nodes, delta);
+            metrics.kind_names[i] = Payload::get_kind_string((Payload::Kind)i);
         }
+    }
+
+    void tick(float delta)
+    {
+        auto tick_start = std::chrono::steady_clock::now();
 
         for (size_t i = 1; i < nodes.size(); i++)
         {
             nodes[i].update_progress(delta);
+
+            int output_count = nodes[i].output_buffer.count;
+            if (output_count > 0 && scheduler.has_waiters(nodes[i].output_wait_list))
+            {
+                scheduler.wake(nodes[i].output_wait_list, output_count);
+            }
+            if (output_count > 0 && !nodes[i].starting_agents.empty())
+            {
+                start_pending_behaviors(i, output_count);
+            }
+        }
+
+        // Only agents whose timer ran out or whose node got output get resumed
+        scheduler.run(delta);
+
+        if (metrics_enabled)
+        {
+            auto tick_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tick_start).count();
+            publish_metrics((u64)tick_ns);
+        }
+
+        if (stream_server.running.load(std::memory_order_relaxed) && state_stream_counts_fit((u32)nodes.size(), (u32)agents.size()))
+        {
+            publish_stream_snapshot();
+        }
+    }
+
+    void publish_stream_snapshot()
+    {
+        State_Snapshot *snapshot = stream_server.begin_publish((u32)nodes.size(), (u32)agents.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            u16 *f = snapshot->node_fields((u32)i);
+            f[0] = State_Snapshot::quantize_count(nodes[i].input_buffer.count);
+            f[1] = State_Snapshot::quantize_count(nodes[i].output_buffer.count);
+        }
+        for (size_t i = 0; i < agents.size(); i++)
+        {
+            u16 *f = snapshot->agent_fields((u32)i);
+            f[0] = State_Snapshot::quantize_progress(agents[i].get_progress(scheduler.now));
+            f[1] = agents[i].is_travelling ? (u16)agents[i].carried_payload.kind : 0;
+        }
+        stream_server.end_publish();
+    }
+
+    // Gauges come from the census, so this costs the same whatever the size of the world
+    void publish_metrics(u64 tick_ns)
+    {
+        Metrics_Slot *slot = metrics.get_thread_slot();
+        metrics.record_tick(slot, tick_ns);
+
+        Metrics::set(slot->agent_count, agents.size() - 1);
+        Metrics::set(slot->node_count, nodes.size() - 1);
+        Metrics::set(slot->input_depth, census.input_depth);
+        Metrics::set(slot->output_depth, census.output_depth);
+        Metrics::set(slot->carried_count, census.carried_count);
+        for (int kind = 0; kind < metrics.kind_count; kind++)
+        {
+            Metrics::set(slot->inventory[kind], census.inventory[kind]);
         }
+    }
+
+    void frame(float delta)
+    {
+        tick(delta);
+
+        draw_metrics_window();
+
+        draw_stream_window();
 
         draw_agent_list_window();
 
@@ -363,6 +643,447 @@ struct Game
         draw_node_windows();
     }
 
+    size_t add_node(const Node &node)
+    {
+        nodes.push_back(node);
+        nodes.back().output_wait_list = scheduler.make_wait_list();
+
+        // Payloads it was made with weren't counted yet
+        Node *added = &nodes.back();
+        added->census = &census;
+        census.input_depth += added->input_buffer.count;
+        census.output_depth += added->output_buffer.count;
+        census.add_queue(&added->input_buffer);
+        census.add_queue(&added->output_buffer);
+        return nodes.size() - 1;
+    }
+
+    // Agent behaviors. Agents are looked up by index after every suspension, the vector may have grown.
+
+    f32 begin_travel(size_t agent_i, size_t from, size_t to, Payload payload)
+    {
+        Agent *agent = &agents[agent_i];
+        agent->is_travelling = true;
+        agent->travel_from = from;
+        agent->travel_to = to;
+        agent->travel_start = scheduler.now;
+        agent->travel_duration = 1.0f / agent->progress_rate;
+        agent->carried_payload = payload;
+        if (!payload.is_none())
+        {
+            census.carried_count++;
+            census.inventory[(int)payload.kind]++;
+        }
+        return agent->travel_duration;
+    }
+
+    void end_travel(size_t agent_i)
+    {
+        Agent *agent = &agents[agent_i];
+        if (!agent->carried_payload.is_none())
+        {
+            census.carried_count--;
+            census.inventory[(int)agent->carried_payload.kind]--;
+            nodes[agent->travel_to].add_payload_to_input_buffer(agent->carried_payload);
+        }
+        agent->carried_payload = Payload::NONE();
+        agent->is_travelling = false;
+    }
+
+    // Carries payloads A -> B and B -> A, waiting at each end until there is something to take
+    Behavior_Task behavior_shuttle(size_t agent_i)
+    {
+        for (bool from_b = false; ; from_b = !from_b)
+        {
+            size_t from = from_b ? agents[agent_i].node_b : agents[agent_i].node_a;
+            size_t to = from_b ? agents[agent_i].node_a : agents[agent_i].node_b;
+            while (nodes[from].output_buffer.count == 0)
+            {
+                co_await scheduler.wait_on(nodes[from].output_wait_list);
+            }
+            co_await scheduler.sleep_for(begin_travel(agent_i, from, to, nodes[from].retrieve_random_output_payload()));
+            end_travel(agent_i);
+        }
+    }
+
+    // Supply line: carries A -> B, walks back to A empty-handed
+    Behavior_Task behavior_collector(size_t agent_i)
+    {
+        for (;;)
+        {
+            size_t a = agents[agent_i].node_a;
+            size_t b = agents[agent_i].node_b;
+            while (nodes[a].output_buffer.count == 0)
+            {
+                co_await scheduler.wait_on(nodes[a].output_wait_list);
+            }
+            co_await scheduler.sleep_for(begin_travel(agent_i, a, b, nodes[a].retrieve_random_output_payload()));
+            end_travel(agent_i);
+            co_await scheduler.sleep_for(begin_travel(agent_i, b, a, Payload::NONE()));
+            end_travel(agent_i);
+        }
+    }
+
+    // Node 0 stands for "no route", other NONE nodes are bad records kept for their number
+    bool is_routable(size_t node_i)
+    {
+        return node_i == 0 || (node_i < nodes.size() && nodes[node_i].kind != Node::Kind::NONE);
+    }
+
+    // Random node other than the one the agent is at, 0 when none turned up in a few tries
+    size_t pick_wander_target(size_t at)
+    {
+        if (nodes.size() <= 2)
+        {
+            return 0;
+        }
+        for (int attempt = 0; attempt < WANDER_PICK_ATTEMPTS; attempt++)
+        {
+            size_t to = 1 + rand() % (nodes.size() - 1);
+            if (to != at && nodes[to].kind != Node::Kind::NONE)
+            {
+                return to;
+            }
+        }
+        return 0;
+    }
+
+    // Starts at A, drops its payload at a random node and waits for that node to hand something back.
+    // With nowhere to go it idles and looks again, the world may grow.
+    Behavior_Task behavior_wanderer(size_t agent_i)
+    {
+        size_t at = agents[agent_i].node_a;
+        for (;;)
+        {
+            while (nodes[at].output_buffer.count == 0)
+            {
+                co_await scheduler.wait_on(nodes[at].output_wait_list);
+            }
+            size_t to = pick_wander_target(at);
+            if (to == 0)
+            {
+                co_await scheduler.sleep_for(WANDER_IDLE_SECONDS);
+                continue;
+            }
+            co_await scheduler.sleep_for(begin_travel(agent_i, at, to, nodes[at].retrieve_random_output_payload()));
+            end_travel(agent_i);
+            at = to;
+        }
+    }
+
+    void stop_behavior(size_t agent_i)
+    {
+        Agent *agent = &agents[agent_i];
+        if (agent->task)
+        {
+            scheduler.cancel(agent->task);
+            agent->task = {};
+        }
+        if (agent->is_start_pending)
+        {
+            // Its entry in starting_agents is skipped when the node gets to it
+            agent->is_start_pending = false;
+            behavior_pending_count--;
+        }
+        // Whatever was in flight goes back where it came from
+        if (!agent->carried_payload.is_none())
+        {
+            census.carried_count--;
+            census.inventory[(int)agent->carried_payload.kind]--;
+        }
+        if (agent->is_travelling && !agent->carried_payload.is_none() && agent->travel_from < nodes.size())
+        {
+            nodes[agent->travel_from].add_payload_to_output_buffer(agent->carried_payload);
+        }
+        agent->carried_payload = Payload::NONE();
+        agent->is_travelling = false;
+    }
+
+    // Every behavior starts by waiting for output at node A, so the coroutine isn't made until there is some.
+    // Idle agents of a big imported world then cost an index on their node instead of a frame.
+    void restart_behavior(size_t agent_i)
+    {
+        stop_behavior(agent_i);
+        Agent *agent = &agents[agent_i];
+        if (!agent->can_run())
+        {
+            return;
+        }
+
+        agent->is_start_pending = true;
+        nodes[agent->node_a].starting_agents.push_back(agent_i);
+        behavior_pending_count++;
+    }
+
+    // Starts up to max_count behaviors queued on the node, skipping agents stopped or restarted elsewhere since
+    void start_pending_behaviors(size_t node_i, int max_count)
+    {
+        std::vector<size_t> *starting = &nodes[node_i].starting_agents;
+        while (!starting->empty() && max_count > 0)
+        {
+            size_t agent_i = starting->back();
+            starting->pop_back();
+            Agent *agent = &agents[agent_i];
+            if (!agent->is_start_pending || agent->node_a != node_i)
+            {
+                continue;
+            }
+            agent->is_start_pending = false;
+            behavior_pending_count--;
+            start_behavior(agent_i);
+            max_count--;
+        }
+    }
+
+    void start_behavior(size_t agent_i)
+    {
+        Behavior_Task task;
+        switch (agents[agent_i].behavior)
+        {
+            case Agent::Behavior::Shuttle: task = behavior_shuttle(agent_i); break;
+            case Agent::Behavior::Collector: task = behavior_collector(agent_i); break;
+            case Agent::Behavior::Wanderer: task = behavior_wanderer(agent_i); break;
+            case Agent::Behavior::COUNT: return;
+        }
+        agents[agent_i].task = task.handle;
+        scheduler.start(task);
+    }
+
+    void stop_all_behaviors()
+    {
+        for (size_t i = 0; i < agents.size(); i++)
+        {
+            if (agents[i].task)
+            {
+                scheduler.cancel(agents[i].task);
+                agents[i].task = {};
+            }
+            agents[i].is_start_pending = false;
+        }
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            nodes[i].starting_agents.clear();
+        }
+        behavior_pending_count = 0;
+    }
+
+    void clear_world()
+    {
+        stop_all_behaviors();
+        nodes.clear();
+        agents.clear();
+        payload_pool.free_all();
+        payload_pool.init(sizeof(Payload_Chunk), PAYLOAD_CHUNKS_PER_SLAB);
+        census = {};
+        scheduler.init();
+        agents.push_back(Agent("NONE"));
+        add_node(Node("NONE", Node::Kind::NONE, &payload_pool));
+        alpha_node_exists = false;
+    }
+
+    // Replaces the current world with the one in the file, see world_import.cpp for the format
+    bool import_world(const char *path)
+    {
+        auto import_start = std::chrono::steady_clock::now();
+
+        Mapped_File file;
+        if (!file.open_read(path))
+        {
+            return false;
+        }
+
+        Csv_Cursor cursor = Csv_Cursor::make(file.data, file.size);
+
+        size_t node_count = 0;
+        size_t agent_count = 0;
+        Csv_Line line;
+        Csv_Cursor header_cursor = cursor;
+        i64 header_nodes, header_agents;
+        i64 records_max = (i64)(file.size / WORLD_RECORD_MIN_BYTES);
+        bool has_header = header_cursor.next_line(&line) && line.fields[0].equals_nocase("world") && line.field_count >= 3 &&
+            line.fields[1].parse_int(&header_nodes) && line.fields[2].parse_int(&header_agents);
+        if (has_header && (header_nodes < 0 || header_agents < 0 || header_nodes > records_max || header_agents > records_max - header_nodes))
+        {
+            warning("%s:%d: world header counts don't fit the file, counting records instead", path, line.line_number);
+            has_header = false;
+        }
+        if (has_header)
+        {
+            node_count = (size_t)header_nodes;
+            agent_count = (size_t)header_agents;
+            cursor = header_cursor;
+        }
+        else
+        {
+            cursor.count_records('n', &node_count);
+            cursor.count_records('a', &agent_count);
+        }
+
+        clear_world();
+        nodes.reserve(node_count + 1);
+        agents.reserve(agent_count + 1);
+
+        char name_buf[STR_BUF_SMALL];
+        int skipped = 0;
+        while (cursor.next_line(&line))
+        {
+            Str_Slice *f = line.fields;
+            if (f[0].equals_nocase("node") && line.field_count >= 3)
+            {
+                Node::Kind kind = Node::Kind::NONE;
+                if (f[2].equals_nocase("storage")) kind = Node::Kind::Storage;
+                else if (f[2].equals_nocase("transmuter")) kind = Node::Kind::Transmuter;
+
+                f32 rate = 0.6f;
+                i64 payload_count = 0;
+                f[1].copy_to(name_buf, sizeof(name_buf));
+                if (kind == Node::Kind::NONE ||
+                    (line.field_count >= 4 && !f[3].parse_float(&rate)) ||
+                    (line.field_count >= 5 && !f[4].parse_int(&payload_count)) ||
+                    !(rate > 0.0f) || payload_count < 0 || payload_count > WORLD_NODE_PAYLOADS_MAX)
+                {
+                    // Keeps its number so the agents after it still point at the right nodes
+                    warning("%s:%d: bad node record", path, line.line_number);
+                    add_node(Node(name_buf, Node::Kind::NONE, &payload_pool));
+                    skipped++;
+                    continue;
+                }
+
+                size_t node_i = add_node(Node(name_buf, kind, &payload_pool, (int)payload_count));
+                nodes[node_i].rate = rate;
+            }
+            else if (f[0].equals_nocase("agent") && line.field_count >= 4)
+            {
+                i64 node_a, node_b;
+                f32 progress_rate = 0.3f;
+                if (!f[2].parse_int(&node_a) || !f[3].parse_int(&node_b) || node_a < 0 || node_b < 0 ||
+                    (line.field_count >= 5 && !f[4].parse_float(&progress_rate)) || !(progress_rate > 0.0f))
+                {
+                    warning("%s:%d: bad agent record", path, line.line_number);
+                    skipped++;
+                    continue;
+                }
+
+                f[1].copy_to(name_buf, sizeof(name_buf));
+                agents.emplace_back(name_buf);
+                agents.back().node_a = (size_t)node_a;
+                agents.back().node_b = (size_t)node_b;
+                agents.back().progress_rate = progress_rate;
+            }
+            else if (f[0].equals_nocase("world"))
+            {
+                continue;
+            }
+            else
+            {
+                warning("%s:%d: unknown record", path, line.line_number);
+                skipped++;
+            }
+        }
+
+        // Agents may name nodes further down the file, so routes are checked once everything is in
+        for (size_t i = 1; i < agents.size(); i++)
+        {
+            if (!is_routable(agents[i].node_a) || !is_routable(agents[i].node_b))
+            {
+                warning("%s: agent %zu routes to a missing or bad node", path, i);
+                agents[i].node_a = 0;
+                agents[i].node_b = 0;
+            }
+            restart_behavior(i);
+        }
+
+        file.close_file();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - import_start).count();
+        trace("Imported %zu nodes, %zu agents from %s in %.3f s (%d records skipped)",
+            nodes.size() - 1, agents.size() - 1, path, seconds, skipped);
+        return true;
+    }
+
+    void shutdown()
+    {
+        metrics_server.stop();
+        stream_server.stop();
+        viewer.disconnect();
+
+        stop_all_behaviors();
+        behavior_free_frame_pools();
+
+        // Payload chunks are not owned by the nodes, the whole pool goes at once
+        nodes.clear();
+        agents.clear();
+        payload_pool.free_all();
+    }
+
+    void draw_metrics_window()
+    {
+        ImGui::Begin("Metrics");
+
+        ImGui::BeginDisabled(metrics_server.running.load());
+        ImGui::InputInt("Port", &metrics_port);
+        ImGui::EndDisabled();
+
+        if (ImGui::Checkbox("Serve on localhost", &metrics_enabled))
+        {
+            if (metrics_enabled)
+            {
+                metrics_enabled = metrics_server.start(&metrics, metrics_port);
+            }
+            else
+            {
+                metrics_server.stop();
+            }
+        }
+
+        if (metrics_server.running.load())
+        {
+            ImGui::BulletText("http://127.0.0.1:%d/metrics", metrics_port);
+        }
+
+        ImGui::End();
+    }
+
+    void draw_stream_window()
+    {
+        ImGui::Begin("Streaming");
+
+        bool is_serving = stream_server.running.load();
+        ImGui::BeginDisabled(is_serving);
+        ImGui::InputInt("Port", &stream_port);
+        ImGui::EndDisabled();
+
+        if (ImGui::Checkbox("Serve state on localhost", &is_serving))
+        {
+            if (is_serving) stream_server.start(stream_port);
+            else stream_server.stop();
+        }
+
+        if (stream_server.running.load())
+        {
+            ImGui::BulletText("Clients: %d", stream_server.client_count.load());
+            ImGui::BulletText("Published: %llu, skipped: %llu",
+                (unsigned long long)stream_server.published_count, (unsigned long long)stream_server.skipped_count);
+            ImGui::BulletText("Encoded: %llu, sent: %llu",
+                (unsigned long long)stream_server.frames_encoded.load(), (unsigned long long)stream_server.frames_sent.load());
+            ImGui::BulletText("Sent: %.1f KB", stream_server.bytes_sent.load() / 1024.0);
+            if (!state_stream_counts_fit((u32)nodes.size(), (u32)agents.size()))
+            {
+                ImGui::BulletText("World too large to stream, nothing is published");
+            }
+        }
+
+        ImGui::Checkbox("Remote viewer", &is_viewer_open);
+
+        ImGui::End();
+
+        viewer.poll_frames();
+        if (is_viewer_open)
+        {
+            viewer.draw_window(metrics.kind_names, metrics.kind_count);
+        }
+    }
+
     void draw_agent_list_window()
     {
         ImGui::Begin("Agents");
@@ -375,6 +1096,9 @@ struct Game
             strcpy(agent_list_name_edit_buf, Agent::get_random_name());
         }
 
+        ImGui::Text("Behaviors: %d running, %d waiting to start, %llu resumes, %.1f MB of frames", scheduler.live_count,
+            behavior_pending_count, (unsigned long long)scheduler.resumed_count, behavior_get_frame_bytes() / (1024.0 * 1024.0));
+
         char item_name_buf[STR_BUF_SMALL];
         for (size_t i = 1; i < agents.size(); i++)
         {
@@ -407,6 +1131,24 @@ struct Game
                 {
                     ImGui::InputText("Name", agents[i].name_buf, sizeof(agents[i].name_buf));
 
+                    if (ImGui::BeginCombo("Behavior", Agent::get_behavior_str(agents[i].behavior), 0))
+                    {
+                        for (int behavior_i = 0; behavior_i < (int)Agent::Behavior::COUNT; behavior_i++)
+                        {
+                            const bool is_selected = (Agent::Behavior)behavior_i == agents[i].behavior;
+                            if (ImGui::Selectable(Agent::get_behavior_str((Agent::Behavior)behavior_i), is_selected))
+                            {
+                                agents[i].behavior = (Agent::Behavior)behavior_i;
+                                restart_behavior(i);
+                            }
+                            if (is_selected)
+                            {
+                                ImGui::SetItemDefaultFocus();
+                            }
+                        }
+                        ImGui::EndCombo();
+                    }
+
                     if (ImGui::BeginCombo("Node A", nodes[agents[i].node_a].name_buf, 0))
                     {
                         for (size_t node_i = 0; node_i < nodes.size(); node_i++)
@@ -415,6 +1157,7 @@ struct Game
                             if (ImGui::Selectable(nodes[node_i].name_buf, is_selected))
                             {
                                 agents[i].node_a = node_i;
+                                restart_behavior(i);
                             }
                             if (is_selected)
                             {
@@ -432,6 +1175,7 @@ struct Game
                             if (ImGui::Selectable(nodes[node_i].name_buf, is_selected))
                             {
                                 agents[i].node_b = node_i;
+                                restart_behavior(i);
                             }
                             if (is_selected)
                             {
@@ -441,11 +1185,15 @@ struct Game
                         ImGui::EndCombo();
                     }
 
-                    if (agents[i].destinations_valid())
+                    if (agents[i].is_travelling)
                     {
-                        ImGui::BulletText("Travel direction: %s", agents[i].travelling_from_b ? "B -> A" : "A -> B");
+                        ImGui::BulletText("Travelling: %s -> %s", nodes[agents[i].travel_from].name_buf, nodes[agents[i].travel_to].name_buf);
                         ImGui::BulletText("Carried payload: %s", agents[i].carried_payload.get_kind_string());
-                        ImGui::BulletText("Progress: %.3f", agents[i].progress);
+                        ImGui::BulletText("Progress: %.3f", agents[i].get_progress(scheduler.now));
+                    }
+                    else if (agents[i].task)
+                    {
+                        ImGui::BulletText("Waiting for payload");
                     }
 
                     ImGui::End();
@@ -462,15 +1210,22 @@ struct Game
         if (ImGui::Button("Add alpha"))
         {
             alpha_node_exists = true;
-            nodes.push_back(Node("Alpha", Node::Kind::Storage, 10));
+            add_node(Node("Alpha", Node::Kind::Storage, &payload_pool, 10));
         }
         ImGui::EndDisabled();
 
+        ImGui::InputText("File", import_path_buf, sizeof(import_path_buf));
+        ImGui::SameLine();
+        if (ImGui::Button("Import"))
+        {
+            import_world(import_path_buf);
+        }
+
         ImGui::InputText("Name", node_list_name_edit_buf, sizeof(node_list_name_edit_buf));
         ImGui::SameLine();
         if (ImGui::Button("Add transmuter"))
         {
-            nodes.push_back(Node(node_list_name_edit_buf, Node::Kind::Transmuter));
+            add_node(Node(node_list_name_edit_buf, Node::Kind::Transmuter, &payload_pool));
             strcpy(node_list_name_edit_buf, Node::get_random_name());
         }
 
@@ -526,17 +1281,23 @@ struct Game
                     }
 
                     ImGui::Text("Input buffer:");
-                    for (size_t input_i = 0; input_i < node_it->input_buffer.size(); input_i++)
+                    for (Payload_Chunk *chunk = node_it->input_buffer.head; chunk; chunk = chunk->next)
                     {
-                        ImGui::BulletText("%s. Progress: %.2f",
-                            node_it->input_buffer[input_i].get_kind_string(),
-                            node_it->progress[input_i] * 100.0f);
+                        for (int input_i = 0; input_i < chunk->count; input_i++)
+                        {
+                            ImGui::BulletText("%s. Progress: %.2f",
+                                Payload::get_kind_string(chunk->kinds[input_i]),
+                                chunk->progress[input_i] * 100.0f);
+                        }
                     }
 
                     ImGui::Text("Output buffer:");
-                    for (auto input_it = node_it->output_buffer.begin(); input_it != node_it->output_buffer.end(); input_it++)
+                    for (Payload_Chunk *chunk = node_it->output_buffer.head; chunk; chunk = chunk->next)
                     {
-                        ImGui::BulletText("%s", input_it->get_kind_string());
+                        for (int output_i = 0; output_i < chunk->count; output_i++)
+                        {
+                            ImGui::BulletText("%s", Payload::get_kind_string(chunk->kinds[output_i]));
+                        }
                     }
 
                     ImGui::End();
@@ -10,6 +10,7 @@
 #include <stb_image.h>
 
 #include "lin_math.cpp"
+#include "gl_state.cpp"
 
 namespace GLTiles
 {
@@ -74,10 +75,10 @@ namespace GLTiles
         glGenBuffers(1, &vb->vbo);
         glGenBuffers(1, &vb->ebo);
 
-        glBindVertexArray(vb->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vb->vbo);
+        gl_bind_vao(vb->vao);
+        gl_bind_buffer(GL_ARRAY_BUFFER, vb->vbo);
         glBufferData(GL_ARRAY_BUFFER, vb_max_vert_size(vb), NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vb->ebo);
+        gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, vb->ebo);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, vb_max_index_size(vb), NULL, GL_DYNAMIC_DRAW);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)0);
         glEnableVertexAttribArray(0);
@@ -87,7 +88,7 @@ namespace GLTiles
         glEnableVertexAttribArray(2);
         glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vert), (void *)(offsetof(Vert, bg)));
         glEnableVertexAttribArray(3);
-        glBindVertexArray(0);
+        gl_bind_vao(0);
 
         return vb;
     }
@@ -103,6 +104,7 @@ namespace GLTiles
         glDeleteBuffers(1, &vb->vbo);
         glDeleteBuffers(1, &vb->ebo);
         glDeleteVertexArrays(1, &vb->vao);
+        gl_state_forget();
         free(vb);
     }
 
@@ -132,12 +134,12 @@ namespace GLTiles
 
     static void vb_draw_call(const Vert_Buf *vb)
     {
-        glBindVertexArray(vb->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vb->vbo);
+        gl_bind_vao(vb->vao);
+        gl_bind_buffer(GL_ARRAY_BUFFER, vb->vbo);
         glBufferData(GL_ARRAY_BUFFER, vb_max_vert_size(vb), NULL, GL_DYNAMIC_DRAW);
         glBufferSubData(GL_ARRAY_BUFFER, 0, vb_vert_size(vb), vb->verts);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vb->ebo);
+        gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, vb->ebo);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, vb_max_index_size(vb), NULL, GL_DYNAMIC_DRAW);
         glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vb_index_size(vb), vb->indices);
 
@@ -233,11 +235,11 @@ namespace GLTiles
 
         GLuint prog = gl_create_shader_program(vs_src, fs_src);
 
-        glUseProgram(prog);
+        gl_use_program(prog);
         m4 ident = m4_identity();
-        glUniformMatrix4fv(glGetUniformLocation(prog, "uMvp"), 1, GL_FALSE, ident.d);
-        glUniform1i(glGetUniformLocation(prog, "uTex"), 0);
-        glUseProgram(0);
+        glUniformMatrix4fv(gl_uniform_location(prog, "uMvp"), 1, GL_FALSE, ident.d);
+        glUniform1i(gl_uniform_location(prog, "uTex"), 0);
+        gl_use_program(0);
 
         return prog;
     }
@@ -264,13 +266,13 @@ namespace GLTiles
         else if (tex.ch == 1) { tex.internal_format = GL_R8; tex.format = GL_RED; }
 
         glGenTextures(1, &tex.texture_id);
-        glBindTexture(GL_TEXTURE_2D, tex.texture_id);
+        gl_bind_texture(0, tex.texture_id);
         glTexImage2D(GL_TEXTURE_2D, 0, tex.internal_format, tex.w, tex.h, 0, tex.format, GL_UNSIGNED_BYTE, tex_data);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampling_type);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampling_type);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        gl_bind_texture(0, 0);
 
         stbi_image_free(tex_data);
 
@@ -280,5 +282,6 @@ namespace GLTiles
     static void gl_delete_texture(Texture *tex)
     {
         glDeleteTextures(1, &tex->texture_id);
+        gl_state_forget();
     }
 }
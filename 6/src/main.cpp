@@ -1,4 +1,9 @@
+#include <chrono>
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 #include <OpenGL/gl3.h>
 #include <GLFW/glfw3.h>
@@ -19,8 +24,77 @@ void on_mouse_cursor(GLFWwindow* window, double xpos, double ypos)
 {
 }
 
-int main()
+static volatile sig_atomic_t g_headless_quit = 0;
+
+static void on_headless_signal(int sig)
+{
+    g_headless_quit = 1;
+}
+
+// Runs the simulation without a window, serving state to viewers and metrics to scrapers
+int run_headless(const char *world_path, int stream_port, int metrics_port)
 {
+    Game game = {};
+    game.init();
+    game.stream_port = stream_port;
+
+    if (world_path && !game.import_world(world_path))
+    {
+        return 1;
+    }
+
+    if (!game.stream_server.start(stream_port))
+    {
+        return 1;
+    }
+
+    if (metrics_port > 0)
+    {
+        game.metrics_port = metrics_port;
+        game.metrics_enabled = game.metrics_server.start(&game.metrics, metrics_port);
+    }
+
+    signal(SIGINT, on_headless_signal);
+    signal(SIGTERM, on_headless_signal);
+
+    f32 delta = 1/120.0f;
+    auto next_tick = std::chrono::steady_clock::now();
+    while (!g_headless_quit)
+    {
+        game.tick(delta);
+        next_tick += std::chrono::microseconds((int)(delta * 1e6f));
+        std::this_thread::sleep_until(next_tick);
+    }
+
+    trace("Shutting down");
+    game.shutdown();
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *world_path = NULL;
+    int serve_port = 0;
+    int metrics_port = 0;
+    int view_port = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--world") == 0 && i + 1 < argc) world_path = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) serve_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) metrics_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--view") == 0 && i + 1 < argc) view_port = atoi(argv[++i]);
+        else
+        {
+            printf("usage: %s [--world file.csv] [--serve port [--metrics port]] [--view port]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (serve_port > 0)
+    {
+        return run_headless(world_path, serve_port, metrics_port);
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -74,6 +148,17 @@ int main()
     Game game = {};
     game.init();
 
+    if (world_path)
+    {
+        game.import_world(world_path);
+    }
+
+    if (view_port > 0)
+    {
+        game.is_viewer_open = true;
+        game.viewer.connect_to(view_port);
+    }
+
     while (!glfwWindowShouldClose(window))
     {
         glfwPollEvents();
@@ -95,13 +180,15 @@ int main()
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
+        GLTiles::gl_state_begin_frame();
+
         glClearColor(0.86f, 0.18f, 0.26f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(tiles_shader);
-        glBindTexture(GL_TEXTURE_2D, tex.texture_id);
+        GLTiles::gl_use_program(tiles_shader);
+        GLTiles::gl_bind_texture(0, tex.texture_id);
         m4 proj = m4_proj_ortho(0, w, h, 0, -1, 1);
-        glUniformMatrix4fv(glGetUniformLocation(tiles_shader, "uMvp"), 1, GL_FALSE, proj.d);
+        glUniformMatrix4fv(GLTiles::gl_uniform_location(tiles_shader, "uMvp"), 1, GL_FALSE, proj.d);
 
         game.frame(delta);
 
@@ -114,6 +201,8 @@ int main()
         glfwSwapBuffers(window);
     }
 
+    game.shutdown();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+#define METRICS_MAX_THREADS 8
+#define METRICS_MAX_KINDS 32
+#define METRICS_RESPONSE_MAX (STR_BUF_LARGE * 16)
+
+// Upper bounds of the tick latency histogram, in seconds. One extra +Inf bucket follows.
+static const double metrics_tick_bucket_bounds[] =
+{
+    0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.05,
+};
+#define METRICS_TICK_BUCKET_COUNT ((int)array_size(metrics_tick_bucket_bounds) + 1)
+
+// Everything a thread writes lives in its own slot, padded to a cache line, so
+// the scraper only ever does relaxed loads from lines the tick thread owns.
+struct alignas(64) Metrics_Slot
+{
+    std::atomic<u64> ticks;
+    std::atomic<u64> tick_ns_total;
+    std::atomic<u64> tick_buckets[METRICS_TICK_BUCKET_COUNT];
+
+    std::atomic<u64> agent_count;
+    std::atomic<u64> node_count;
+    std::atomic<u64> input_depth;
+    std::atomic<u64> output_depth;
+    std::atomic<u64> carried_count;
+    std::atomic<u64> inventory[METRICS_MAX_KINDS];
+};
+
+struct Metrics
+{
+    Metrics_Slot slots[METRICS_MAX_THREADS];
+    std::atomic<int> slot_count;
+
+    const char *kind_names[METRICS_MAX_KINDS];
+    int kind_count;
+
+    Metrics_Slot *get_thread_slot()
+    {
+        thread_local int slot_index = -1;
+        if (slot_index < 0)
+        {
+            slot_index = slot_count.fetch_add(1, std::memory_order_relaxed);
+            if (slot_index >= METRICS_MAX_THREADS)
+            {
+                warning("Out of metrics slots, sharing the last one");
+                slot_index = METRICS_MAX_THREADS - 1;
+            }
+        }
+        return &slots[slot_index];
+    }
+
+    static void add(std::atomic<u64> &counter, u64 value)
+    {
+        // Only the owning thread writes a slot, no need for a locked add
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static void set(std::atomic<u64> &gauge, u64 value)
+    {
+        gauge.store(value, std::memory_order_relaxed);
+    }
+
+    void record_tick(Metrics_Slot *slot, u64 tick_ns)
+    {
+        double seconds = tick_ns / 1e9;
+        int bucket = 0;
+        while (bucket < METRICS_TICK_BUCKET_COUNT - 1 && seconds > metrics_tick_bucket_bounds[bucket])
+        {
+            bucket++;
+        }
+        add(slot->tick_buckets[bucket], 1);
+        add(slot->tick_ns_total, tick_ns);
+        add(slot->ticks, 1);
+    }
+
+    u64 sum(std::atomic<u64> Metrics_Slot::*field)
+    {
+        u64 total = 0;
+        int count = slot_count.load(std::memory_order_relaxed);
+        if (count > METRICS_MAX_THREADS) count = METRICS_MAX_THREADS;
+        for (int i = 0; i < count; i++)
+        {
+            total += (slots[i].*field).load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    u64 sum_bucket(int bucket)
+    {
+        u64 total = 0;
+        int count = slot_count.load(std::memory_order_relaxed);
+        if (count > METRICS_MAX_THREADS) count = METRICS_MAX_THREADS;
+        for (int i = 0; i < count; i++)
+        {
+            total += slots[i].tick_buckets[bucket].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    u64 sum_inventory(int kind)
+    {
+        u64 total = 0;
+        int count = slot_count.load(std::memory_order_relaxed);
+        if (count > METRICS_MAX_THREADS) count = METRICS_MAX_THREADS;
+        for (int i = 0; i < count; i++)
+        {
+            total += slots[i].inventory[kind].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+struct Metrics_Writer
+{
+    char *buf;
+    size_t cap;
+    size_t len;
+
+    void append(const char *fmt, ...)
+    {
+        if (len >= cap) return;
+        va_list args;
+        va_start(args, fmt);
+        int written = vsnprintf(buf + len, cap - len, fmt, args);
+        va_end(args);
+        if (written > 0) len += written;
+        if (len > cap) len = cap;
+    }
+};
+
+// Serves GET /metrics in the Prometheus text exposition format on 127.0.0.1
+struct Metrics_Server
+{
+    Metrics *metrics = nullptr;
+    int listen_fd = -1;
+    int port = 0;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    bool start(Metrics *metrics, int port)
+    {
+        if (running.load()) return true;
+
+        this->metrics = metrics;
+        this->port = port;
+
+        signal(SIGPIPE, SIG_IGN);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            warning("Metrics: socket() failed: %s", strerror(errno));
+            return false;
+        }
+
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((u16)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0)
+        {
+            warning("Metrics: can't listen on 127.0.0.1:%d: %s", port, strerror(errno));
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+
+        running.store(true);
+        thread = std::thread([this]() { serve(); });
+        trace("Metrics: serving on http://127.0.0.1:%d/metrics", port);
+        return true;
+    }
+
+    void stop()
+    {
+        if (!running.load()) return;
+        running.store(false);
+        thread.join();
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+    void serve()
+    {
+        static char response[METRICS_RESPONSE_MAX + STR_BUF_MED];
+        static char body[METRICS_RESPONSE_MAX];
+
+        while (running.load())
+        {
+            pollfd pfd = {listen_fd, POLLIN, 0};
+            if (poll(&pfd, 1, 100) <= 0) continue;
+
+            int client_fd = accept(listen_fd, NULL, NULL);
+            if (client_fd < 0) continue;
+
+            char request[STR_BUF_LARGE];
+            ssize_t request_len = recv(client_fd, request, sizeof(request) - 1, 0);
+            request[request_len > 0 ? request_len : 0] = 0;
+
+            const char *status = "200 OK";
+            Metrics_Writer w = {body, sizeof(body), 0};
+            if (strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0)
+            {
+                write_exposition(&w);
+            }
+            else
+            {
+                status = "404 Not Found";
+                w.append("Not found, try /metrics\n");
+            }
+
+            int response_len = snprintf(response, sizeof(response),
+                "HTTP/1.1 %s\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\n"
+                "Connection: close\r\n"
+                "\r\n"
+                "%.*s", status, w.len, (int)w.len, body);
+            if (response_len > (int)sizeof(response)) response_len = sizeof(response);
+
+            for (int sent = 0; sent < response_len;)
+            {
+                ssize_t n = send(client_fd, response + sent, response_len - sent, 0);
+                if (n <= 0) break;
+                sent += n;
+            }
+            close(client_fd);
+        }
+    }
+
+    void write_exposition(Metrics_Writer *w)
+    {
+        // No rate gauge: scrapes don't share an interval, rate(sim_ticks_total[...]) gives the tick rate
+        u64 ticks = metrics->sum(&Metrics_Slot::ticks);
+
+        w->append("# HELP sim_ticks_total Simulation ticks since start.\n");
+        w->append("# TYPE sim_ticks_total counter\n");
+        w->append("sim_ticks_total %llu\n", (unsigned long long)ticks);
+
+        w->append("# HELP sim_tick_duration_seconds Time spent updating agents and nodes per tick.\n");
+        w->append("# TYPE sim_tick_duration_seconds histogram\n");
+        u64 cumulative = 0;
+        for (int i = 0; i < METRICS_TICK_BUCKET_COUNT; i++)
+        {
+            cumulative += metrics->sum_bucket(i);
+            if (i < METRICS_TICK_BUCKET_COUNT - 1)
+            {
+                w->append("sim_tick_duration_seconds_bucket{le=\"%g\"} %llu\n", metrics_tick_bucket_bounds[i], (unsigned long long)cumulative);
+            }
+            else
+            {
+                w->append("sim_tick_duration_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+            }
+        }
+        w->append("sim_tick_duration_seconds_sum %f\n", metrics->sum(&Metrics_Slot::tick_ns_total) / 1e9);
+        w->append("sim_tick_duration_seconds_count %llu\n", (unsigned long long)cumulative);
+
+        w->append("# HELP sim_entities Number of live entities.\n");
+        w->append("# TYPE sim_entities gauge\n");
+        w->append("sim_entities{kind=\"agent\"} %llu\n", (unsigned long long)metrics->sum(&Metrics_Slot::agent_count));
+        w->append("sim_entities{kind=\"node\"} %llu\n", (unsigned long long)metrics->sum(&Metrics_Slot::node_count));
+
+        w->append("# HELP sim_queue_depth Payloads waiting in node buffers.\n");
+        w->append("# TYPE sim_queue_depth gauge\n");
+        w->append("sim_queue_depth{buffer=\"input\"} %llu\n", (unsigned long long)metrics->sum(&Metrics_Slot::input_depth));
+        w->append("sim_queue_depth{buffer=\"output\"} %llu\n", (unsigned long long)metrics->sum(&Metrics_Slot::output_depth));
+        w->append("sim_queue_depth{buffer=\"carried\"} %llu\n", (unsigned long long)metrics->sum(&Metrics_Slot::carried_count));
+
+        w->append("# HELP sim_inventory Payloads in the world by kind.\n");
+        w->append("# TYPE sim_inventory gauge\n");
+        for (int kind = 1; kind < metrics->kind_count; kind++)
+        {
+            w->append("sim_inventory{kind=\"%s\"} %llu\n", metrics->kind_names[kind], (unsigned long long)metrics->sum_inventory(kind));
+        }
+    }
+};
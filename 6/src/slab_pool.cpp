@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdlib>
+
+#include "util.hpp"
+
+// Fixed-size block allocator. Blocks are carved out of big slabs and recycled
+// through an intrusive free list, so once the pool has warmed up alloc/release
+// never touch malloc. Everything is handed back in one go by free_all().
+struct Slab_Pool
+{
+    struct Free_Block
+    {
+        Free_Block *next;
+    };
+
+    struct Slab
+    {
+        Slab *next;
+        size_t _pad;
+    };
+
+    size_t block_size = 0;
+    int blocks_per_slab = 0;
+
+    Slab *slabs = nullptr;
+    Free_Block *free_list = nullptr;
+
+    int slab_count = 0;
+    int used_count = 0;
+
+    void init(size_t block_size, int blocks_per_slab)
+    {
+        // Keep every block 16 byte aligned
+        size_t min_size = block_size < sizeof(Free_Block) ? sizeof(Free_Block) : block_size;
+        this->block_size = (min_size + 15) & ~(size_t)15;
+        this->blocks_per_slab = blocks_per_slab;
+        slabs = nullptr;
+        free_list = nullptr;
+        slab_count = 0;
+        used_count = 0;
+    }
+
+    void grow()
+    {
+        Slab *slab = (Slab *)malloc(sizeof(Slab) + block_size * blocks_per_slab);
+        if (!slab)
+        {
+            warning("Slab allocation failed (%zu bytes)", sizeof(Slab) + block_size * blocks_per_slab);
+            return;
+        }
+        slab->next = slabs;
+        slabs = slab;
+        slab_count++;
+
+        u8 *blocks = (u8 *)(slab + 1);
+        for (int i = blocks_per_slab - 1; i >= 0; i--)
+        {
+            Free_Block *block = (Free_Block *)(blocks + block_size * i);
+            block->next = free_list;
+            free_list = block;
+        }
+    }
+
+    void *alloc()
+    {
+        if (!free_list)
+        {
+            grow();
+            if (!free_list) return nullptr;
+        }
+        Free_Block *block = free_list;
+        free_list = block->next;
+        used_count++;
+        return block;
+    }
+
+    void release(void *ptr)
+    {
+        Free_Block *block = (Free_Block *)ptr;
+        block->next = free_list;
+        free_list = block;
+        used_count--;
+    }
+
+    void free_all()
+    {
+        Slab *slab = slabs;
+        while (slab)
+        {
+            Slab *next = slab->next;
+            free(slab);
+            slab = next;
+        }
+        slabs = nullptr;
+        free_list = nullptr;
+        slab_count = 0;
+        used_count = 0;
+    }
+
+    size_t get_reserved_bytes()
+    {
+        return (size_t)slab_count * (sizeof(Slab) + block_size * blocks_per_slab);
+    }
+};
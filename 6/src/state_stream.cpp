@@ -0,0 +1,654 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <imgui.h>
+
+#include "util.hpp"
+
+/*
+ * Streams quantized simulation state to viewers over TCP on 127.0.0.1.
+ *
+ * A snapshot is a flat array of u16 fields: two per node (input count, output
+ * count) followed by two per agent (progress in 1/65535ths, carried payload kind).
+ *
+ * Server -> client frame:
+ *   State_Stream_Header, then (skip, zigzag delta) varint pairs for every field
+ *   that differs from the baseline snapshot. baseline_tick is
+ *   STATE_STREAM_NO_BASELINE for keyframes, which are deltas against all zeros.
+ *
+ * Client -> server: a u32 tick, acking the newest snapshot it has rebuilt. Send
+ * STATE_STREAM_NO_BASELINE to ask for a keyframe.
+ *
+ * Worlds with more than STATE_STREAM_MAX_ENTITIES nodes and agents are not
+ * streamed, viewers drop any frame claiming more.
+ *
+ * The tick thread only quantizes into a snapshot ring. Encoding happens on the
+ * stream thread, once per distinct client baseline, and the bytes are shared by
+ * every client acked at that baseline.
+ */
+
+#define STATE_STREAM_MAGIC 0x52545344u // "DSTR"
+#define STATE_STREAM_NO_BASELINE 0xFFFFFFFFu
+#define STATE_STREAM_RING 64
+#define STATE_STREAM_NODE_FIELDS 2
+#define STATE_STREAM_AGENT_FIELDS 2
+#define STATE_STREAM_MAX_CLIENTS 16
+#define STATE_STREAM_MAX_FRAME (64u * 1024 * 1024)
+#define STATE_STREAM_MAX_ENTITIES (16u * 1024 * 1024) // nodes + agents, a full snapshot is then at most 64 MB
+
+struct State_Stream_Header
+{
+    u32 magic;
+    u32 payload_size;
+    u32 tick;
+    u32 baseline_tick;
+    u32 node_count;
+    u32 agent_count;
+};
+
+// Headers come off the wire, the counts are checked before anything is sized by them
+static bool state_stream_counts_fit(u32 node_count, u32 agent_count)
+{
+    return (u64)node_count + agent_count <= STATE_STREAM_MAX_ENTITIES;
+}
+
+struct State_Snapshot
+{
+    u32 tick = STATE_STREAM_NO_BASELINE;
+    u32 node_count = 0;
+    u32 agent_count = 0;
+    std::vector<u16> fields;
+
+    void resize(u32 node_count, u32 agent_count)
+    {
+        this->node_count = node_count;
+        this->agent_count = agent_count;
+        fields.resize((size_t)node_count * STATE_STREAM_NODE_FIELDS + (size_t)agent_count * STATE_STREAM_AGENT_FIELDS);
+    }
+
+    u16 *node_fields(u32 node_i)
+    {
+        return fields.data() + (size_t)node_i * STATE_STREAM_NODE_FIELDS;
+    }
+
+    u16 *agent_fields(u32 agent_i)
+    {
+        return fields.data() + (size_t)node_count * STATE_STREAM_NODE_FIELDS + (size_t)agent_i * STATE_STREAM_AGENT_FIELDS;
+    }
+
+    static u16 quantize_count(int count)
+    {
+        return (u16)(count < 0 ? 0 : count > 0xFFFF ? 0xFFFF : count);
+    }
+
+    static u16 quantize_progress(f32 progress)
+    {
+        if (progress <= 0.0f) return 0;
+        if (progress >= 1.0f) return 0xFFFF;
+        return (u16)(progress * 65535.0f + 0.5f);
+    }
+};
+
+static void stream_put_varint(std::vector<u8> *out, u32 value)
+{
+    while (value >= 0x80)
+    {
+        out->push_back((u8)(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back((u8)value);
+}
+
+static bool stream_get_varint(const u8 **at, const u8 *end, u32 *out)
+{
+    u32 value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (*at >= end) return false;
+        u8 byte = *(*at)++;
+        value |= (u32)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *out = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Baseline value of the field at index i of a snapshot laid out like cur
+static inline u16 stream_baseline_field(const State_Snapshot *base, const State_Snapshot *cur, size_t i)
+{
+    if (!base) return 0;
+    size_t node_fields = (size_t)cur->node_count * STATE_STREAM_NODE_FIELDS;
+    if (i < node_fields)
+    {
+        return i < (size_t)base->node_count * STATE_STREAM_NODE_FIELDS ? base->fields[i] : 0;
+    }
+    size_t agent_i = i - node_fields;
+    if (agent_i < (size_t)base->agent_count * STATE_STREAM_AGENT_FIELDS)
+    {
+        return base->fields[(size_t)base->node_count * STATE_STREAM_NODE_FIELDS + agent_i];
+    }
+    return 0;
+}
+
+static void state_stream_encode(const State_Snapshot *base, const State_Snapshot *cur, std::vector<u8> *out)
+{
+    out->clear();
+    out->resize(sizeof(State_Stream_Header));
+
+    bool same_layout = base && base->node_count == cur->node_count && base->agent_count == cur->agent_count;
+    size_t last_changed = 0;
+    for (size_t i = 0; i < cur->fields.size(); i++)
+    {
+        u16 before = same_layout ? base->fields[i] : stream_baseline_field(base, cur, i);
+        u16 after = cur->fields[i];
+        if (before != after)
+        {
+            i32 diff = (i32)after - (i32)before;
+            stream_put_varint(out, (u32)(i - last_changed));
+            stream_put_varint(out, (u32)((diff << 1) ^ (diff >> 31)));
+            last_changed = i;
+        }
+    }
+
+    State_Stream_Header header = {
+        STATE_STREAM_MAGIC,
+        (u32)(out->size() - sizeof(State_Stream_Header)),
+        cur->tick,
+        base ? base->tick : STATE_STREAM_NO_BASELINE,
+        cur->node_count,
+        cur->agent_count,
+    };
+    memcpy(out->data(), &header, sizeof(header));
+}
+
+static bool state_stream_decode(const State_Stream_Header *header, const u8 *payload, const State_Snapshot *base, State_Snapshot *out)
+{
+    out->tick = header->tick;
+    out->resize(header->node_count, header->agent_count);
+    if (base && base->node_count == out->node_count && base->agent_count == out->agent_count)
+    {
+        memcpy(out->fields.data(), base->fields.data(), out->fields.size() * sizeof(u16));
+    }
+    else
+    {
+        for (size_t i = 0; i < out->fields.size(); i++)
+        {
+            out->fields[i] = stream_baseline_field(base, out, i);
+        }
+    }
+
+    const u8 *at = payload;
+    const u8 *end = payload + header->payload_size;
+    size_t field_i = 0;
+    while (at < end)
+    {
+        u32 skip, zigzag;
+        if (!stream_get_varint(&at, end, &skip) || !stream_get_varint(&at, end, &zigzag))
+        {
+            return false;
+        }
+        field_i += skip;
+        if (field_i >= out->fields.size())
+        {
+            return false;
+        }
+        i32 diff = (i32)(zigzag >> 1) ^ -(i32)(zigzag & 1);
+        out->fields[field_i] = (u16)((i32)out->fields[field_i] + diff);
+    }
+    return true;
+}
+
+static void stream_set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+}
+
+struct State_Stream_Server
+{
+    struct Client
+    {
+        int fd;
+        u32 acked_tick;
+        u8 ack_buf[4];
+        int ack_len;
+        std::vector<u8> pending;
+        size_t pending_sent;
+    };
+
+    struct Encoded_Frame
+    {
+        u32 baseline_tick;
+        std::vector<u8> bytes;
+    };
+
+    int listen_fd = -1;
+    int port = 0;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    // Guarded by ring_mutex
+    std::mutex ring_mutex;
+    State_Snapshot ring[STATE_STREAM_RING];
+    u32 latest_tick = STATE_STREAM_NO_BASELINE;
+
+    // Tick thread only
+    State_Snapshot scratch;
+    u32 next_tick = 0;
+    u64 published_count = 0;
+    u64 skipped_count = 0;
+
+    // Stream thread only
+    std::vector<Client> clients;
+    std::vector<Encoded_Frame> encoded;
+    u32 sent_tick = STATE_STREAM_NO_BASELINE;
+
+    std::atomic<int> client_count;
+    std::atomic<u64> frames_encoded;
+    std::atomic<u64> frames_sent;
+    std::atomic<u64> bytes_sent;
+
+    bool start(int port)
+    {
+        if (running.load()) return true;
+
+        this->port = port;
+        signal(SIGPIPE, SIG_IGN);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            warning("State stream: socket() failed: %s", strerror(errno));
+            return false;
+        }
+
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((u16)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0)
+        {
+            warning("State stream: can't listen on 127.0.0.1:%d: %s", port, strerror(errno));
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        stream_set_nonblocking(listen_fd);
+
+        running.store(true);
+        thread = std::thread([this]() { serve(); });
+        trace("State stream: serving on 127.0.0.1:%d", port);
+        return true;
+    }
+
+    void stop()
+    {
+        if (!running.load()) return;
+        running.store(false);
+        thread.join();
+        for (Client &client : clients)
+        {
+            close(client.fd);
+        }
+        clients.clear();
+        client_count.store(0);
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+    // Tick thread: fill the returned snapshot, then call end_publish()
+    State_Snapshot *begin_publish(u32 node_count, u32 agent_count)
+    {
+        scratch.resize(node_count, agent_count);
+        return &scratch;
+    }
+
+    void end_publish()
+    {
+        // Never wait on the stream thread, if it's busy encoding this tick is simply not streamed
+        if (!ring_mutex.try_lock())
+        {
+            skipped_count++;
+            return;
+        }
+        scratch.tick = next_tick;
+        ring[next_tick % STATE_STREAM_RING].fields.swap(scratch.fields);
+        State_Snapshot *slot = &ring[next_tick % STATE_STREAM_RING];
+        slot->tick = scratch.tick;
+        slot->node_count = scratch.node_count;
+        slot->agent_count = scratch.agent_count;
+        latest_tick = next_tick;
+        ring_mutex.unlock();
+
+        next_tick++;
+        published_count++;
+    }
+
+    // Stream thread, ring_mutex held
+    State_Snapshot *find_snapshot(u32 tick)
+    {
+        if (tick == STATE_STREAM_NO_BASELINE || latest_tick == STATE_STREAM_NO_BASELINE) return nullptr;
+        if (tick > latest_tick || latest_tick - tick >= STATE_STREAM_RING) return nullptr;
+        State_Snapshot *snapshot = &ring[tick % STATE_STREAM_RING];
+        return snapshot->tick == tick ? snapshot : nullptr;
+    }
+
+    const std::vector<u8> *get_encoded(State_Snapshot *cur, u32 baseline_tick)
+    {
+        State_Snapshot *base = find_snapshot(baseline_tick);
+        u32 key = base ? base->tick : STATE_STREAM_NO_BASELINE;
+        for (Encoded_Frame &frame : encoded)
+        {
+            if (frame.baseline_tick == key) return &frame.bytes;
+        }
+        encoded.push_back(Encoded_Frame{key, {}});
+        state_stream_encode(base, cur, &encoded.back().bytes);
+        frames_encoded.fetch_add(1, std::memory_order_relaxed);
+        return &encoded.back().bytes;
+    }
+
+    void drop_client(size_t i)
+    {
+        close(clients[i].fd);
+        clients.erase(clients.begin() + i);
+        client_count.store((int)clients.size());
+    }
+
+    bool flush_client(Client *client)
+    {
+        while (client->pending_sent < client->pending.size())
+        {
+            ssize_t n = send(client->fd, client->pending.data() + client->pending_sent,
+                client->pending.size() - client->pending_sent, 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            if (n <= 0) return false;
+            client->pending_sent += n;
+            bytes_sent.fetch_add(n, std::memory_order_relaxed);
+        }
+        client->pending.clear();
+        client->pending_sent = 0;
+        return true;
+    }
+
+    bool read_acks(Client *client)
+    {
+        u8 buf[STR_BUF_MED];
+        for (;;)
+        {
+            ssize_t n = recv(client->fd, buf, sizeof(buf), 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            if (n <= 0) return false;
+            for (ssize_t i = 0; i < n; i++)
+            {
+                client->ack_buf[client->ack_len++] = buf[i];
+                if (client->ack_len == 4)
+                {
+                    memcpy(&client->acked_tick, client->ack_buf, 4);
+                    client->ack_len = 0;
+                }
+            }
+        }
+    }
+
+    void serve()
+    {
+        std::vector<pollfd> pfds;
+        while (running.load())
+        {
+            pfds.clear();
+            pfds.push_back(pollfd{listen_fd, POLLIN, 0});
+            for (Client &client : clients)
+            {
+                short events = POLLIN;
+                if (!client.pending.empty()) events |= POLLOUT;
+                pfds.push_back(pollfd{client.fd, events, 0});
+            }
+            poll(pfds.data(), pfds.size(), 2);
+
+            if (pfds[0].revents & POLLIN)
+            {
+                int fd = accept(listen_fd, NULL, NULL);
+                if (fd >= 0 && clients.size() < STATE_STREAM_MAX_CLIENTS)
+                {
+                    stream_set_nonblocking(fd);
+                    clients.push_back(Client{fd, STATE_STREAM_NO_BASELINE, {}, 0, {}, 0});
+                    client_count.store((int)clients.size());
+                }
+                else if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+
+            for (size_t i = 0; i < clients.size();)
+            {
+                if (!read_acks(&clients[i]) || !flush_client(&clients[i]))
+                {
+                    drop_client(i);
+                }
+                else
+                {
+                    i++;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            if (latest_tick == STATE_STREAM_NO_BASELINE || latest_tick == sent_tick) continue;
+
+            State_Snapshot *cur = &ring[latest_tick % STATE_STREAM_RING];
+            encoded.clear();
+            for (Client &client : clients)
+            {
+                // Clients still draining an earlier frame skip this one, their next delta covers it
+                if (!client.pending.empty()) continue;
+                const std::vector<u8> *bytes = get_encoded(cur, client.acked_tick);
+                client.pending.assign(bytes->begin(), bytes->end());
+                client.pending_sent = 0;
+                frames_sent.fetch_add(1, std::memory_order_relaxed);
+            }
+            sent_tick = latest_tick;
+        }
+    }
+};
+
+struct State_Stream_Client
+{
+    int fd = -1;
+    int port = 0;
+    bool connected = false;
+
+    std::vector<u8> recv_buf;
+    State_Snapshot history[STATE_STREAM_RING];
+    State_Snapshot *latest = nullptr;
+
+    u64 frames_received = 0;
+    u64 keyframes_received = 0;
+    u64 bytes_received = 0;
+
+    bool connect_to(int port)
+    {
+        disconnect();
+        this->port = port;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((u16)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            warning("State stream: can't connect to 127.0.0.1:%d: %s", port, strerror(errno));
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        stream_set_nonblocking(fd);
+        connected = true;
+        return true;
+    }
+
+    void disconnect()
+    {
+        if (fd >= 0) close(fd);
+        fd = -1;
+        connected = false;
+        recv_buf.clear();
+        latest = nullptr;
+        for (State_Snapshot &snapshot : history)
+        {
+            snapshot.tick = STATE_STREAM_NO_BASELINE;
+        }
+    }
+
+    void send_ack(u32 tick)
+    {
+        u8 buf[4];
+        memcpy(buf, &tick, 4);
+        // Acks are tiny, if the socket can't take one the next frame will ack again
+        send(fd, buf, 4, 0);
+    }
+
+    State_Snapshot *find_snapshot(u32 tick)
+    {
+        if (tick == STATE_STREAM_NO_BASELINE) return nullptr;
+        State_Snapshot *snapshot = &history[tick % STATE_STREAM_RING];
+        return snapshot->tick == tick ? snapshot : nullptr;
+    }
+
+    // Call once per frame, never blocks
+    void poll_frames()
+    {
+        if (!connected) return;
+
+        u8 buf[STR_BUF_LARGE * 16];
+        for (;;)
+        {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0)
+            {
+                warning("State stream: server closed the connection");
+                disconnect();
+                return;
+            }
+            recv_buf.insert(recv_buf.end(), buf, buf + n);
+            bytes_received += n;
+        }
+
+        size_t consumed = 0;
+        while (recv_buf.size() - consumed >= sizeof(State_Stream_Header))
+        {
+            State_Stream_Header header;
+            memcpy(&header, recv_buf.data() + consumed, sizeof(header));
+            if (header.magic != STATE_STREAM_MAGIC || header.payload_size > STATE_STREAM_MAX_FRAME ||
+                !state_stream_counts_fit(header.node_count, header.agent_count))
+            {
+                warning("State stream: bad frame header");
+                disconnect();
+                return;
+            }
+            if (recv_buf.size() - consumed < sizeof(header) + header.payload_size) break;
+
+            const u8 *payload = recv_buf.data() + consumed + sizeof(header);
+            consumed += sizeof(header) + header.payload_size;
+
+            State_Snapshot *base = find_snapshot(header.baseline_tick);
+            if (header.baseline_tick != STATE_STREAM_NO_BASELINE && !base)
+            {
+                // Lost the baseline somehow, start over from a keyframe
+                send_ack(STATE_STREAM_NO_BASELINE);
+                continue;
+            }
+
+            State_Snapshot *out = &history[header.tick % STATE_STREAM_RING];
+            if (out == base)
+            {
+                warning("State stream: baseline too old for history ring");
+                send_ack(STATE_STREAM_NO_BASELINE);
+                continue;
+            }
+            if (!state_stream_decode(&header, payload, base, out))
+            {
+                warning("State stream: corrupt frame for tick %u", header.tick);
+                out->tick = STATE_STREAM_NO_BASELINE;
+                send_ack(STATE_STREAM_NO_BASELINE);
+                continue;
+            }
+
+            latest = out;
+            frames_received++;
+            if (!base) keyframes_received++;
+            send_ack(out->tick);
+        }
+        recv_buf.erase(recv_buf.begin(), recv_buf.begin() + consumed);
+    }
+
+    void draw_window(const char **kind_names, int kind_count)
+    {
+        ImGui::Begin("Remote viewer");
+
+        ImGui::BeginDisabled(connected);
+        ImGui::InputInt("Port", &port);
+        ImGui::EndDisabled();
+        if (!connected)
+        {
+            if (ImGui::Button("Connect")) connect_to(port);
+        }
+        else
+        {
+            if (ImGui::Button("Disconnect")) disconnect();
+        }
+
+        ImGui::BulletText("Frames: %llu (%llu keyframes)", (unsigned long long)frames_received, (unsigned long long)keyframes_received);
+        ImGui::BulletText("Received: %.1f KB", bytes_received / 1024.0);
+
+        if (latest)
+        {
+            ImGui::SeparatorText("Nodes");
+            ImGui::Text("Tick %u", latest->tick);
+            for (u32 i = 1; i < latest->node_count; i++)
+            {
+                u16 *f = latest->node_fields(i);
+                ImGui::BulletText("Node %u: in %u, out %u", i, f[0], f[1]);
+            }
+
+            ImGui::SeparatorText("Agents");
+            for (u32 i = 1; i < latest->agent_count; i++)
+            {
+                u16 *f = latest->agent_fields(i);
+                const char *kind = f[1] < kind_count ? kind_names[f[1]] : "UNKNOWN";
+                ImGui::BulletText("Agent %u: %s, %.3f", i, kind, f[0] / 65535.0f);
+            }
+        }
+
+        ImGui::End();
+    }
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <strings.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+/*
+ * World files are plain CSV, one record per line, '#' starts a comment line:
+ *
+ *   world,<node count>,<agent count>             optional, lets the loader skip its counting pass
+ *   node,<name>,<Storage|Transmuter>[,<rate>[,<random payload count>]]
+ *   agent,<name>,<node a>,<node b>[,<progress rate>]
+ *
+ * Nodes are numbered in file order starting at 1 (0 is the NONE node), agents
+ * refer to them by that number. A bad node record still takes its number, as a
+ * NONE node that agents can't be routed to, so later nodes keep theirs.
+ *
+ * The world header is only a hint: counts that don't fit the file are ignored
+ * and the records counted instead.
+ */
+
+#define WORLD_RECORD_MIN_BYTES 10 // "agent,,0,0" without the newline, node records are longer
+#define WORLD_NODE_PAYLOADS_MAX 100000
+
+struct Mapped_File
+{
+    const char *data = nullptr;
+    size_t size = 0;
+    int fd = -1;
+
+    bool open_read(const char *path)
+    {
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            warning("Can't open %s: %s", path, strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+        {
+            warning("Can't stat %s: %s", path, strerror(errno));
+            close_file();
+            return false;
+        }
+
+        size = (size_t)st.st_size;
+        if (size == 0)
+        {
+            return true;
+        }
+
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            warning("Can't mmap %s: %s", path, strerror(errno));
+            close_file();
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = (const char *)mapped;
+        return true;
+    }
+
+    void close_file()
+    {
+        if (data) munmap((void *)data, size);
+        if (fd >= 0) close(fd);
+        data = nullptr;
+        size = 0;
+        fd = -1;
+    }
+};
+
+// Points into the mapped file, never owns or terminates anything
+struct Str_Slice
+{
+    const char *data;
+    int len;
+
+    bool equals_nocase(const char *str)
+    {
+        return (int)strlen(str) == len && strncasecmp(data, str, len) == 0;
+    }
+
+    void copy_to(char *buf, size_t buf_size)
+    {
+        size_t n = (size_t)len < buf_size - 1 ? (size_t)len : buf_size - 1;
+        memcpy(buf, data, n);
+        buf[n] = 0;
+    }
+
+    bool parse_int(i64 *out)
+    {
+        int i = 0;
+        bool negative = false;
+        if (i < len && (data[i] == '-' || data[i] == '+'))
+        {
+            negative = data[i] == '-';
+            i++;
+        }
+        if (i == len) return false;
+
+        i64 value = 0;
+        for (; i < len; i++)
+        {
+            char c = data[i];
+            if (c < '0' || c > '9') return false;
+            if (value > (INT64_MAX - (c - '0')) / 10) return false;
+            value = value * 10 + (c - '0');
+        }
+        *out = negative ? -value : value;
+        return true;
+    }
+
+    // Plain decimals only ("0.6", "-12", ".25"), that's all the world files use
+    bool parse_float(f32 *out)
+    {
+        int i = 0;
+        bool negative = false;
+        if (i < len && (data[i] == '-' || data[i] == '+'))
+        {
+            negative = data[i] == '-';
+            i++;
+        }
+
+        double value = 0.0;
+        bool has_digits = false;
+        for (; i < len && data[i] >= '0' && data[i] <= '9'; i++)
+        {
+            value = value * 10.0 + (data[i] - '0');
+            has_digits = true;
+        }
+        if (i < len && data[i] == '.')
+        {
+            i++;
+            double scale = 0.1;
+            for (; i < len && data[i] >= '0' && data[i] <= '9'; i++)
+            {
+                value += (data[i] - '0') * scale;
+                scale *= 0.1;
+                has_digits = true;
+            }
+        }
+        if (i != len || !has_digits) return false;
+
+        *out = (f32)(negative ? -value : value);
+        return true;
+    }
+};
+
+#define CSV_MAX_FIELDS 8
+
+struct Csv_Line
+{
+    Str_Slice fields[CSV_MAX_FIELDS];
+    int field_count;
+    int line_number;
+};
+
+struct Csv_Cursor
+{
+    const char *at;
+    const char *end;
+    int line_number;
+
+    static Csv_Cursor make(const char *data, size_t size)
+    {
+        return Csv_Cursor{data, data + size, 0};
+    }
+
+    // Skips blank and comment lines. Fields are trimmed of spaces and '\r'.
+    bool next_line(Csv_Line *line)
+    {
+        while (at < end)
+        {
+            const char *line_start = at;
+            const char *line_end = (const char *)memchr(at, '\n', end - at);
+            if (!line_end) line_end = end;
+            at = line_end < end ? line_end + 1 : end;
+            line_number++;
+
+            while (line_end > line_start && (line_end[-1] == '\r' || line_end[-1] == ' '))
+            {
+                line_end--;
+            }
+            while (line_start < line_end && line_start[0] == ' ')
+            {
+                line_start++;
+            }
+            if (line_start == line_end || line_start[0] == '#')
+            {
+                continue;
+            }
+
+            line->field_count = 0;
+            line->line_number = line_number;
+            const char *field_start = line_start;
+            for (const char *p = line_start; ; p++)
+            {
+                if (p == line_end || *p == ',')
+                {
+                    const char *a = field_start;
+                    const char *b = p;
+                    while (a < b && *a == ' ') a++;
+                    while (b > a && b[-1] == ' ') b--;
+                    if (line->field_count < CSV_MAX_FIELDS)
+                    {
+                        line->fields[line->field_count++] = Str_Slice{a, (int)(b - a)};
+                    }
+                    field_start = p + 1;
+                    if (p == line_end) break;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Counts records by their first letter, without splitting fields
+    void count_records(char first_char, size_t *out_count)
+    {
+        const char *p = at;
+        size_t count = 0;
+        while (p < end)
+        {
+            if (*p == first_char) count++;
+            const char *line_end = (const char *)memchr(p, '\n', end - p);
+            if (!line_end) break;
+            p = line_end + 1;
+        }
+        *out_count = count;
+    }
+};